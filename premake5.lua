@@ -5,6 +5,32 @@
 sources = {
   "./src/**.cpp",
 }
+-- Sources which need window or OpenGL (not used by tools)
+renderer_only_sources = {
+  "./src/main.cpp",
+  "./src/glsl_classes.cpp",
+  "./src/fps_counter.cpp",
+  "./src/headless_gl.cpp",
+}
+
+-- SIMD of CPU renderer packets
+newoption {
+  trigger = "simd",
+  value = "ISA",
+  description = "Instruction set of CPU ray packets",
+  allowed = {
+    { "sse", "SSE2 (4 lanes)" },
+    { "avx2", "AVX2 (8 lanes)" },
+    { "avx512", "AVX-512 (16 lanes)" },
+    { "native", "Instruction sets of this machine" },
+  }
+}
+simd_buildoptions = {
+  sse = { "-msse2" },
+  avx2 = { "-mavx2", "-mfma" },
+  avx512 = { "-mavx512f", "-mavx2", "-mfma" },
+  native = { "-march=native" },
+}
 
 workspace "GlslRenderWorkspace"
   configurations { "release", "debug" }
@@ -13,7 +39,10 @@ workspace "GlslRenderWorkspace"
 
   includedirs { "/usr/local/include" }
   libdirs { "/usr/local/lib" }
-  buildoptions { "-fpermissive" }
+  buildoptions { "-fpermissive", "-std=c++11" }
+  if _OPTIONS["simd"] then
+    buildoptions { simd_buildoptions[_OPTIONS["simd"]] }
+  end
 
   -- Links
   configuration { "macosx", "gmake" }
@@ -24,7 +53,7 @@ workspace "GlslRenderWorkspace"
     -- for Arch Linux
 --     links { "GLEW", "glfw", "GLU", "GL" }
     -- for Other linux
-    links { "GLEW", "glfw3", "GLU", "GL" }
+    links { "GLEW", "glfw3", "GLU", "GL", "EGL" }
     links { "X11", "Xrandr", "Xi", "Xxf86vm", "Xcursor", "Xinerama" }
     links { "pthread", "dl" }
 
@@ -40,3 +69,27 @@ workspace "GlslRenderWorkspace"
   project( "renderer" )
     kind "ConsoleApp"
     files { sources }
+
+  project( "bvh_bench" )
+    kind "ConsoleApp"
+    includedirs { "./src" }
+    files { sources, "./tools/bvh_bench.cpp" }
+    removefiles { renderer_only_sources }
+
+  project( "bvh_layout_bench" )
+    kind "ConsoleApp"
+    includedirs { "./src" }
+    files { sources, "./tools/bvh_layout_bench.cpp" }
+    removefiles { renderer_only_sources }
+
+  project( "cpu_render" )
+    kind "ConsoleApp"
+    includedirs { "./src" }
+    files { sources, "./tools/cpu_render.cpp" }
+    removefiles { renderer_only_sources }
+
+  project( "scene_convert" )
+    kind "ConsoleApp"
+    includedirs { "./src" }
+    files { sources, "./tools/scene_convert.cpp" }
+    removefiles { renderer_only_sources }
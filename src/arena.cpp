@@ -0,0 +1,42 @@
+#include "arena.h"
+
+#include <cstdlib>
+#include <new>
+
+using namespace std;
+
+/* Arena */
+Arena::Arena(size_t block_size)
+	: block_size(block_size), block_used(0), block_capacity(0), allocated_size(0) {
+}
+Arena::~Arena(){
+	release();
+}
+void* Arena::allocate(size_t size, size_t align){
+	lock_guard<std::mutex> lock(mutex);
+	// Align in current block
+	size_t offset = (block_used + align - 1) / align * align;
+	if(blocks.empty() || offset + size > block_capacity){
+		// New block (large requests get their own block)
+		size_t capacity = max(block_size, size + align);
+		char* block = static_cast<char*>(malloc(capacity));
+		if(block == NULL) throw bad_alloc();
+		blocks.push_back(block);
+		block_capacity = capacity;
+		allocated_size += capacity;
+		// Align the start of new block
+		size_t base = reinterpret_cast<size_t>(block);
+		offset = (base + align - 1) / align * align - base;
+	}
+	block_used = offset + size;
+	return blocks.back() + offset;
+}
+void Arena::release(){
+	lock_guard<std::mutex> lock(mutex);
+	for(int i = 0; i < blocks.size(); i++){
+		free(blocks[i]);
+	}
+	blocks.clear();
+	block_used = block_capacity = 0;
+	allocated_size = 0;
+}
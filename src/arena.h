@@ -0,0 +1,29 @@
+#ifndef ARENA_H_261017
+#define ARENA_H_261017
+
+#include <cstddef>
+#include <vector>
+#include <mutex>
+
+/* Bump allocator for temporary buffers (released all at once) */
+class Arena {
+public:
+	Arena(size_t block_size = 1 << 20);
+	~Arena();
+	// Thread safe (no constructor is called)
+	void* allocate(size_t size, size_t align = 16);
+	template<typename T>
+	T* allocArray(size_t count) {
+		return static_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
+	}
+	// Free all blocks
+	void release();
+	size_t getAllocatedSize() const { return allocated_size; }
+private:
+	std::vector<char*> blocks;
+	size_t block_size, block_used, block_capacity;
+	size_t allocated_size;
+	std::mutex mutex;
+};
+
+#endif
@@ -1,190 +1,555 @@
 #include "bvh.h"
 
+#include <cstdlib>
+#include <new>
+
+#include "arena.h"
+#include "bvh_build.h"
+
 using namespace glm;
 using namespace std;
 
 
-Triangle::Triangle(vec3 v0, vec3 v1, vec3 v2, int tri_idx){
-	this->v[0] = v0;
-	this->v[1] = v1;
-	this->v[2] = v2;
-	this->center = (v0+v1+v2) / 3.0f;
-	this->tri_idx = tri_idx;
-}
-
-
-/* BVH Node */
-Node::Node(){
-}
-void Node::walkAndDelete(){
-	if(is_leaf) return;
-	left->walkAndDelete();
-	right->walkAndDelete();
-	delete left, right;
-}
-// Triangle sort functions
-bool lessTriangleCenterX(const Triangle* t0, const Triangle* t1){ return t0->center.x < t1->center.x; }
-bool lessTriangleCenterY(const Triangle* t0, const Triangle* t1){ return t0->center.y < t1->center.y; }
-bool lessTriangleCenterZ(const Triangle* t0, const Triangle* t1){ return t0->center.z < t1->center.z; }
-void sortTrianglesCenter(vector<Triangle*>& tris_p, int axis){
-	if(axis == 0) sort(tris_p.begin(), tris_p.end(), lessTriangleCenterX);
-	else if(axis == 1) sort(tris_p.begin(), tris_p.end(), lessTriangleCenterY);
-	else if(axis == 2) sort(tris_p.begin(), tris_p.end(), lessTriangleCenterZ);
-}
-// AABB functions
-inline float min(float a, float b){ return (a > b) ? b : a; }
-inline float max(float a, float b){ return (a > b) ? a : b; }
-inline vec3 max(const vec3& a, const vec3& b){
-	return vec3(max(a.x, b.x), max(a.y, b.y), max(a.z, b.z));
-}
-inline vec3 min(const vec3& a, const vec3& b){
-	return vec3(min(a.x, b.x), min(a.y, b.y), min(a.z, b.z));
-}
-void calcBboxMinMaxPoint(const vector<Triangle*>& tris_p, vec3& min_point, vec3& max_point){
-	// Get min, max point
-	min_point = vec3( INFINITY,  INFINITY,  INFINITY);
-	max_point = vec3(-INFINITY, -INFINITY, -INFINITY);
-	for(int i = 0; i < tris_p.size(); i++){
-		for(int v_idx = 0; v_idx < 3; v_idx++){
-			min_point = min(min_point, tris_p[i]->v[v_idx]);
-			max_point = max(max_point, tris_p[i]->v[v_idx]);
-		}
-	}
-	return;
+/* BVH Nodes */
+BVHNodes::BVHNodes() : min_points(NULL), max_points(NULL), lefts(NULL), rights(NULL),
+                       tri_starts(NULL), tri_ends(NULL), capacity(0), count(0) {
+}
+BVHNodes::~BVHNodes(){
+	clear();
+}
+template<typename T>
+void reallocArray(T*& array, int size){
+	void* ptr = realloc(array, sizeof(T) * max(size, 1));
+	if(ptr == NULL) throw bad_alloc();
+	array = static_cast<T*>(ptr);
+}
+void BVHNodes::allocate(int capacity){
+	clear();
+	reallocArray(min_points, capacity);
+	reallocArray(max_points, capacity);
+	reallocArray(lefts, capacity);
+	reallocArray(rights, capacity);
+	reallocArray(tri_starts, capacity);
+	reallocArray(tri_ends, capacity);
+	this->capacity = capacity;
+}
+void BVHNodes::clear(){
+	free(min_points);
+	free(max_points);
+	free(lefts);
+	free(rights);
+	free(tri_starts);
+	free(tri_ends);
+	min_points = max_points = NULL;
+	lefts = rights = tri_starts = tri_ends = NULL;
+	capacity = count = 0;
+}
+void BVHNodes::shrink(){
+	if(capacity == count) return;
+	reallocArray(min_points, count);
+	reallocArray(max_points, count);
+	reallocArray(lefts, count);
+	reallocArray(rights, count);
+	reallocArray(tri_starts, count);
+	reallocArray(tri_ends, count);
+	capacity = count;
+}
+int BVHNodes::add(int count){
+	int node_idx = this->count.fetch_add(count);
+	assert(node_idx + count <= capacity);
+	return node_idx;
+}
+void BVHNodes::setLeaf(int node_idx, int tri_start, int tri_end){
+	lefts[node_idx] = rights[node_idx] = -1;
+	tri_starts[node_idx] = tri_start;
+	tri_ends[node_idx] = tri_end;
+}
+void BVHNodes::setInternal(int node_idx, int left, int right){
+	lefts[node_idx] = left;
+	rights[node_idx] = right;
+	tri_starts[node_idx] = tri_ends[node_idx] = -1;
 }
+
+
 float surface(const vec3& min_point, const vec3& max_point){
 	// Surface
 	vec3 diff = max_point - min_point;
 	return (diff.x*diff.y + diff.y*diff.z + diff.z*diff.x) * 2;
 }
-float surface(const vector<Triangle*>& tris_p){
-	vec3 min_point, max_point;
-	calcBboxMinMaxPoint(tris_p, min_point, max_point);
-	return surface(min_point, max_point);
+
+/* Build helpers */
+void initTriangleRefs(const vector<vec3>& tri_vertices, BuildRef* refs, ThreadPool& pool){
+	int tri_count = tri_vertices.size() / 3;
+	parallelFor(pool, 0, tri_count, PARALLEL_CHUNK_TRIS, [&](int begin, int end){
+		for(int tri_idx = begin; tri_idx < end; tri_idx++){
+			const vec3* v = &tri_vertices[3 * tri_idx];
+			refs[tri_idx].min_point = min(min(v[0], v[1]), v[2]);
+			refs[tri_idx].max_point = max(max(v[0], v[1]), v[2]);
+			refs[tri_idx].tri_idx = tri_idx;
+		}
+	});
 }
-// Build tree returning node count
-int Node::build(vector<Triangle*>& tris_p, int node_idx, int depth, int max_depth){
-	this->node_idx = node_idx;
-	int node_count = node_idx + 1;
+void calcRefBounds(const BuildRef* refs, int ref_count, RefBounds& bounds, ThreadPool& pool){
+	int chunk_count = getChunkCount(ref_count);
+	bounds.init();
+	if(chunk_count == 1){
+		bounds.grow(refs, ref_count);
+		return;
+	}
+	RefBounds chunk_bounds[MAX_PARALLEL_CHUNKS];
+	parallelFor(pool, 0, chunk_count, 1, [&](int begin, int end){
+		for(int c = begin; c < end; c++){
+			int ref_begin = getChunkBegin(ref_count, chunk_count, c);
+			int ref_end = getChunkBegin(ref_count, chunk_count, c + 1);
+			chunk_bounds[c].init();
+			chunk_bounds[c].grow(refs + ref_begin, ref_end - ref_begin);
+		}
+	});
+	for(int c = 0; c < chunk_count; c++) bounds.grow(chunk_bounds[c]);
+}
+
+/* Build context */
+struct BuildContext {
+	BVHNodes* nodes;
+	BuildRef* refs;
+	float* surfaces;   // sweep buffer (same range as refs)
+	int bin_count, max_depth;
+	ThreadPool* pool;
+};
+
+/* Sweep SAH (reference) */
+struct LessRefCenter {
+	LessRefCenter(int axis) : axis(axis) {}
+	bool operator()(const BuildRef& r0, const BuildRef& r1) const {
+		float c0 = r0.min_point[axis] + r0.max_point[axis];
+		float c1 = r1.min_point[axis] + r1.max_point[axis];
+		return (c0 != c1) ? c0 < c1 : r0.tri_idx < r1.tri_idx;
+	}
+	int axis;
+};
+void buildSweepNode(BuildContext& ctx, int node_idx, int begin, int ref_count, int depth){
+	BVHNodes& nodes = *ctx.nodes;
+	BuildRef* refs = ctx.refs + begin;
+	float* right_surfaces = ctx.surfaces + begin;
 
 	//Bounding Box Coordinates
-	calcBboxMinMaxPoint(tris_p, this->bbox_min_point, this->bbox_max_point);
+	RefBounds bounds;
+	bounds.init();
+	bounds.grow(refs, ref_count);
+	nodes.min_points[node_idx] = bounds.min_point;
+	nodes.max_points[node_idx] = bounds.max_point;
 
 	//Search best position to devide
-	vector<Triangle*> best_right, best_left;
-	float total_surface = surface(this->bbox_min_point, this->bbox_max_point);
-	float best_cost = TRI_TIME * tris_p.size();// *surface(tris_p)/surface(tris_p)
-	for(int axis = 0; axis < 3; axis++){
+	int best_axis = -1, best_left_count = -1;
+	float total_surface = surface(bounds.min_point, bounds.max_point);
+	float best_cost = TRI_TIME * ref_count;
+	for(int axis = 0; axis < 3 && total_surface > 0; axis++){
 		// Sort center coordinates
-		sortTrianglesCenter(tris_p, axis);
-		// Devide temporary
-		for(int idx = 1; idx < tris_p.size()-1; idx++){
-			vector<Triangle*> left(tris_p.begin(), tris_p.begin() + idx);
-			vector<Triangle*> right(tris_p.begin() + idx, tris_p.end());
+		sort(refs, refs + ref_count, LessRefCenter(axis));
+		// Sweep from right (right_surfaces[i] : surface of [i, ref_count))
+		RefBounds right_bounds;
+		right_bounds.init();
+		for(int i = ref_count - 1; i > 0; i--){
+			right_bounds.grow(refs + i, 1);
+			right_surfaces[i] = surface(right_bounds.min_point, right_bounds.max_point);
+		}
+		// Sweep from left
+		RefBounds left_bounds;
+		left_bounds.init();
+		for(int i = 1; i < ref_count; i++){
+			left_bounds.grow(refs + i - 1, 1);
 			// Calc SAH
 			float cost = 2 * AABB_TIME +
-				(surface(left)*left.size() + surface(right)*right.size()) * TRI_TIME / total_surface;
-
+				(surface(left_bounds.min_point, left_bounds.max_point) * i +
+				 right_surfaces[i] * (ref_count - i)) * TRI_TIME / total_surface;
 			// Update
-			if(cost <= best_cost){
+			if(cost < best_cost){
 				best_cost = cost;
-				best_left = left;
-				best_right = right;
+				best_axis = axis;
+				best_left_count = i;
 			}
 		}
 	}
 
-	if(best_left.size() == 0 || best_right.size() == 0 || (max_depth > 0 && depth >= max_depth)){
-		//Set
-		this->is_leaf = true;
-		this->tris_p = tris_p;
-		return node_count;
+	if(best_axis < 0 || (ctx.max_depth > 0 && depth >= ctx.max_depth)){
+		nodes.setLeaf(node_idx, begin, begin + ref_count);
+		return;
 	}
-	//Set
-	this->is_leaf = false;
-	this->left = new Node();
-	this->right = new Node();
+	//Devide
+	if(best_axis != 2) sort(refs, refs + ref_count, LessRefCenter(best_axis));
+	int left = nodes.add(2);
+	nodes.setInternal(node_idx, left, left + 1);
 	//Recursive call
-	node_count = this->left->build(best_left, node_count, depth + 1, max_depth);
-	node_count = this->right->build(best_right, node_count, depth + 1, max_depth);
-	return node_count;
-}
-// Walk hit link and get bbox info
-void Node::getBboxInfo(vector<glm::vec3>& bbox_minmax_array, vector<int>& tri_array, vector<int>& tri_idx_info){
-	// min, max points
-// 	assert(bbox_minmax_array.size() == node_idx * 2);
-	bbox_minmax_array.push_back(this->bbox_min_point);
-	bbox_minmax_array.push_back(this->bbox_max_point);
-	// triangles
-	if(this->is_leaf){
-		// start triangle index
-		tri_idx_info.push_back(tri_array.size());
-		// triangle array
-		for(int i = 0; i < this->tris_p.size(); i++){
-			tri_array.push_back(this->tris_p[i]->tri_idx);
+	buildSweepNode(ctx, left, begin, best_left_count, depth + 1);
+	buildSweepNode(ctx, left + 1, begin + best_left_count, ref_count - best_left_count, depth + 1);
+}
+
+
+/* Binned SAH */
+void putRefsIntoBins(const BuildRef* refs, int ref_count, const SahBinning& binning,
+                     SahBinSet& bin_set, ThreadPool& pool){
+	int chunk_count = getChunkCount(ref_count);
+	bin_set.init(binning.bin_count);
+	if(chunk_count == 1){
+		binning.putRefs(refs, ref_count, bin_set);
+		return;
+	}
+	vector<SahBinSet> chunk_bin_sets(chunk_count);
+	parallelFor(pool, 0, chunk_count, 1, [&](int begin, int end){
+		for(int c = begin; c < end; c++){
+			int ref_begin = getChunkBegin(ref_count, chunk_count, c);
+			int ref_end = getChunkBegin(ref_count, chunk_count, c + 1);
+			chunk_bin_sets[c].init(binning.bin_count);
+			binning.putRefs(refs + ref_begin, ref_end - ref_begin, chunk_bin_sets[c]);
+		}
+	});
+	for(int c = 0; c < chunk_count; c++){
+		for(int axis = 0; axis < 3; axis++){
+			for(int b = 0; b < binning.bin_count; b++){
+				bin_set.bins[axis][b].grow(chunk_bin_sets[c].bins[axis][b]);
+			}
 		}
-		// end triangle index
-		tri_idx_info.push_back(tri_array.size());
 	}
-	else{
-		// triangle array index
-		tri_idx_info.push_back(-1);
-		tri_idx_info.push_back(-1);
+}
+SahSplit findBinnedSplit(const SahBinSet& bin_set, const SahBinning& binning,
+                         float total_surface, float leaf_cost){
+	int bin_count = binning.bin_count;
+	SahBin right_bins[MAX_BIN_COUNT];
+	SahSplit best;
+	best.axis = best.bin_idx = -1;
+	best.cost = leaf_cost;
+	for(int axis = 0; axis < 3 && total_surface > 0; axis++){
+		if(binning.bin_scale[axis] <= 0) continue;
+		const SahBin* bins = bin_set.bins[axis];
+		// Sweep from right (right_bins[b] : union of bins[b, bin_count))
+		right_bins[bin_count - 1] = bins[bin_count - 1];
+		for(int b = bin_count - 2; b > 0; b--){
+			right_bins[b] = right_bins[b + 1];
+			right_bins[b].grow(bins[b]);
+		}
+		// Sweep from left (devide between b and b+1)
+		SahBin left_bin;
+		left_bin.init();
+		for(int b = 0; b < bin_count - 1; b++){
+			left_bin.grow(bins[b]);
+			const SahBin& right_bin = right_bins[b + 1];
+			if(left_bin.count == 0 || right_bin.count == 0) continue;
+			// Calc SAH
+			float cost = 2 * AABB_TIME +
+				(left_bin.getSurface() * left_bin.count +
+				 right_bin.getSurface() * right_bin.count) * TRI_TIME / total_surface;
+			// Update
+			if(cost < best.cost){
+				best.cost = cost;
+				best.axis = axis;
+				best.bin_idx = b;
+				best.left = left_bin;
+				best.right = right_bin;
+			}
+		}
 	}
+	return best;
+}
+void buildBinnedNode(BuildContext& ctx, int node_idx, int begin, int ref_count, int depth){
+	BVHNodes& nodes = *ctx.nodes;
+	BuildRef* refs = ctx.refs + begin;
+	int bin_count = ctx.bin_count;
 
-	// Exit
-	if(this->is_leaf){
+	//Bounding Box Coordinates
+	RefBounds bounds;
+	calcRefBounds(refs, ref_count, bounds, *ctx.pool);
+	nodes.min_points[node_idx] = bounds.min_point;
+	nodes.max_points[node_idx] = bounds.max_point;
+
+	//Put references into bins of all axes
+	SahBinning binning(bounds.center_min, bounds.center_max, bin_count);
+	SahBinSet bin_set;
+	putRefsIntoBins(refs, ref_count, binning, bin_set, *ctx.pool);
+
+	//Search best bin boundary to devide
+	float total_surface = surface(bounds.min_point, bounds.max_point);
+	SahSplit split = findBinnedSplit(bin_set, binning, total_surface, TRI_TIME * ref_count);
+	if(split.axis < 0 || (ctx.max_depth > 0 && depth >= ctx.max_depth)){
+		nodes.setLeaf(node_idx, begin, begin + ref_count);
 		return;
 	}
-	// Recurrent call
-	this->left->getBboxInfo(bbox_minmax_array, tri_array, tri_idx_info);
-	this->right->getBboxInfo(bbox_minmax_array, tri_array, tri_idx_info);
-	return;
+	//Devide in place
+	int left_count = partitionRefs(refs, ref_count, *ctx.pool,
+		[&](const BuildRef& ref){ return binning.getBinIdx(ref, split.axis) <= split.bin_idx; });
+	int left = nodes.add(2);
+	nodes.setInternal(node_idx, left, left + 1);
+	//Recursive call (large left subtree becomes a task)
+	if(ref_count >= PARALLEL_TASK_MIN_TRIS){
+		TaskGroup tasks(*ctx.pool);
+		tasks.run([=, &ctx](){
+			buildBinnedNode(ctx, left, begin, left_count, depth + 1);
+		});
+		buildBinnedNode(ctx, left + 1, begin + left_count, ref_count - left_count, depth + 1);
+		tasks.wait();
+	} else {
+		buildBinnedNode(ctx, left, begin, left_count, depth + 1);
+		buildBinnedNode(ctx, left + 1, begin + left_count, ref_count - left_count, depth + 1);
+	}
 }
-// Get miss index array
-void Node::getMissIdxInfo(std::vector<int>& miss_idx_array, Node *next_right){
-	// Set miss idx
-	if(next_right == NULL) miss_idx_array.push_back(-1); // terminal
-	else miss_idx_array.push_back(next_right->node_idx);
 
-	// Exit
-	if(this->is_leaf) return;
-	// Recurrent call
-	this->left->getMissIdxInfo(miss_idx_array, this->right);
-	this->right->getMissIdxInfo(miss_idx_array, next_right);
+
+void buildObjectBvh(const vector<vec3>& tri_vertices, const BVHBuildSettings& settings,
+                    ThreadPool& pool, BVHNodes& nodes, vector<int>& tri_refs){
+	int tri_count = tri_vertices.size() / 3;
+
+	// Triangle references
+	Arena arena;
+	BuildRef* refs = arena.allocArray<BuildRef>(tri_count);
+	initTriangleRefs(tri_vertices, refs, pool);
+
+	// Node array (a leaf has one triangle at least)
+	nodes.allocate(2 * tri_count - 1);
+	int root = nodes.add(1);
+
+	// Start dividing
+	BuildContext ctx;
+	ctx.nodes = &nodes;
+	ctx.refs = refs;
+	ctx.surfaces = NULL;
+	ctx.bin_count = std::min(std::max(settings.bin_count, MIN_BIN_COUNT), MAX_BIN_COUNT);
+	ctx.max_depth = settings.max_depth;
+	ctx.pool = &pool;
+	if(settings.method == BVH_BUILD_SWEEP){
+		ctx.surfaces = arena.allocArray<float>(tri_count);
+		buildSweepNode(ctx, root, 0, tri_count, 1);
+	} else {
+		buildBinnedNode(ctx, root, 0, tri_count, 1);
+	}
+	nodes.shrink();
+
+	// Triangle indices referred by leaves
+	tri_refs.resize(tri_count);
+	for(int i = 0; i < tri_count; i++){
+		tri_refs[i] = refs[i].tri_idx;
+	}
 }
 
+
+/* Refit */
+struct RefitContext {
+	BVHNodes* nodes;
+	const int* tri_refs;
+	const vec3* tri_vertices;
+	ThreadPool* pool;
+};
+// Returns unnormalized SAH cost of subtree
+double refitNode(RefitContext& ctx, int node_idx, int depth){
+	BVHNodes& nodes = *ctx.nodes;
+	if(nodes.isLeaf(node_idx)){
+		vec3 min_point( INFINITY,  INFINITY,  INFINITY);
+		vec3 max_point(-INFINITY, -INFINITY, -INFINITY);
+		for(int i = nodes.tri_starts[node_idx]; i < nodes.tri_ends[node_idx]; i++){
+			const vec3* v = ctx.tri_vertices + 3 * ctx.tri_refs[i];
+			min_point = min(min_point, min(min(v[0], v[1]), v[2]));
+			max_point = max(max_point, max(max(v[0], v[1]), v[2]));
+		}
+		nodes.min_points[node_idx] = min_point;
+		nodes.max_points[node_idx] = max_point;
+		int tri_count = nodes.tri_ends[node_idx] - nodes.tri_starts[node_idx];
+		return TRI_TIME * tri_count * surface(min_point, max_point);
+	}
+	//Children first (subtrees near root become tasks)
+	int left = nodes.lefts[node_idx], right = nodes.rights[node_idx];
+	double left_cost, right_cost;
+	if(depth < PARALLEL_SUBTREE_DEPTH){
+		TaskGroup tasks(*ctx.pool);
+		tasks.run([&](){
+			left_cost = refitNode(ctx, left, depth + 1);
+		});
+		right_cost = refitNode(ctx, right, depth + 1);
+		tasks.wait();
+	} else {
+		left_cost = refitNode(ctx, left, depth + 1);
+		right_cost = refitNode(ctx, right, depth + 1);
+	}
+	nodes.min_points[node_idx] = min(nodes.min_points[left], nodes.min_points[right]);
+	nodes.max_points[node_idx] = max(nodes.max_points[left], nodes.max_points[right]);
+	float node_surface = surface(nodes.min_points[node_idx], nodes.max_points[node_idx]);
+	return 2 * AABB_TIME * node_surface + left_cost + right_cost;
+}
+
+
 /* BVH */
-BVH::~BVH(){
-	root.walkAndDelete();
+void BVH::build(const vector<vec3>& tri_vertices, const BVHBuildSettings& settings){
+	int tri_count = tri_vertices.size() / 3;
+	this->nodes.clear();
+	this->tri_refs.clear();
+	this->settings = settings;
+	this->tri_count = tri_count;
+	this->built_sah_cost = 0;
+	if(tri_count == 0) return;
+
+	ThreadPool pool(settings.thread_count);
+	if(settings.method == BVH_BUILD_SPATIAL){
+		buildSpatialBvh(tri_vertices, settings, pool, this->nodes, this->tri_refs);
+	} else if(settings.method == BVH_BUILD_LINEAR){
+		buildLinearBvh(tri_vertices, settings, pool, this->nodes, this->tri_refs);
+	} else {
+		buildObjectBvh(tri_vertices, settings, pool, this->nodes, this->tri_refs);
+	}
+	if(settings.treelet_passes > 0){
+		optimizeTreelets(this->nodes, settings.treelet_size, settings.treelet_passes, pool);
+	}
+	this->built_sah_cost = getSahCost();
+}
+void BVH::release(){
+	nodes.clear();
+	vector<int>().swap(tri_refs);
+	refit_pool.reset();
+	tri_count = 0;
+	built_sah_cost = 0;
 }
-void BVH::build(const vector<vec3>& tri_vertices){
-	// Original triangles
-	this->tris.clear();
-	for(int tri_idx = 0; tri_idx < tri_vertices.size()/3; tri_idx++){
-		Triangle tri(tri_vertices[3*tri_idx+0],
-		             tri_vertices[3*tri_idx+1],
-		             tri_vertices[3*tri_idx+2],
-					 tri_idx);
-		this->tris.push_back(tri);
+bool BVH::refit(const vector<vec3>& tri_vertices){
+	if(nodes.size() == 0 || tri_vertices.size() / 3 != tri_count){
+		build(tri_vertices, settings);
+		return false;
 	}
-
-	// Create pointer array
-	vector<Triangle*> tris_p(this->tris.size());
-	for(int i = 0; i < this->tris.size(); i++){
-		tris_p[i] = &tris[i];
+	if(!refit_pool) refit_pool.reset(new ThreadPool(settings.thread_count));
+	RefitContext ctx;
+	ctx.nodes = &nodes;
+	ctx.tri_refs = &tri_refs[0];
+	ctx.tri_vertices = &tri_vertices[0];
+	ctx.pool = refit_pool.get();
+	double cost = refitNode(ctx, 0, 1) / surface(nodes.min_points[0], nodes.max_points[0]);
+	// Rebuild degraded tree
+	if(cost > built_sah_cost * settings.refit_max_cost_ratio){
+		build(tri_vertices, settings);
+		return false;
 	}
-
-	// Start dividing
-	this->bbox_count = this->root.build(tris_p, 0, 1);
+	return true;
 }
-void BVH::getInfo(vector<vec3>& bbox_minmax_array, std::vector<int>& tri_array, std::vector<int>& tri_idx_info, vector<int>& miss_idx_array){
-	//hit link and bbox
+void BVH::getHitOrder(vector<int>& order, vector<int>& miss_nodes) const {
+	// Walk hit link (depth first) with destination of miss link
+	order.clear();
+	miss_nodes.clear();
+	order.reserve(nodes.size());
+	miss_nodes.reserve(nodes.size());
+	vector<pair<int, int> > stack(1, make_pair(0, -1)); // node, miss node
+	while(!stack.empty()){
+		int node_idx = stack.back().first;
+		int miss_node = stack.back().second;
+		stack.pop_back();
+		order.push_back(node_idx);
+		miss_nodes.push_back(miss_node);
+		if(!nodes.isLeaf(node_idx)){
+			stack.push_back(make_pair(nodes.rights[node_idx], miss_node));
+			stack.push_back(make_pair(nodes.lefts[node_idx], nodes.rights[node_idx]));
+		}
+	}
+}
+// van Emde Boas order of subtree cut at levels (nodes under it go to frontier)
+void layoutVebNode(const BVHNodes& nodes, int node_idx, int levels,
+                   vector<int>& order, vector<int>& frontier){
+	if(levels == 1){
+		order.push_back(node_idx);
+		if(!nodes.isLeaf(node_idx)){
+			frontier.push_back(nodes.lefts[node_idx]);
+			frontier.push_back(nodes.rights[node_idx]);
+		}
+		return;
+	}
+	// Top half, then subtrees of bottom half
+	int top_levels = levels / 2;
+	vector<int> middle;
+	layoutVebNode(nodes, node_idx, top_levels, order, middle);
+	for(int i = 0; i < middle.size(); i++){
+		layoutVebNode(nodes, middle[i], levels - top_levels, order, frontier);
+	}
+}
+void BVH::getLayoutOrder(BVHLayout layout, const vector<int>& hit_order,
+                         vector<int>& order) const {
+	if(layout == BVH_LAYOUT_DEPTH_FIRST){
+		order = hit_order;
+		return;
+	}
+	// Tree height (children are after parent in hit order)
+	vector<int> levels(nodes.size(), 1);
+	for(int i = hit_order.size() - 1; i >= 0; i--){
+		int node_idx = hit_order[i];
+		if(!nodes.isLeaf(node_idx)){
+			levels[node_idx] = 1 + std::max(levels[nodes.lefts[node_idx]],
+			                                levels[nodes.rights[node_idx]]);
+		}
+	}
+	order.clear();
+	order.reserve(nodes.size());
+	vector<int> frontier;
+	layoutVebNode(nodes, 0, levels[0], order, frontier);
+}
+float BVH::getSahCost() const {
+	if(nodes.size() == 0) return 0;
+	// Sum of node costs weighted by surfaces
+	double cost = 0;
+	for(int i = 0; i < nodes.size(); i++){
+		float node_surface = surface(nodes.min_points[i], nodes.max_points[i]);
+		if(nodes.isLeaf(i)){
+			cost += TRI_TIME * (nodes.tri_ends[i] - nodes.tri_starts[i]) * node_surface;
+		} else {
+			cost += 2 * AABB_TIME * node_surface;
+		}
+	}
+	return cost / surface(nodes.min_points[0], nodes.max_points[0]);
+}
+void BVH::getInfo(vector<vec3>& bbox_minmax_array, std::vector<int>& tri_array, std::vector<int>& tri_idx_info, vector<int>& miss_idx_array, BVHLayout layout) const {
 	bbox_minmax_array.clear();
 	tri_array.clear();
 	tri_idx_info.clear();
-	root.getBboxInfo(bbox_minmax_array, tri_array, tri_idx_info);
-	//miss link
 	miss_idx_array.clear();
-	root.getMissIdxInfo(miss_idx_array, NULL);
+	int node_count = nodes.size();
+	if(node_count == 0) return;
+
+	vector<int> hit_order, miss_nodes, order;
+	getHitOrder(hit_order, miss_nodes);
+	getLayoutOrder(layout, hit_order, order);
+	vector<int> miss_links(node_count); // node idx -> miss node
+	vector<int> layout_idxs(node_count); // node idx -> layout order
+	for(int i = 0; i < node_count; i++){
+		miss_links[hit_order[i]] = miss_nodes[i];
+		layout_idxs[order[i]] = i;
+	}
+
+	bbox_minmax_array.reserve(2 * node_count);
+	tri_idx_info.reserve(2 * node_count);
+	miss_idx_array.reserve(node_count);
+	tri_array.reserve(tri_refs.size());
+	for(int i = 0; i < node_count; i++){
+		int node_idx = order[i];
+		// min, max points
+		bbox_minmax_array.push_back(nodes.min_points[node_idx]);
+		bbox_minmax_array.push_back(nodes.max_points[node_idx]);
+		// triangles
+		if(nodes.isLeaf(node_idx)){
+			// start triangle index
+			tri_idx_info.push_back(tri_array.size());
+			// triangle array
+			tri_array.insert(tri_array.end(), tri_refs.begin() + nodes.tri_starts[node_idx],
+			                 tri_refs.begin() + nodes.tri_ends[node_idx]);
+			// end triangle index
+			tri_idx_info.push_back(tri_array.size());
+		} else {
+			// hit link (left child)
+			tri_idx_info.push_back(-1);
+			tri_idx_info.push_back(layout_idxs[nodes.lefts[node_idx]]);
+		}
+		// miss link (-1 is terminal)
+		int miss_node = miss_links[node_idx];
+		miss_idx_array.push_back((miss_node < 0) ? -1 : layout_idxs[miss_node]);
+	}
+}
+void BVH::getBoundsInfo(vector<vec3>& bbox_minmax_array, BVHLayout layout) const {
+	bbox_minmax_array.clear();
+	if(nodes.size() == 0) return;
+	vector<int> hit_order, miss_nodes, order;
+	getHitOrder(hit_order, miss_nodes);
+	getLayoutOrder(layout, hit_order, order);
+	bbox_minmax_array.resize(2 * order.size());
+	for(int i = 0; i < order.size(); i++){
+		bbox_minmax_array[2*i+0] = nodes.min_points[order[i]];
+		bbox_minmax_array[2*i+1] = nodes.max_points[order[i]];
+	}
 }
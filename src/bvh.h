@@ -4,58 +4,138 @@
 #include <iostream>
 #include <vector>
 #include <algorithm>
+#include <atomic>
+#include <memory>
 #include <cassert>
-#define GLM_FORCE_RADIANS 
+#define GLM_FORCE_RADIANS
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
-struct Triangle {
-	Triangle(glm::vec3 v0, glm::vec3 v1, glm::vec3 v2, int tri_idx);
-	glm::vec3 v[3];
-	glm::vec3 center;
-	int tri_idx;
-};
+#include "thread_pool.h"
 
-struct Node {
-	/* BVH Node (AABB) */
+/* Flat BVH node array (structure of arrays)
+ *   Builders store children after their parent, but treelet optimization
+ *   reuses node indices without keeping that order. Node 0 is the root. */
+class BVHNodes {
 public:
-	Node();
-	void walkAndDelete();
-	/* Build tree
-	 *   return : node count */
-	int build(std::vector<Triangle*>& tris_p, int node_idx, int depth, int max_depth=-1);
-	/* Walk hit link and get bbox info */
-	void getBboxInfo(std::vector<glm::vec3>& bbox_minmax_array,
-	                 std::vector<int>& tri_array,
-	                 std::vector<int>& tri_idx_info);
-	/* Get miss index array */
-	void getMissIdxInfo(std::vector<int>& miss_idx_array, Node* next_right);
+	BVHNodes();
+	~BVHNodes();
+	// Reserve (pages are not touched until written)
+	void allocate(int capacity);
+	void clear();
+	// Fit capacity to size
+	void shrink();
+	// Get new nodes (thread safe) returning first node idx
+	int add(int count);
+	int size() const { return count; }
+	bool isLeaf(int node_idx) const { return lefts[node_idx] < 0; }
+	void setLeaf(int node_idx, int tri_start, int tri_end);
+	void setInternal(int node_idx, int left, int right);
+
+	glm::vec3 *min_points, *max_points; // bounding box
+	int *lefts, *rights;          // child node idx (-1 for leaf)
+	int *tri_starts, *tri_ends;   // leaf range in tri_refs
 private:
-	int node_idx;
-	bool is_leaf;
-	Node *right, *left;
-	glm::vec3 bbox_min_point, bbox_max_point;
-	std::vector<Triangle*> tris_p;
+	BVHNodes(const BVHNodes&);
+	BVHNodes& operator=(const BVHNodes&);
+	int capacity;
+	std::atomic<int> count;
 };
 
 //SAH constant time value
 const static float AABB_TIME = 3.0f, TRI_TIME = 1.0f;
+//SAH bin count range
+const static int MIN_BIN_COUNT = 16, MAX_BIN_COUNT = 64;
+//Parallel build granularity
+const static int PARALLEL_TASK_MIN_TRIS = 4096; // subtree task
+const static int PARALLEL_CHUNK_TRIS = 16384, MAX_PARALLEL_CHUNKS = 64; // split search
+//Spatial splits are tried when overlap of object split children exceeds
+//  SPATIAL_SPLIT_ALPHA * (root surface)
+const static float SPATIAL_SPLIT_ALPHA = 1e-5f;
+//Linear BVH leaf size
+const static int LINEAR_MAX_LEAF_TRIS = 4;
+//Triangle count to choose linear BVH automatically
+const static int LINEAR_BUILD_MIN_TRIS = 1 << 20;
+//Treelet optimization leaves per treelet
+const static int MAX_TREELET_SIZE = 8;
+//Subtree task depth of tree walks (treelet optimization, refit)
+const static int PARALLEL_SUBTREE_DEPTH = 12;
+
+enum BVHBuildMethod {
+	BVH_BUILD_SWEEP,  // sort and sweep every split candidate (reference)
+	BVH_BUILD_BINNED, // binned SAH
+	BVH_BUILD_SPATIAL, // binned SAH with spatial splits (SBVH)
+	BVH_BUILD_LINEAR, // Morton code order (LBVH, HLBVH with sah_top_bits)
+};
+
+// Node order of serialized tree (links are remapped to it)
+enum BVHLayout {
+	BVH_LAYOUT_DEPTH_FIRST, // hit link is the next node
+	BVH_LAYOUT_VEB,         // van Emde Boas order (cache-oblivious subtree blocks)
+};
+
+struct BVHBuildSettings {
+	BVHBuildSettings() : method(BVH_BUILD_BINNED), bin_count(32), max_depth(-1),
+	                     thread_count(0), split_budget(0.3f), morton_bits(30),
+	                     sah_top_bits(15), treelet_passes(0), treelet_size(7),
+	                     refit_max_cost_ratio(1.5f) {}
+	BVHBuildMethod method;
+	int bin_count; // bins per axis for BVH_BUILD_BINNED and BVH_BUILD_SPATIAL
+	int max_depth; // -1 is unlimited
+	int thread_count; // 0 is hardware concurrency
+	float split_budget; // duplicated references per triangle for BVH_BUILD_SPATIAL
+	int morton_bits; // 30 or 63 for BVH_BUILD_LINEAR
+	int sah_top_bits; // top Morton bits divided by SAH for BVH_BUILD_LINEAR (0 : LBVH)
+	int treelet_passes; // treelet optimization passes after build (0 : disabled)
+	int treelet_size; // leaves per treelet [3, MAX_TREELET_SIZE]
+	float refit_max_cost_ratio; // refit() rebuilds above this ratio of built SAH cost
+};
 
 class BVH {
 public:
-	BVH() {}
-	~BVH();
-	void build(const std::vector<glm::vec3>& tri_vertices);
-	// Get built tree info
-	//    (hit_idx is current_idx+1)
+	BVH() : tri_count(0), built_sah_cost(0) {}
+	void build(const std::vector<glm::vec3>& tri_vertices,
+	           const BVHBuildSettings& settings = BVHBuildSettings());
+	// Update bounds for moved vertices of same triangles (parallel bottom-up)
+	//   When SAH cost exceeds refit_max_cost_ratio of built one, the tree is
+	//   rebuilt with the last settings and false is returned.
+	bool refit(const std::vector<glm::vec3>& tri_vertices);
+	// Free nodes and refs (after serialization without refit)
+	void release();
+	// SAH cost of current tree
+	float getSahCost() const;
+	float getBuiltSahCost() const { return built_sah_cost; }
+	int getNodeCount() const { return nodes.size(); }
+	const BVHNodes& getNodes() const { return nodes; }
+	// Triangle indices referred by leaves (may be duplicated by spatial splits)
+	const std::vector<int>& getTriRefs() const { return tri_refs; }
+	// Get built tree info in layout order
+	//    (hit link of leaf is its miss link, -1 of miss link is terminal)
 	void getInfo(std::vector<glm::vec3>& bbox_minmax_array,
 	             std::vector<int>& tri_array, // triangle idx array referred by tri_array_idx
-	             std::vector<int>& tri_idx_info, // start and end idx of tri_array in each bbox
-	             std::vector<int>& miss_idx_array);
+	             std::vector<int>& tri_idx_info, // start and end idx of tri_array in each leaf,
+	                                             // -1 and hit idx in each internal bbox
+	             std::vector<int>& miss_idx_array,
+	             BVHLayout layout = BVH_LAYOUT_DEPTH_FIRST) const;
+	// Get only bounding boxes (same order as getInfo, for refit)
+	void getBoundsInfo(std::vector<glm::vec3>& bbox_minmax_array,
+	                   BVHLayout layout = BVH_LAYOUT_DEPTH_FIRST) const;
 private:
-	Node root;
-	std::vector<Triangle> tris;
-	int bbox_count;
+	// Node idx in hit link order with destination of miss link
+	void getHitOrder(std::vector<int>& order, std::vector<int>& miss_nodes) const;
+	// Node idx in layout order
+	void getLayoutOrder(BVHLayout layout, const std::vector<int>& hit_order,
+	                    std::vector<int>& order) const;
+
+	BVHNodes nodes;
+	std::vector<int> tri_refs; // triangle idx referred by leaves
+	BVHBuildSettings settings; // last build settings
+	int tri_count;
+	float built_sah_cost;
+	std::unique_ptr<ThreadPool> refit_pool;
 };
 
+/* Surface of bounding box */
+float surface(const glm::vec3& min_point, const glm::vec3& max_point);
+
 #endif
@@ -0,0 +1,167 @@
+#ifndef BVH_BUILD_H_261017
+#define BVH_BUILD_H_261017
+
+/* Internal helpers shared by BVH builders */
+
+#include "bvh.h"
+
+// AABB functions
+inline float min(float a, float b){ return (a > b) ? b : a; }
+inline float max(float a, float b){ return (a > b) ? a : b; }
+inline glm::vec3 max(const glm::vec3& a, const glm::vec3& b){
+	return glm::vec3(max(a.x, b.x), max(a.y, b.y), max(a.z, b.z));
+}
+inline glm::vec3 min(const glm::vec3& a, const glm::vec3& b){
+	return glm::vec3(min(a.x, b.x), min(a.y, b.y), min(a.z, b.z));
+}
+
+// Triangle reference (bounds may be clipped by spatial splits)
+struct BuildRef {
+	glm::vec3 getCenter() const { return (min_point + max_point) * 0.5f; }
+	glm::vec3 min_point, max_point;
+	int tri_idx;
+};
+// Bounds of references and their centers
+struct RefBounds {
+	void init(){
+		min_point = center_min = glm::vec3( INFINITY,  INFINITY,  INFINITY);
+		max_point = center_max = glm::vec3(-INFINITY, -INFINITY, -INFINITY);
+	}
+	void grow(const BuildRef* refs, int ref_count){
+		for(int i = 0; i < ref_count; i++){
+			min_point = min(min_point, refs[i].min_point);
+			max_point = max(max_point, refs[i].max_point);
+			glm::vec3 center = refs[i].getCenter();
+			center_min = min(center_min, center);
+			center_max = max(center_max, center);
+		}
+	}
+	void grow(const RefBounds& bounds){
+		min_point = min(min_point, bounds.min_point);
+		max_point = max(max_point, bounds.max_point);
+		center_min = min(center_min, bounds.center_min);
+		center_max = max(center_max, bounds.center_max);
+	}
+	glm::vec3 min_point, max_point;
+	glm::vec3 center_min, center_max;
+};
+void initTriangleRefs(const std::vector<glm::vec3>& tri_vertices, BuildRef* refs, ThreadPool& pool);
+
+// Splits parallel loop into fixed chunks (independent of thread count)
+inline int getChunkCount(int ref_count){
+	return min(ref_count / PARALLEL_CHUNK_TRIS + 1, MAX_PARALLEL_CHUNKS);
+}
+inline int getChunkBegin(int ref_count, int chunk_count, int chunk_idx){
+	return (long long)ref_count * chunk_idx / chunk_count;
+}
+void calcRefBounds(const BuildRef* refs, int ref_count, RefBounds& bounds, ThreadPool& pool);
+
+// In-place partition returning left count
+//   (result order depends only on chunks, not on thread count)
+template<typename Pred>
+int partitionRefs(BuildRef* refs, int ref_count, ThreadPool& pool, Pred is_left){
+	int chunk_count = getChunkCount(ref_count);
+	if(chunk_count == 1){
+		return std::partition(refs, refs + ref_count, is_left) - refs;
+	}
+	// Partition each chunk
+	int begins[MAX_PARALLEL_CHUNKS + 1], mids[MAX_PARALLEL_CHUNKS];
+	for(int c = 0; c <= chunk_count; c++){
+		begins[c] = getChunkBegin(ref_count, chunk_count, c);
+	}
+	parallelFor(pool, 0, chunk_count, 1, [&](int begin, int end){
+		for(int c = begin; c < end; c++){
+			mids[c] = std::partition(refs + begins[c], refs + begins[c + 1], is_left) - refs;
+		}
+	});
+	// Merge neighboring chunks by swapping right part and left part
+	for(int step = 1; step < chunk_count; step *= 2){
+		parallelFor(pool, 0, (chunk_count + 2 * step - 1) / (2 * step), 1, [&](int begin, int end){
+			for(int i = begin; i < end; i++){
+				int c0 = 2 * step * i, c1 = c0 + step;
+				if(c1 >= chunk_count) continue;
+				std::rotate(refs + mids[c0], refs + begins[c1], refs + mids[c1]);
+				mids[c0] += mids[c1] - begins[c1];
+			}
+		});
+	}
+	return mids[0];
+}
+
+/* Binned SAH */
+struct SahBin {
+	void init(){
+		min_point = glm::vec3( INFINITY,  INFINITY,  INFINITY);
+		max_point = glm::vec3(-INFINITY, -INFINITY, -INFINITY);
+		count = 0;
+	}
+	void grow(const BuildRef& ref){
+		min_point = min(min_point, ref.min_point);
+		max_point = max(max_point, ref.max_point);
+		count++;
+	}
+	void grow(const SahBin& bin){
+		min_point = min(min_point, bin.min_point);
+		max_point = max(max_point, bin.max_point);
+		count += bin.count;
+	}
+	float getSurface() const { return (count > 0) ? surface(min_point, max_point) : 0; }
+	glm::vec3 min_point, max_point;
+	int count;
+};
+struct SahBinSet {
+	void init(int bin_count){
+		for(int axis = 0; axis < 3; axis++){
+			for(int b = 0; b < bin_count; b++) bins[axis][b].init();
+		}
+	}
+	SahBin bins[3][MAX_BIN_COUNT];
+};
+// Bin placement in bounds of reference centers
+struct SahBinning {
+	SahBinning(const glm::vec3& center_min, const glm::vec3& center_max, int bin_count)
+		: center_min(center_min), bin_count(bin_count) {
+		for(int axis = 0; axis < 3; axis++){
+			float extent = center_max[axis] - center_min[axis];
+			bin_scale[axis] = (extent > 0) ? bin_count / extent : 0;
+		}
+	}
+	int getBinIdx(const BuildRef& ref, int axis) const {
+		float center = (ref.min_point[axis] + ref.max_point[axis]) * 0.5f;
+		int bin_idx = int((center - center_min[axis]) * bin_scale[axis]);
+		return (bin_idx < bin_count) ? bin_idx : bin_count - 1;
+	}
+	void putRefs(const BuildRef* refs, int ref_count, SahBinSet& bin_set) const {
+		for(int i = 0; i < ref_count; i++){
+			for(int axis = 0; axis < 3; axis++){
+				bin_set.bins[axis][getBinIdx(refs[i], axis)].grow(refs[i]);
+			}
+		}
+	}
+	glm::vec3 center_min;
+	float bin_scale[3];
+	int bin_count;
+};
+void putRefsIntoBins(const BuildRef* refs, int ref_count, const SahBinning& binning,
+                     SahBinSet& bin_set, ThreadPool& pool);
+// Best boundary of bins (axis is -1 when no split is better than leaf)
+struct SahSplit {
+	int axis, bin_idx;
+	float cost;
+	SahBin left, right;
+};
+SahSplit findBinnedSplit(const SahBinSet& bin_set, const SahBinning& binning,
+                         float total_surface, float leaf_cost);
+
+/* Builders */
+void buildSpatialBvh(const std::vector<glm::vec3>& tri_vertices, const BVHBuildSettings& settings,
+                     ThreadPool& pool, BVHNodes& nodes, std::vector<int>& tri_refs);
+void buildObjectBvh(const std::vector<glm::vec3>& tri_vertices, const BVHBuildSettings& settings,
+                    ThreadPool& pool, BVHNodes& nodes, std::vector<int>& tri_refs);
+void buildLinearBvh(const std::vector<glm::vec3>& tri_vertices, const BVHBuildSettings& settings,
+                    ThreadPool& pool, BVHNodes& nodes, std::vector<int>& tri_refs);
+
+/* Post-build optimization */
+void optimizeTreelets(BVHNodes& nodes, int treelet_size, int pass_count, ThreadPool& pool);
+
+#endif
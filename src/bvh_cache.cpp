@@ -0,0 +1,178 @@
+#include "bvh_cache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <unistd.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+/* File layout
+ *   |CacheHeader|CacheArrayHeader * array_count|padding|array data|... */
+struct CacheHeader {
+	char magic[8];
+	uint32_t version, array_count;
+	uint64_t key;
+};
+struct CacheArrayHeader {
+	uint64_t elem_size, count, offset;
+};
+const static char CACHE_MAGIC[8] = {'B', 'V', 'H', 'C', 'A', 'C', 'H', 'E'};
+const static size_t CACHE_ALIGN = 64;
+
+inline size_t alignSize(size_t size){
+	return (size + CACHE_ALIGN - 1) / CACHE_ALIGN * CACHE_ALIGN;
+}
+
+/* Hash */
+uint64_t hashBytes(const void* data, size_t size, uint64_t hash){
+	const uint64_t PRIME = 0x100000001b3ULL;
+	const char* bytes = static_cast<const char*>(data);
+	size_t word_end = size / 8 * 8;
+	for(size_t i = 0; i < word_end; i += 8){
+		uint64_t word;
+		memcpy(&word, bytes + i, 8);
+		hash = (hash ^ word) * PRIME;
+	}
+	for(size_t i = word_end; i < size; i++){
+		hash = (hash ^ (unsigned char)bytes[i]) * PRIME;
+	}
+	return hash;
+}
+bool hashObjFile(const string& filename, uint64_t& hash){
+	MappedFile obj;
+	if(!obj.open(filename)) return false;
+	hash = hashBytes(obj.data(), obj.size());
+
+	// Material files
+	string basepath;
+	size_t slash_idx = filename.find_last_of('/');
+	if(slash_idx != string::npos) basepath = filename.substr(0, slash_idx + 1);
+	const char* line = obj.data();
+	const char* end = obj.data() + obj.size();
+	while(line < end){
+		const char* line_end = static_cast<const char*>(memchr(line, '\n', end - line));
+		if(line_end == NULL) line_end = end;
+		if(line_end - line > 7 && strncmp(line, "mtllib", 6) == 0){
+			stringstream names(string(line + 6, line_end));
+			string name;
+			while(names >> name){
+				MappedFile mtl;
+				if(mtl.open(basepath + name)){
+					hash = hashBytes(mtl.data(), mtl.size(), hash);
+				} else {
+					hash = hashBytes(name.c_str(), name.size(), hash);
+				}
+			}
+		}
+		line = line_end + 1;
+	}
+	return true;
+}
+
+string getBVHCachePath(const string& cache_dir, uint64_t key){
+	stringstream path;
+	path << cache_dir << "/" << hex << setw(16) << setfill('0') << key << ".bvhcache";
+	return path.str();
+}
+
+/* Writer */
+void BVHCacheWriter::addArray(const void* data, size_t elem_size, size_t count){
+	Array array;
+	array.data = data;
+	array.elem_size = elem_size;
+	array.count = count;
+	arrays.push_back(array);
+}
+bool BVHCacheWriter::write(const string& path, uint64_t key) const {
+	// Directory
+	size_t slash_idx = path.find_last_of('/');
+	if(slash_idx != string::npos) mkdir(path.substr(0, slash_idx).c_str(), 0755);
+
+	// Headers
+	CacheHeader header;
+	memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+	header.version = BVH_CACHE_VERSION;
+	header.array_count = arrays.size();
+	header.key = key;
+	vector<CacheArrayHeader> array_headers(arrays.size());
+	size_t offset = alignSize(sizeof(CacheHeader) + sizeof(CacheArrayHeader) * arrays.size());
+	for(int i = 0; i < arrays.size(); i++){
+		array_headers[i].elem_size = arrays[i].elem_size;
+		array_headers[i].count = arrays[i].count;
+		array_headers[i].offset = offset;
+		offset = alignSize(offset + arrays[i].elem_size * arrays[i].count);
+	}
+
+	// Write
+	stringstream tmp_path;
+	tmp_path << path << ".tmp" << getpid();
+	ofstream ofs(tmp_path.str().c_str(), ios::binary);
+	if(!ofs) return false;
+	ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	ofs.write(reinterpret_cast<const char*>(array_headers.data()),
+	          sizeof(CacheArrayHeader) * array_headers.size());
+	const char zeros[CACHE_ALIGN] = {};
+	for(int i = 0; i < arrays.size(); i++){
+		ofs.write(zeros, array_headers[i].offset - ofs.tellp());
+		ofs.write(static_cast<const char*>(arrays[i].data), arrays[i].elem_size * arrays[i].count);
+	}
+	ofs.write(zeros, offset - ofs.tellp());
+	ofs.close();
+	if(!ofs || rename(tmp_path.str().c_str(), path.c_str()) != 0){
+		remove(tmp_path.str().c_str());
+		return false;
+	}
+	return true;
+}
+
+/* Reader */
+bool BVHCacheFile::open(const string& path, uint64_t key){
+	close();
+	if(!file.open(path)) return false;
+	const char* data = file.data();
+	size_t size = file.size();
+
+	// Check header
+	CacheHeader header;
+	if(size < sizeof(header)) return false;
+	memcpy(&header, data, sizeof(header));
+	if(memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ||
+	   header.version != BVH_CACHE_VERSION || header.key != key ||
+	   size < sizeof(header) + sizeof(CacheArrayHeader) * header.array_count){
+		close();
+		return false;
+	}
+	// Arrays
+	for(int i = 0; i < header.array_count; i++){
+		CacheArrayHeader array_header;
+		memcpy(&array_header, data + sizeof(header) + sizeof(CacheArrayHeader) * i,
+		       sizeof(array_header));
+		if(array_header.offset > size || array_header.elem_size == 0 ||
+		   array_header.count > (size - array_header.offset) / array_header.elem_size){
+			close();
+			return false;
+		}
+		Array array;
+		array.data = data + array_header.offset;
+		array.elem_size = array_header.elem_size;
+		array.count = array_header.count;
+		arrays.push_back(array);
+	}
+	return true;
+}
+void BVHCacheFile::close(){
+	arrays.clear();
+	file.close();
+}
+const void* BVHCacheFile::getArray(int idx, size_t elem_size, size_t& count) const {
+	if(idx < 0 || idx >= arrays.size() || arrays[idx].elem_size != elem_size){
+		count = 0;
+		return NULL;
+	}
+	count = arrays[idx].count;
+	return arrays[idx].data;
+}
@@ -0,0 +1,59 @@
+#ifndef BVH_CACHE_H_261017
+#define BVH_CACHE_H_261017
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "mapped_file.h"
+
+/* Persistent cache of BVH ordered scene arrays
+ *   A cache file is keyed by hash of its source and settings, and is read
+ *   by memory mapping (arrays are used in place). */
+
+const static uint32_t BVH_CACHE_VERSION = 2; // 2 : explicit hit links
+const static uint64_t HASH_SEED = 0xcbf29ce484222325ULL;
+
+// 64-bit FNV-1a style hash (8 bytes per step)
+uint64_t hashBytes(const void* data, size_t size, uint64_t hash = HASH_SEED);
+template<typename T>
+uint64_t hashValue(const T& value, uint64_t hash){
+	return hashBytes(&value, sizeof(T), hash);
+}
+// Hash of obj file and mtl files referred by it (false when obj can't be read)
+bool hashObjFile(const std::string& filename, uint64_t& hash);
+
+std::string getBVHCachePath(const std::string& cache_dir, uint64_t key);
+
+class BVHCacheWriter {
+public:
+	// Array is referred until write()
+	void addArray(const void* data, size_t elem_size, size_t count);
+	// Write to temporary file and rename (readers never see partial file)
+	bool write(const std::string& path, uint64_t key) const;
+private:
+	struct Array {
+		const void* data;
+		size_t elem_size, count;
+	};
+	std::vector<Array> arrays;
+};
+
+class BVHCacheFile {
+public:
+	// Fails when missing, broken or key is different
+	bool open(const std::string& path, uint64_t key);
+	void close();
+	int getArrayCount() const { return arrays.size(); }
+	// Pointer into mapped file (valid until close)
+	const void* getArray(int idx, size_t elem_size, size_t& count) const;
+private:
+	struct Array {
+		const char* data;
+		size_t elem_size, count;
+	};
+	MappedFile file;
+	std::vector<Array> arrays;
+};
+
+#endif
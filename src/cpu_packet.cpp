@@ -0,0 +1,254 @@
+#include "cpu_renderer.h"
+
+using namespace glm;
+using namespace std;
+
+/* Packet traversal
+ *   SIMD_WIDTH coherent rays (a pixel block) follow the same stackless
+ *   links of getInfo() as traverse(), and a node is entered when any active
+ *   ray hits its bbox. Leaf triangles are tested against all lanes at once.
+ *   When fewer than CPU_PACKET_SPLIT_LANES lanes hit an internal node, the
+ *   packet is split and each ray continues alone from that node (never with
+ *   the default 0).
+ *   Shadow rays of a packet only look for any hit nearer than their light,
+ *   and lanes leave the packet at their first hit. */
+
+#if SIMD_WIDTH > 1
+
+namespace {
+
+// Rays in SoA
+struct RayPacket {
+	SimdFloat org[3], dir[3];
+};
+struct PacketHit {
+	SimdFloat dist, u, v;
+	int tri_idxs[SIMD_WIDTH];
+};
+
+// Lanes of active which hit bbox nearer than t_max (same divisions as intersectBBox)
+SimdMask intersectBBoxPacket(const RayPacket& packet, SimdMask active,
+                             const vec3& min_point, const vec3& max_point, SimdFloat t_max){
+	SimdFloat t_far = t_max;
+	SimdFloat t_near = simdSet(-CPU_INFINITY);
+	for(int i = 0; i < 3; i++){
+		SimdFloat t1 = simdDiv(simdSub(simdSet(min_point[i]), packet.org[i]), packet.dir[i]);
+		SimdFloat t2 = simdDiv(simdSub(simdSet(max_point[i]), packet.org[i]), packet.dir[i]);
+		t_far = simdMin(t_far, simdMax(t1, t2));
+		t_near = simdMax(t_near, simdMin(t1, t2));
+	}
+	return simdAndNot(simdLess(t_far, t_near), active);
+}
+
+// Cross and dot products of lanes with a broadcast vector
+inline void crossPacket(const SimdFloat a[3], const vec3& b, SimdFloat out[3]){
+	SimdFloat bx = simdSet(b.x), by = simdSet(b.y), bz = simdSet(b.z);
+	out[0] = simdSub(simdMul(a[1], bz), simdMul(by, a[2]));
+	out[1] = simdSub(simdMul(a[2], bx), simdMul(bz, a[0]));
+	out[2] = simdSub(simdMul(a[0], by), simdMul(bx, a[1]));
+}
+inline SimdFloat dotPacket(const SimdFloat a[3], const SimdFloat b[3]){
+	return simdAdd(simdAdd(simdMul(a[0], b[0]), simdMul(a[1], b[1])), simdMul(a[2], b[2]));
+}
+inline SimdFloat dotPacket(const SimdFloat a[3], const vec3& b){
+	return simdAdd(simdAdd(simdMul(a[0], simdSet(b.x)), simdMul(a[1], simdSet(b.y))),
+	               simdMul(a[2], simdSet(b.z)));
+}
+
+/* Möller–Trumbore intersection of one triangle and lanes */
+void intersectTrianglePacket(const RayPacket& packet, SimdMask active,
+                             const vec3* vertices, int tri_idx, PacketHit& hit){
+	vec3 position0 = vertices[0];
+	vec3 edge0 = vertices[1] - position0;
+	vec3 edge1 = vertices[2] - position0;
+	const SimdFloat zero = simdSet(0.0f), one = simdSet(1.0f);
+	const SimdFloat near_zero = simdSet(CPU_NEAR_ZERO);
+
+	SimdFloat P[3];
+	crossPacket(packet.dir, edge1, P);
+	SimdFloat det = dotPacket(P, edge0);
+	SimdMask valid = simdAndNot(simdAnd(simdLess(simdSet(-CPU_NEAR_ZERO), det),
+	                                    simdLess(det, near_zero)), active);
+	if(!simdMaskBits(valid)) return;
+	SimdFloat inv_det = simdDiv(one, det);
+	SimdFloat T[3];
+	for(int i = 0; i < 3; i++) T[i] = simdSub(packet.org[i], simdSet(position0[i]));
+	SimdFloat u = simdMul(dotPacket(T, P), inv_det);
+	valid = simdAndNot(simdOr(simdLess(u, zero), simdLess(one, u)), valid);
+	if(!simdMaskBits(valid)) return;
+	SimdFloat Q[3];
+	crossPacket(T, edge0, Q);
+	SimdFloat v = simdMul(dotPacket(packet.dir, Q), inv_det);
+	valid = simdAndNot(simdOr(simdLess(v, zero), simdLess(one, simdAdd(u, v))), valid);
+	SimdFloat t = simdMul(dotPacket(Q, edge1), inv_det);
+	valid = simdAnd(valid, simdAnd(simdLess(near_zero, t), simdLess(t, hit.dist)));
+	int hit_bits = simdMaskBits(valid);
+	if(!hit_bits) return;
+	// Hit and nearer
+	hit.dist = simdSelect(valid, t, hit.dist);
+	hit.u = simdSelect(valid, u, hit.u);
+	hit.v = simdSelect(valid, v, hit.v);
+	for(; hit_bits; hit_bits &= hit_bits - 1){
+		hit.tri_idxs[__builtin_ctz(hit_bits)] = tri_idx;
+	}
+}
+
+// Lanes to SoA (inactive lanes are masked out, but kept finite)
+void loadPacket(const CpuRay* rays, int active_bits, RayPacket& packet){
+	float lanes[6][SIMD_WIDTH];
+	for(int lane = 0; lane < SIMD_WIDTH; lane++){
+		bool active = active_bits & (1 << lane);
+		for(int i = 0; i < 3; i++){
+			lanes[i][lane] = active ? rays[lane].org[i] : 0.0f;
+			lanes[3 + i][lane] = active ? rays[lane].dir[i] : 1.0f;
+		}
+	}
+	for(int i = 0; i < 3; i++){
+		packet.org[i] = simdLoad(lanes[i]);
+		packet.dir[i] = simdLoad(lanes[3 + i]);
+	}
+}
+
+}
+
+void CpuRenderer::intersectPacket(const CpuRay* rays, int active_bits, CpuHit* hits) const {
+	RayPacket packet;
+	loadPacket(rays, active_bits, packet);
+	PacketHit hit;
+	hit.dist = simdSet(CPU_INFINITY);
+	hit.u = hit.v = simdSet(0.0f);
+	for(int lane = 0; lane < SIMD_WIDTH; lane++) hit.tri_idxs[lane] = 0;
+	SimdMask active = simdMaskFromBits(active_bits);
+
+	int bbox_idx = 0, split_bits = 0, node_count = 0;
+	while(true){
+		const int* info = &scene.bbox_info[3 * bbox_idx];
+		node_count++;
+		SimdMask bbox_hit = intersectBBoxPacket(packet, active, scene.bbox_minmax[2 * bbox_idx],
+		                                        scene.bbox_minmax[2 * bbox_idx + 1],
+		                                        simdSet(CPU_INFINITY));
+		int hit_bits = simdMaskBits(bbox_hit);
+		if(hit_bits){
+			// Leaf check (internal node is -1)
+			if(info[0] < 0){
+				// Incoherent, continue with single rays
+				if(__builtin_popcount(hit_bits) < CPU_PACKET_SPLIT_LANES){
+					split_bits = active_bits;
+					break;
+				}
+				// hit link
+				bbox_idx = info[1];
+				continue;
+			}
+			// Linear search
+			for(int tri_idx = info[0]; tri_idx < info[1]; tri_idx++){
+				intersectTrianglePacket(packet, bbox_hit, &scene.triangles[3 * tri_idx],
+				                        tri_idx, hit);
+			}
+		}
+		// miss link (also hit link of leaf)
+		bbox_idx = info[2];
+		if(bbox_idx < 0) break;
+	}
+
+	float dists[SIMD_WIDTH], us[SIMD_WIDTH], vs[SIMD_WIDTH];
+	simdStore(dists, hit.dist);
+	simdStore(us, hit.u);
+	simdStore(vs, hit.v);
+	for(int lane = 0; lane < SIMD_WIDTH; lane++){
+		if(!(active_bits & (1 << lane))) continue;
+		CpuHit lane_hit = {dists[lane], us[lane], vs[lane], hit.tri_idxs[lane], node_count};
+		hits[lane] = lane_hit;
+		// Rest of tree from split node (nodes before it are done)
+		if(split_bits & (1 << lane)) traverse(rays[lane], bbox_idx, hits[lane]);
+	}
+}
+int CpuRenderer::occludedPacket(const CpuRay* rays, int active_bits, const float* t_maxs) const {
+	RayPacket packet;
+	loadPacket(rays, active_bits, packet);
+	float lane_t_maxs[SIMD_WIDTH];
+	for(int lane = 0; lane < SIMD_WIDTH; lane++){
+		lane_t_maxs[lane] = (active_bits & (1 << lane)) ? t_maxs[lane] : 0.0f;
+	}
+	SimdFloat t_max = simdLoad(lane_t_maxs);
+	PacketHit hit;
+	hit.dist = t_max;
+	hit.u = hit.v = simdSet(0.0f);
+	SimdMask active = simdMaskFromBits(active_bits);
+
+	int bbox_idx = 0, occluded_bits = 0;
+	while(true){
+		const int* info = &scene.bbox_info[3 * bbox_idx];
+		SimdMask bbox_hit = intersectBBoxPacket(packet, active, scene.bbox_minmax[2 * bbox_idx],
+		                                        scene.bbox_minmax[2 * bbox_idx + 1], t_max);
+		if(simdMaskBits(bbox_hit)){
+			// Leaf check (internal node is -1)
+			if(info[0] < 0){
+				// hit link
+				bbox_idx = info[1];
+				continue;
+			}
+			// Linear search (lanes with a hit are done)
+			for(int tri_idx = info[0]; tri_idx < info[1]; tri_idx++){
+				intersectTrianglePacket(packet, bbox_hit, &scene.triangles[3 * tri_idx],
+				                        tri_idx, hit);
+			}
+			SimdMask hit_lanes = simdLess(hit.dist, t_max);
+			occluded_bits |= simdMaskBits(hit_lanes);
+			active = simdAndNot(hit_lanes, active);
+			if(!simdMaskBits(active)) break;
+		}
+		// miss link (also hit link of leaf)
+		bbox_idx = info[2];
+		if(bbox_idx < 0) break;
+	}
+	return occluded_bits & active_bits;
+}
+
+#else
+
+void CpuRenderer::intersectPacket(const CpuRay* rays, int active_bits, CpuHit* hits) const {
+	for(int lane = 0; lane < SIMD_WIDTH; lane++){
+		if(!(active_bits & (1 << lane))) continue;
+		CpuHit hit = {CPU_INFINITY, 0, 0, 0, 0};
+		hits[lane] = hit;
+		traverse(rays[lane], 0, hits[lane]);
+	}
+}
+int CpuRenderer::occludedPacket(const CpuRay* rays, int active_bits, const float* t_maxs) const {
+	int occluded_bits = 0;
+	for(int lane = 0; lane < SIMD_WIDTH; lane++){
+		if(!(active_bits & (1 << lane))) continue;
+		if(occluded(rays[lane], t_maxs[lane])) occluded_bits |= 1 << lane;
+	}
+	return occluded_bits;
+}
+
+#endif
+
+void CpuRenderer::tracePrimaryPacket(const CpuRay* rays, const FrameUniforms* const* uniforms,
+                                     int active_bits, CpuPrimaryHit* primaries) const {
+	// Camera rays
+	CpuHit hits[SIMD_WIDTH];
+	intersectPacket(rays, active_bits, hits);
+	// Shadow rays of hit lanes (as first shading step of render())
+	CpuRay s_rays[SIMD_WIDTH];
+	float light_dists[SIMD_WIDTH];
+	int shadow_bits = 0;
+	for(int lane = 0; lane < SIMD_WIDTH; lane++){
+		if(!(active_bits & (1 << lane))) continue;
+		CpuPrimaryHit& primary = primaries[lane];
+		primary.result = getIntersection(rays[lane], hits[lane]);
+		primary.shadowed = false;
+		if(primary.result.dist >= CPU_INFINITY) continue;
+		vec3 org = primary.result.hit_position - 0.001f * rays[lane].dir;
+		s_rays[lane] = getShadowRay(org, primary.result.hit_position, *uniforms[lane],
+		                            light_dists[lane]);
+		shadow_bits |= 1 << lane;
+	}
+	if(!shadow_bits) return;
+	int occluded_bits = occludedPacket(s_rays, shadow_bits, light_dists);
+	for(int lane = 0; lane < SIMD_WIDTH; lane++){
+		if(occluded_bits & (1 << lane)) primaries[lane].shadowed = true;
+	}
+}
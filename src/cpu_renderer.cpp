@@ -0,0 +1,655 @@
+#include "cpu_renderer.h"
+
+#include <cmath>
+#include <algorithm>
+
+using namespace glm;
+using namespace std;
+
+// Same as simple.fs
+const static vec3 LIGHT_POS_RANGE = vec3(0.10, 0, 0.10);
+const static vec3 LIGHT_POS = vec3(0.50, 0.75, 0.50);
+const static float GLOSSINESS = 8.0;
+
+CpuRandom::CpuRandom(uint64_t seed, uint64_t stream) : state(0), inc((stream << 1) | 1) {
+	next();
+	state += seed;
+	next();
+}
+uint32_t CpuRandom::next(){
+	uint64_t old_state = state;
+	state = old_state * 6364136223846793005ULL + inc;
+	uint32_t xorshifted = ((old_state >> 18) ^ old_state) >> 27;
+	uint32_t rot = old_state >> 59;
+	return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+}
+float CpuRandom::nextFloat(){
+	return (next() >> 8) * (1.0f / 16777216.0f);
+}
+
+CpuRenderer::CpuRenderer(const SceneData& scene, int width, int height, int thread_count)
+    : scene(scene), width(width), height(height), accum_frame(0),
+      pixels(width * height), moments(width * height), sample_counts(width * height),
+      sample_mask(width * height, 1), adaptive_ratio(0), ray_count(0), pixel_random(false),
+      packet_traversal(false), stack_traversal(false), wavefront(false),
+      wavefront_sort(CPU_SORT_CELL), random_seed(0), pool(new ThreadPool(thread_count)), wide(NULL),
+      tri_record_type(TRI_RECORD_VERTICES), tri_records(NULL) {
+}
+void CpuRenderer::clear(){
+	accum_frame = 0;
+}
+void CpuRenderer::setPixelRandom(bool enabled, uint64_t seed){
+	pixel_random = enabled;
+	random_seed = seed;
+}
+bool CpuRenderer::setStackTraversal(bool enabled){
+	stack_traversal = enabled && getBVHStackSize(scene) <= CPU_BVH_STACK_SIZE;
+	return stack_traversal == enabled;
+}
+bool CpuRenderer::setWideBVH(const WideBVH* wide_bvh){
+	if(wide_bvh && getWideStackSize(*wide_bvh) > CPU_WIDE_STACK_SIZE){
+		wide = NULL;
+		return false;
+	}
+	wide = wide_bvh;
+	return true;
+}
+void CpuRenderer::setTriRecords(TriRecordType type, const vec4* records){
+	tri_record_type = records ? type : TRI_RECORD_VERTICES;
+	tri_records = records;
+}
+uint64_t CpuRenderer::getSampleCount() const {
+	uint64_t count = 0;
+	if(accum_frame == 0) return count;
+	for(size_t i = 0; i < sample_counts.size(); i++) count += sample_counts[i];
+	return count;
+}
+void CpuRenderer::updateSampleMask(){
+	if(adaptive_ratio <= 0.0f || adaptive_ratio >= 1.0f ||
+	   accum_frame < ADAPTIVE_MIN_SAMPLES){
+		sample_mask.assign(width * height, 1);
+		return;
+	}
+	int budget = (int)(adaptive_ratio * width * height + 0.5f);
+	selectNoisyPixels(pixels, moments, sample_counts, budget, sample_mask);
+}
+void CpuRenderer::renderFrame(const FrameUniforms& uniforms){
+	updateSampleMask();
+	if(wavefront){
+		renderWavefront(uniforms);
+		accum_frame++;
+		return;
+	}
+	// Tiles as tasks (idle threads steal them)
+	int tiles_x = (width + CPU_TILE_SIZE - 1) / CPU_TILE_SIZE;
+	int tiles_y = (height + CPU_TILE_SIZE - 1) / CPU_TILE_SIZE;
+	TaskGroup tasks(*pool);
+	for(int tile_idx = 0; tile_idx < tiles_x * tiles_y; tile_idx++){
+		tasks.run([=, &uniforms](){
+			renderTile(tile_idx % tiles_x, tile_idx / tiles_x, uniforms);
+		});
+	}
+	tasks.wait();
+	accum_frame++;
+}
+void CpuRenderer::renderTile(int tile_x, int tile_y, const FrameUniforms& uniforms){
+	int x_end = std::min((tile_x + 1) * CPU_TILE_SIZE, width);
+	int y_end = std::min((tile_y + 1) * CPU_TILE_SIZE, height);
+	// Stream of tile (first pixel idx) and frame, same image for any thread count
+	uint64_t stream = (uint64_t)tile_y * CPU_TILE_SIZE * width + tile_x * CPU_TILE_SIZE;
+	CpuRandom random(random_seed ^ ((uint64_t)accum_frame << 32), stream);
+	uint64_t tile_ray_count = 0;
+	if(!packet_traversal){
+		FrameUniforms pixel_uniforms = uniforms;
+		for(int y = tile_y * CPU_TILE_SIZE; y < y_end; y++){
+			for(int x = tile_x * CPU_TILE_SIZE; x < x_end; x++){
+				if(pixel_random){
+					pixel_uniforms.rand_vec2_a = vec2(random.nextFloat(), random.nextFloat());
+					pixel_uniforms.rand_vec2_b = vec2(random.nextFloat(), random.nextFloat());
+					pixel_uniforms.rand_vec3 = vec3(random.nextFloat(), random.nextFloat(),
+					                                random.nextFloat());
+				}
+				if(!isPixelSampled(x, y)) continue;
+				vec3 color = renderPixel(vec2(x + 0.5f, y + 0.5f), pixel_uniforms,
+				                         tile_ray_count);
+				accumulatePixel(x, y, color);
+			}
+		}
+		ray_count += tile_ray_count;
+		return;
+	}
+
+	/* Packets of pixel blocks */
+	FrameUniforms tile_uniforms[CPU_TILE_SIZE * CPU_TILE_SIZE];
+	tile_uniforms[0] = uniforms;
+	if(pixel_random) drawTileUniforms(tile_x, tile_y, uniforms, tile_uniforms);
+	for(int by = tile_y * CPU_TILE_SIZE; by < y_end; by += CPU_PACKET_HEIGHT){
+		for(int bx = tile_x * CPU_TILE_SIZE; bx < x_end; bx += CPU_PACKET_WIDTH){
+			CpuRay rays[SIMD_WIDTH];
+			const FrameUniforms* lane_uniforms[SIMD_WIDTH];
+			int active_bits = 0;
+			for(int lane = 0; lane < SIMD_WIDTH; lane++){
+				int x = bx + lane % CPU_PACKET_WIDTH;
+				int y = by + lane / CPU_PACKET_WIDTH;
+				if(x >= x_end || y >= y_end) continue; // Tile edge
+				if(!isPixelSampled(x, y)) continue;
+				active_bits |= 1 << lane;
+				int uniforms_idx = pixel_random ?
+				    (y % CPU_TILE_SIZE) * CPU_TILE_SIZE + x % CPU_TILE_SIZE : 0;
+				lane_uniforms[lane] = &tile_uniforms[uniforms_idx];
+				rays[lane] = getCameraRay(vec2(x + 0.5f, y + 0.5f), *lane_uniforms[lane]);
+			}
+			if(active_bits == 0) continue;
+			CpuPrimaryHit primaries[SIMD_WIDTH];
+			tracePrimaryPacket(rays, lane_uniforms, active_bits, primaries);
+			for(int lane = 0; lane < SIMD_WIDTH; lane++){
+				if(!(active_bits & (1 << lane))) continue;
+				tile_ray_count++; // camera ray
+				if(primaries[lane].result.dist < CPU_INFINITY) tile_ray_count++; // shadow ray
+				vec3 color = render(rays[lane], *lane_uniforms[lane], tile_ray_count,
+				                    &primaries[lane]);
+				accumulatePixel(bx + lane % CPU_PACKET_WIDTH, by + lane / CPU_PACKET_WIDTH,
+				                color);
+			}
+		}
+	}
+	ray_count += tile_ray_count;
+}
+void CpuRenderer::drawTileUniforms(int tile_x, int tile_y, const FrameUniforms& uniforms,
+                                   FrameUniforms* tile_uniforms) const {
+	int x_end = std::min((tile_x + 1) * CPU_TILE_SIZE, width);
+	int y_end = std::min((tile_y + 1) * CPU_TILE_SIZE, height);
+	// Same stream and (row) order as single rays of renderTile()
+	uint64_t stream = (uint64_t)tile_y * CPU_TILE_SIZE * width + tile_x * CPU_TILE_SIZE;
+	CpuRandom random(random_seed ^ ((uint64_t)accum_frame << 32), stream);
+	for(int y = tile_y * CPU_TILE_SIZE; y < y_end; y++){
+		for(int x = tile_x * CPU_TILE_SIZE; x < x_end; x++){
+			FrameUniforms& pixel_uniforms =
+			    tile_uniforms[(y % CPU_TILE_SIZE) * CPU_TILE_SIZE + x % CPU_TILE_SIZE];
+			pixel_uniforms = uniforms;
+			pixel_uniforms.rand_vec2_a = vec2(random.nextFloat(), random.nextFloat());
+			pixel_uniforms.rand_vec2_b = vec2(random.nextFloat(), random.nextFloat());
+			pixel_uniforms.rand_vec3 = vec3(random.nextFloat(), random.nextFloat(),
+			                                random.nextFloat());
+		}
+	}
+}
+void CpuRenderer::accumulatePixel(int x, int y, const vec3& color){
+	vec3& pixel = pixels[y * width + x];
+	float& moment = moments[y * width + x];
+	int& count = sample_counts[y * width + x];
+	float luminance = getLuminance(color);
+	if(accum_frame == 0){
+		pixel = color;
+		moment = luminance * luminance;
+		count = 1;
+	} else {
+		// Add pre-frame pixel color
+		pixel = (pixel * float(count) + color) / float(count + 1);
+		moment = (moment * float(count) + luminance * luminance) / float(count + 1);
+		count++;
+	}
+}
+
+void CpuRenderer::intersectTriangle(const CpuRay& ray, int tri_idx, CpuHit& hit) const {
+	const vec3* vertices = &scene.triangles[3 * tri_idx];
+	vec3 position0 = vertices[0];
+	intersectEdges(ray, tri_idx, position0, vertices[1] - position0,
+	               vertices[2] - position0, hit);
+}
+// Möller–Trumbore intersection algorithm
+inline void CpuRenderer::intersectEdges(const CpuRay& ray, int tri_idx, const vec3& position0,
+                                        const vec3& edge0, const vec3& edge1,
+                                        CpuHit& hit) const {
+	vec3 P = cross(ray.dir, edge1);
+	float det = dot(P, edge0);
+	if(-CPU_NEAR_ZERO < det && det < CPU_NEAR_ZERO) return;
+	float inv_det = 1.0f / det;
+	vec3 T = ray.org - position0;
+	float u = dot(T, P) * inv_det;
+	if(u < 0.0f || 1.0f < u) return;
+	vec3 Q = cross(T, edge0);
+	float v = dot(ray.dir, Q) * inv_det;
+	if(v < 0.0f || 1.0f < u + v) return;
+	float t = dot(edge1, Q) * inv_det;
+	if(CPU_NEAR_ZERO < t && t < hit.dist){ // Hit and nearer
+		hit.dist = t;
+		hit.u = u;
+		hit.v = v;
+		hit.tri_idx = tri_idx;
+	}
+}
+// Woop intersection (ray in unit triangle space, rows of makeWoopRecord())
+inline void CpuRenderer::intersectWoop(const CpuRay& ray, int tri_idx, const vec4* rows,
+                                       CpuHit& hit) const {
+	vec3 row2 = vec3(rows[2]);
+	float t = -(rows[2].w + dot(row2, ray.org)) / dot(row2, ray.dir);
+	if(!(CPU_NEAR_ZERO < t && t < hit.dist)) return;
+	vec3 row0 = vec3(rows[0]);
+	float u = rows[0].w + dot(row0, ray.org) + t * dot(row0, ray.dir);
+	if(u < 0.0f || 1.0f < u) return;
+	vec3 row1 = vec3(rows[1]);
+	float v = rows[1].w + dot(row1, ray.org) + t * dot(row1, ray.dir);
+	if(v < 0.0f || 1.0f < u + v) return;
+	hit.dist = t;
+	hit.u = u;
+	hit.v = v;
+	hit.tri_idx = tri_idx;
+}
+void CpuRenderer::testTriangles(const CpuRay& ray, int start, int end, CpuHit& hit) const {
+	switch(tri_record_type){
+		case TRI_RECORD_EDGES:
+			for(int tri_idx = start; tri_idx < end; tri_idx++){
+				const vec4* record = &tri_records[3 * tri_idx];
+				intersectEdges(ray, tri_idx, vec3(record[0]), vec3(record[1]), vec3(record[2]),
+				               hit);
+			}
+			break;
+		case TRI_RECORD_WOOP:
+			for(int tri_idx = start; tri_idx < end; tri_idx++){
+				intersectWoop(ray, tri_idx, &tri_records[3 * tri_idx], hit);
+			}
+			break;
+		default:
+			for(int tri_idx = start; tri_idx < end; tri_idx++){
+				intersectTriangle(ray, tri_idx, hit);
+			}
+	}
+}
+bool CpuRenderer::intersectBBox(const CpuRay& ray, int bbox_idx, float t_min,
+                                float t_max) const {
+	float t_far = t_max;
+	float t_near = t_min;
+	vec3 min_point = scene.bbox_minmax[2 * bbox_idx + 0];
+	vec3 max_point = scene.bbox_minmax[2 * bbox_idx + 1];
+	for(int i = 0; i < 3; i++){
+		float t1 = (min_point[i] - ray.org[i]) / ray.dir[i];
+		float t2 = (max_point[i] - ray.org[i]) / ray.dir[i];
+		if(t1 < t2){
+			t_far = std::min(t_far, t2);
+			t_near = std::max(t_near, t1);
+		} else {
+			t_far = std::min(t_far, t1);
+			t_near = std::max(t_near, t2);
+		}
+		if(t_far < t_near) return false;
+	}
+	return true;
+}
+void CpuRenderer::traverse(const CpuRay& ray, int bbox_idx, CpuHit& hit) const {
+	while(true){
+		const int* info = &scene.bbox_info[3 * bbox_idx];
+		hit.node_count++;
+		if(intersectBBox(ray, bbox_idx)){
+			// Leaf check (internal node is -1)
+			if(info[0] < 0){
+				// hit link
+				bbox_idx = info[1];
+				continue;
+			}
+			// Linear search
+			testTriangles(ray, info[0], info[1], hit);
+		}
+		// miss link (also hit link of leaf)
+		bbox_idx = info[2];
+		if(bbox_idx < 0) break;
+	}
+}
+float CpuRenderer::enterBBox(const CpuRay& ray, const vec3& inv_dir, int bbox_idx,
+                             float t_max) const {
+	float t_far = t_max;
+	float t_near = 0.0f;
+	vec3 min_point = scene.bbox_minmax[2 * bbox_idx + 0];
+	vec3 max_point = scene.bbox_minmax[2 * bbox_idx + 1];
+	for(int i = 0; i < 3; i++){
+		float t1 = (min_point[i] - ray.org[i]) * inv_dir[i];
+		float t2 = (max_point[i] - ray.org[i]) * inv_dir[i];
+		t_near = std::max(t_near, std::min(t1, t2));
+		t_far = std::min(t_far, std::max(t1, t2));
+	}
+	return (t_far < t_near) ? -1.0f : t_near;
+}
+void CpuRenderer::traverseStack(const CpuRay& ray, CpuHit& hit) const {
+	vec3 inv_dir = vec3(1.0f) / ray.dir;
+	int stack_nodes[CPU_BVH_STACK_SIZE];
+	float stack_dists[CPU_BVH_STACK_SIZE];
+	int stack_size = 0;
+	hit.node_count++;
+	int bbox_idx = (enterBBox(ray, inv_dir, 0, hit.dist) < 0.0f) ? -1 : 0;
+	while(bbox_idx >= 0){
+		const int* info = &scene.bbox_info[3 * bbox_idx];
+		// Leaf check (internal node is -1)
+		if(info[0] < 0){
+			// Children (right is miss link of left)
+			int left = info[1];
+			int right = scene.bbox_info[3 * left + 2];
+			float t_left = enterBBox(ray, inv_dir, left, hit.dist);
+			float t_right = enterBBox(ray, inv_dir, right, hit.dist);
+			hit.node_count += 2;
+			if(t_left >= 0.0f && t_right >= 0.0f){
+				// Nearer child first, farther one is deferred
+				if(t_right < t_left){
+					std::swap(left, right);
+					std::swap(t_left, t_right);
+				}
+				stack_nodes[stack_size] = right;
+				stack_dists[stack_size] = t_right;
+				stack_size++;
+				bbox_idx = left;
+				continue;
+			}
+			if(t_left >= 0.0f || t_right >= 0.0f){
+				bbox_idx = (t_left >= 0.0f) ? left : right;
+				continue;
+			}
+		} else {
+			// Linear search
+			testTriangles(ray, info[0], info[1], hit);
+		}
+		// Pop deferred child (culled behind nearest hit)
+		bbox_idx = -1;
+		while(stack_size > 0){
+			stack_size--;
+			if(stack_dists[stack_size] <= hit.dist){
+				bbox_idx = stack_nodes[stack_size];
+				break;
+			}
+		}
+	}
+}
+// Children hit nearer than dist (bits, t_near of each child)
+int CpuRenderer::intersectWideNode(const CpuRay& ray, const vec3& inv_dir, int node_idx,
+                                   float dist, float* t_nears) const {
+	const int width = wide->width;
+	const float* bounds = &wide->bounds[6 * width * node_idx];
+	int hit_bits = 0;
+#if SIMD_WIDTH > 1
+	for(int c = 0; c < width; c += SIMD_WIDTH){
+		int count = std::min(width - c, SIMD_WIDTH);
+		SimdFloat t_near = simdSet(0.0f);
+		SimdFloat t_far = simdSet(dist);
+		for(int i = 0; i < 3; i++){
+			SimdFloat org = simdSet(ray.org[i]);
+			SimdFloat inv = simdSet(inv_dir[i]);
+			SimdFloat t1 = simdMul(simdSub(simdLoadPartial(&bounds[i * width + c], count), org),
+			                       inv);
+			SimdFloat t2 = simdMul(simdSub(simdLoadPartial(&bounds[(3 + i) * width + c], count),
+			                                org), inv);
+			t_near = simdMax(t_near, simdMin(t1, t2));
+			t_far = simdMin(t_far, simdMax(t1, t2));
+		}
+		float lanes[SIMD_WIDTH];
+		simdStore(lanes, t_near);
+		for(int i = 0; i < count; i++) t_nears[c + i] = lanes[i];
+		int lane_bits = ~simdMaskBits(simdLess(t_far, t_near)) & ((1 << count) - 1);
+		hit_bits |= lane_bits << c;
+	}
+#else
+	for(int c = 0; c < width; c++){
+		float t_near = 0.0f, t_far = dist;
+		for(int i = 0; i < 3; i++){
+			float t1 = (bounds[i * width + c] - ray.org[i]) * inv_dir[i];
+			float t2 = (bounds[(3 + i) * width + c] - ray.org[i]) * inv_dir[i];
+			t_near = std::max(t_near, std::min(t1, t2));
+			t_far = std::min(t_far, std::max(t1, t2));
+		}
+		t_nears[c] = t_near;
+		if(!(t_far < t_near)) hit_bits |= 1 << c;
+	}
+#endif
+	return hit_bits;
+}
+void CpuRenderer::traverseWide(const CpuRay& ray, CpuHit& hit) const {
+	struct StackEntry {
+		int first, second; // child links
+		float t_near;
+	};
+	const int width = wide->width;
+	vec3 inv_dir = vec3(1.0f) / ray.dir;
+	StackEntry stack[CPU_WIDE_STACK_SIZE];
+	int stack_size = 0;
+	int node_idx = 0;
+	while(node_idx >= 0){
+		float t_nears[WIDE_BVH_MAX_WIDTH];
+		int hit_bits = intersectWideNode(ray, inv_dir, node_idx, hit.dist, t_nears);
+		hit.node_count++;
+		// Push hit children, nearest on top
+		const int* links = &wide->links[2 * width * node_idx];
+		int base = stack_size;
+		for(; hit_bits; hit_bits &= hit_bits - 1){
+			int c = __builtin_ctz(hit_bits);
+			StackEntry entry = {links[c], links[width + c], t_nears[c]};
+			int i = stack_size++;
+			for(; i > base && stack[i - 1].t_near < entry.t_near; i--) stack[i] = stack[i - 1];
+			stack[i] = entry;
+		}
+		// Pop next node (leaves are searched on the way)
+		node_idx = -1;
+		while(stack_size > 0){
+			StackEntry entry = stack[--stack_size];
+			if(entry.t_near > hit.dist) continue; // behind nearest hit
+			if(entry.first < 0){
+				node_idx = entry.second;
+				break;
+			}
+			testTriangles(ray, entry.first, entry.second, hit);
+		}
+	}
+}
+bool CpuRenderer::occludedWide(const CpuRay& ray, float t_max) const {
+	// Same as traverseWide() without order (children are all nearer than t_max)
+	const int width = wide->width;
+	vec3 inv_dir = vec3(1.0f) / ray.dir;
+	int stack[CPU_WIDE_STACK_SIZE];
+	int stack_size = 0;
+	int node_idx = 0;
+	CpuHit hit = {t_max, 0, 0, 0, 0};
+	while(true){
+		float t_nears[WIDE_BVH_MAX_WIDTH];
+		int hit_bits = intersectWideNode(ray, inv_dir, node_idx, t_max, t_nears);
+		const int* links = &wide->links[2 * width * node_idx];
+		for(; hit_bits; hit_bits &= hit_bits - 1){
+			int c = __builtin_ctz(hit_bits);
+			if(links[c] < 0){
+				stack[stack_size++] = links[width + c];
+				continue;
+			}
+			// Leaves are searched at once
+			testTriangles(ray, links[c], links[width + c], hit);
+			if(hit.dist < t_max) return true;
+		}
+		if(stack_size == 0) break;
+		node_idx = stack[--stack_size];
+	}
+	return false;
+}
+CpuIntersection CpuRenderer::getIntersection(const CpuRay& ray, const CpuHit& hit) const {
+	CpuIntersection result = {CPU_INFINITY, 0, vec3(0), vec3(0), vec2(0)};
+	if(!(hit.dist < CPU_INFINITY)) return result;
+	int tri_idx = hit.tri_idx;
+	float u = hit.u, v = hit.v;
+	result.dist = hit.dist;
+	result.tri_idx = tri_idx;
+	result.hit_position = ray.dir * hit.dist + ray.org;
+
+	float uv1 = 1.0f - u - v;
+
+	const vec3* normals = &scene.normals[3 * tri_idx];
+	vec3 n0 = normals[0] * 2.0f - 1.0f;
+	vec3 n1 = normals[1] * 2.0f - 1.0f;
+	vec3 n2 = normals[2] * 2.0f - 1.0f;
+	if(length(n0) < 0.5f && length(n1) < 0.5f && length(n2) < 0.5f){
+		const vec3* vertices = &scene.triangles[3 * tri_idx];
+		result.normal = normalize(cross(vertices[1] - vertices[0], vertices[2] - vertices[0]));
+	} else {
+		if(dot(n1, n0) < 0) n1 *= -1.0f;
+		if(dot(n2, n0) < 0) n2 *= -1.0f;
+		result.normal = n0 * uv1 + n1 * u + n2 * v;
+	}
+
+	const vec2* texcoords = &scene.texcoords[3 * tri_idx];
+	result.texcoord = texcoords[0] * uv1 + texcoords[1] * u + texcoords[2] * v;
+	return result;
+}
+CpuHit CpuRenderer::traceHit(const CpuRay& ray) const {
+	CpuHit hit = {CPU_INFINITY, 0, 0, 0, 0};
+	if(wide) traverseWide(ray, hit);
+	else if(stack_traversal) traverseStack(ray, hit);
+	else traverse(ray, 0, hit);
+	return hit;
+}
+CpuIntersection CpuRenderer::intersect(const CpuRay& ray) const {
+	// Attributes of nearest hit only
+	return getIntersection(ray, traceHit(ray));
+}
+bool CpuRenderer::occluded(const CpuRay& ray, float t_max) const {
+	if(wide) return occludedWide(ray, t_max);
+	CpuHit hit = {t_max, 0, 0, 0, 0};
+	int bbox_idx = 0;
+	while(true){
+		const int* info = &scene.bbox_info[3 * bbox_idx];
+		// Segment to t_max (bboxes behind origin too are culled)
+		if(intersectBBox(ray, bbox_idx, 0.0f, t_max)){
+			// Leaf check (internal node is -1)
+			if(info[0] < 0){
+				// hit link
+				bbox_idx = info[1];
+				continue;
+			}
+			// Any hit nearer than t_max
+			testTriangles(ray, info[0], info[1], hit);
+			if(hit.dist < t_max) return true;
+		}
+		// miss link (also hit link of leaf)
+		bbox_idx = info[2];
+		if(bbox_idx < 0) break;
+	}
+	return false;
+}
+
+vec3 CpuRenderer::sampleDiffuse(const vec3& light_dir, const vec3& look_dir,
+                                const vec3& normal, int tri_idx) const {
+	// Triangles without material are black
+	int mat_id = scene.mat_idxs[tri_idx];
+	if(mat_id < 0) return vec3(0);
+	vec3 Kd = scene.materials[2 * mat_id + 0];
+	vec3 Ks = scene.materials[2 * mat_id + 1];
+
+	vec3 L = vec3(0);
+	float Ld = dot(light_dir, normal);
+
+	// for neg normal
+	bool visible = (dot(-look_dir, normal) > 0.0f);
+	if(!visible){
+		Ld *= -1;
+	}
+
+	if(Ld > 0.0f){
+		L += Ld * Kd;
+
+		vec3 r = reflect(-light_dir, normal);
+		// pow() of negative base is undefined in GLSL (NaN on GPUs)
+		float base = dot(-look_dir, r);
+		float Ls = (base > 0.0f) ? pow(base, GLOSSINESS) : 0.0f;
+		if(Ls > 0){
+			L += Ls * Ks;
+		}
+	}
+
+	return clamp(L, 0.0f, 1.0f);
+}
+
+vec3 CpuRenderer::render(const CpuRay& ray, const FrameUniforms& uniforms,
+                         uint64_t& ray_count, const CpuPrimaryHit* primary) const {
+	vec3 L = vec3(0);
+	CpuRay rays[CPU_DEPTH_COUNT + 1] = {}; // direction of last one is zero
+	CpuIntersection results[CPU_DEPTH_COUNT];
+
+	int i;
+	/* Trace reverse ray */
+	for(i = 0; i < CPU_DEPTH_COUNT; i++){
+		/* Create new ray (dir) */
+		if(i == 0){
+			rays[i] = ray;
+		} else {
+			rays[i].dir = getBounceDir(rays[i-1].dir, results[i-1].normal, uniforms);
+		}
+		/* Emit */
+		if(i == 0 && primary){
+			results[i] = primary->result;
+		} else {
+			results[i] = intersect(rays[i]);
+			ray_count++;
+		}
+		if(results[i].dist >= CPU_INFINITY){ // miss Check
+			break;
+		}
+
+		/* Create new ray (org) */
+		rays[i+1].org = results[i].hit_position - 0.001f * rays[i].dir;
+	}
+
+	//i==CPU_DEPTH_COUNT or i-th ray did not hit.
+	i -= 1;
+
+	/* Sampling at each hit point */
+	for(; i >= 0; i--){
+		/* Direct Light */
+		vec3 direct_color = vec3(0);
+		float light_dist;
+		CpuRay s_ray = getShadowRay(rays[i+1].org, results[i].hit_position, uniforms,
+		                            light_dist);
+		bool shadowed;
+		if(i == 0 && primary){
+			shadowed = primary->shadowed;
+		} else {
+			shadowed = occluded(s_ray, light_dist);
+			ray_count++;
+		}
+		// Check arrival of the light
+		if(!shadowed){
+			direct_color += sampleDiffuse(s_ray.dir, rays[i].dir, results[i].normal,
+			                              results[i].tri_idx);
+		}
+
+		/* Update */
+		L = direct_color + L * sampleDiffuse(rays[i+1].dir, rays[i].dir, results[i].normal,
+		                                     results[i].tri_idx);
+		L = clamp(L, 0.0f, 1.0f);
+	}
+
+	return L;
+}
+CpuRay CpuRenderer::getCameraRay(const vec2& position, const FrameUniforms& uniforms) const {
+	vec3 camera_dir = normalize(uniforms.camera_dir_base +
+	                            (position.x + uniforms.rand_vec2_b.x) * uniforms.camera_xvec -
+	                            (position.y + uniforms.rand_vec2_b.y) * uniforms.camera_yvec);
+	CpuRay ray = {uniforms.camera_org, camera_dir};
+	return ray;
+}
+vec3 CpuRenderer::getBounceDir(const vec3& dir, const vec3& normal,
+                               const FrameUniforms& uniforms) const {
+	vec3 reflected = reflect(dir, normal);
+	vec3 w, u, v;
+	w = normal;
+	if(dot(w, reflected) < 0.0f) w *= -1;
+	if(std::abs(w.x) > 0.001f) u = normalize(cross(vec3(0.0f, 1.0f, 0.0f), w));
+	else                       u = normalize(cross(vec3(1.0f, 0.0f, 0.0f), w));
+	v = cross(w, u);
+	float r1 = uniforms.rand_vec2_a.x * 2 * 3.141592f;
+	float r2 = uniforms.rand_vec2_a.y;
+	float sqrt_r2 = sqrt(r2);
+	return normalize(u * cos(r1) * sqrt_r2 + v * sin(r1) * sqrt_r2 + w * sqrt(1.0f - r2));
+}
+CpuRay CpuRenderer::getShadowRay(const vec3& org, const vec3& hit_position,
+                                 const FrameUniforms& uniforms, float& light_dist) const {
+	vec3 light_rel_pos = (LIGHT_POS + LIGHT_POS_RANGE * (uniforms.rand_vec3 * 2.0f - 1.0f))
+	                     - hit_position;
+	light_dist = length(light_rel_pos);
+	CpuRay s_ray = {org, normalize(light_rel_pos)};
+	return s_ray;
+}
+vec3 CpuRenderer::renderPixel(const vec2& position, const FrameUniforms& uniforms,
+                              uint64_t& ray_count) const {
+	return render(getCameraRay(position, uniforms), uniforms, ray_count);
+}
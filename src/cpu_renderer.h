@@ -0,0 +1,220 @@
+#ifndef CPU_RENDERER_H_261017
+#define CPU_RENDERER_H_261017
+
+#include <vector>
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include "scene.h"
+#include "thread_pool.h"
+#include "simd.h"
+#include "wide_bvh.h"
+#include "tri_records.h"
+#include "pixel_stats.h"
+
+/* CPU reference of simple.fs
+ *   intersect(), sampleDiffuse() and render() read the same arrays as the
+ *   textures (SceneData) and use the same uniforms, so that shader changes
+ *   can be checked against it and scenes can be rendered without GPU.
+ *   Frames are split into tiles rendered by a work-stealing thread pool.
+ *   Camera rays and their shadow rays can be traced in SIMD packets.
+ *   Single rays of the binary BVH follow miss links, or visit nearer child
+ *   first with a short stack (farther child is culled behind nearest hit).
+ *   With a wide BVH, single rays test all children of a node at once.
+ *   Single rays can test precomputed triangle records (packets use vertices).
+ *   In wavefront mode, paths of many tiles advance together one bounce at a
+ *   time, with rays of each stage in sorted queues.
+ *   Accumulation is kept in float (the shader accumulates in framebuffer),
+ *   with the mean of squared luminance of each pixel for noise estimates.
+ *   With adaptive sampling, each frame samples only the noisiest pixels. */
+
+const static int CPU_DEPTH_COUNT = 3;
+const static float CPU_NEAR_ZERO = 1e-6f;
+const static float CPU_INFINITY = 1e5f;
+const static int CPU_TILE_SIZE = 16; // pixels per tile side
+// Packets of SIMD_WIDTH rays (pixel block in tile)
+const static int CPU_PACKET_WIDTH = (SIMD_WIDTH >= 4) ? 4 : 1;
+const static int CPU_PACKET_HEIGHT = SIMD_WIDTH / CPU_PACKET_WIDTH;
+// Packet is split into single rays when fewer lanes hit an internal node
+//   (0 : packets never split and the single ray fallback is unused. Every
+//    threshold from 2 to SIMD_WIDTH / 2 was slower, because a split ray
+//    continues through the rest of the tree by miss links alone)
+const static int CPU_PACKET_SPLIT_LANES = 0;
+// Stack entries of wide BVH traversal
+const static int CPU_WIDE_STACK_SIZE = 256;
+// Stack entries of binary BVH traversal in distance order
+const static int CPU_BVH_STACK_SIZE = 64;
+// Paths of one wavefront batch (whole tile rows, at least one)
+const static int CPU_WAVEFRONT_PATHS = 1 << 16;
+// Rays per task of wavefront stages
+const static int CPU_WAVEFRONT_CHUNK = 256;
+
+// Order of wavefront ray queues before tracing
+enum CpuRaySort {
+	CPU_SORT_NONE,   // order of paths (tiles)
+	CPU_SORT_OCTANT, // direction octant
+	CPU_SORT_CELL,   // direction octant, then Morton order of origin cell
+};
+
+// Uniforms of simple.fs for one frame
+struct FrameUniforms {
+	glm::vec3 camera_org, camera_dir_base, camera_xvec, camera_yvec;
+	glm::vec2 rand_vec2_a, rand_vec2_b;
+	glm::vec3 rand_vec3;
+};
+
+// Random stream (PCG32)
+class CpuRandom {
+public:
+	CpuRandom(uint64_t seed, uint64_t stream);
+	uint32_t next();
+	float nextFloat(); // [0, 1)
+private:
+	uint64_t state, inc;
+};
+
+struct CpuRay {
+	glm::vec3 org, dir;
+};
+struct CpuIntersection {
+	float dist;
+	int tri_idx;
+	glm::vec3 hit_position;
+	glm::vec3 normal;
+	glm::vec2 texcoord;
+};
+// Nearest hit while traversing (attributes are fetched at the end)
+struct CpuHit {
+	float dist, u, v;
+	int tri_idx;
+	int node_count; // fetched nodes (of whole packet for packet lanes)
+};
+// Camera ray intersection and occlusion of its shadow ray (traced in packets)
+struct CpuPrimaryHit {
+	CpuIntersection result;
+	bool shadowed;
+};
+
+class CpuRenderer {
+public:
+	// thread_count includes the calling thread (0 : hardware concurrency)
+	CpuRenderer(const SceneData& scene, int width, int height, int thread_count = 0);
+	// Render one frame for every pixel and accumulate it
+	void renderFrame(const FrameUniforms& uniforms);
+	// Draw random uniforms for each pixel from a stream of each tile
+	//   (faster convergence, but differs from the shader which has one per frame)
+	void setPixelRandom(bool enabled, uint64_t seed = 0);
+	// Trace camera and first shadow rays in packets (when SIMD is enabled)
+	void setPacketTraversal(bool enabled){ packet_traversal = enabled && SIMD_WIDTH > 1; }
+	// Trace single rays of binary BVH in distance order with a stack
+	//   (false : miss links, or when the tree is deeper than the stack)
+	bool setStackTraversal(bool enabled);
+	// Trace single rays in wide BVH collapsed from scene (NULL : binary)
+	//   false when it is deeper than the traversal stack
+	bool setWideBVH(const WideBVH* wide_bvh);
+	// Test triangles of single rays with records of makeTriRecords()
+	//   (NULL : vertices, records are not copied)
+	void setTriRecords(TriRecordType type, const glm::vec4* records);
+	// Render frames in wavefront stages (generate, extend, shadow, shade)
+	//   instead of one path after another (same image)
+	void setWavefront(bool enabled, CpuRaySort sort = CPU_SORT_CELL){
+		wavefront = enabled;
+		wavefront_sort = sort;
+	}
+	// Samples per pixel of each frame given to noisiest pixels, in (0, 1)
+	//   (0 : every pixel in every frame)
+	void setAdaptiveSampling(float ratio){ adaptive_ratio = ratio; }
+	// Restart accumulation (accum_frame = 0)
+	void clear();
+	int getAccumFrame() const { return accum_frame; }
+	int getWidth() const { return width; }
+	int getHeight() const { return height; }
+	int getThreadCount() const { return pool->getThreadCount(); }
+	// Accumulated pixels (bottom row first, as OpenGL)
+	const std::vector<glm::vec3>& getPixels() const { return pixels; }
+	// Mean of squared luminance of each pixel (for estimateImageNoise())
+	const std::vector<float>& getMoments() const { return moments; }
+	// Samples of each pixel (accum_frame without adaptive sampling)
+	const std::vector<int>& getSampleCounts() const { return sample_counts; }
+	// Samples of all pixels since accumulation start
+	uint64_t getSampleCount() const;
+	// Traced rays since construction (camera, bounce and shadow rays)
+	uint64_t getRayCount() const { return ray_count; }
+
+	// Color of pixel position (same as main() of simple.fs, ray_count is added)
+	glm::vec3 renderPixel(const glm::vec2& position, const FrameUniforms& uniforms,
+	                      uint64_t& ray_count) const;
+	CpuIntersection intersect(const CpuRay& ray) const;
+	// Nearest hit without attributes
+	CpuHit traceHit(const CpuRay& ray) const;
+	// Nearest hits of SIMD_WIDTH rays (lanes of active_bits)
+	void intersectPacket(const CpuRay* rays, int active_bits, CpuHit* hits) const;
+	// Any hit nearer than t_max (nodes beyond it are culled, first hit returns)
+	bool occluded(const CpuRay& ray, float t_max) const;
+	// Occluded lanes of active_bits (any hit nearer than t_maxs of each)
+	int occludedPacket(const CpuRay* rays, int active_bits, const float* t_maxs) const;
+	// Test triangles [start, end) of a leaf and keep nearer hit
+	void testTriangles(const CpuRay& ray, int start, int end, CpuHit& hit) const;
+	glm::vec3 sampleDiffuse(const glm::vec3& light_dir, const glm::vec3& look_dir,
+	                        const glm::vec3& normal, int tri_idx) const;
+	// primary : camera ray is already traced (NULL : traced here)
+	glm::vec3 render(const CpuRay& ray, const FrameUniforms& uniforms,
+	                 uint64_t& ray_count, const CpuPrimaryHit* primary = NULL) const;
+private:
+	void renderTile(int tile_x, int tile_y, const FrameUniforms& uniforms);
+	void renderWavefront(const FrameUniforms& uniforms);
+	// Pixel uniforms of tile in row order (CPU_TILE_SIZE^2, pixel_random only)
+	void drawTileUniforms(int tile_x, int tile_y, const FrameUniforms& uniforms,
+	                      FrameUniforms* tile_uniforms) const;
+	void accumulatePixel(int x, int y, const glm::vec3& color);
+	// Select pixels of frame (sample_mask)
+	void updateSampleMask();
+	bool isPixelSampled(int x, int y) const { return sample_mask[y * width + x] != 0; }
+	CpuRay getCameraRay(const glm::vec2& position, const FrameUniforms& uniforms) const;
+	glm::vec3 getBounceDir(const glm::vec3& dir, const glm::vec3& normal,
+	                       const FrameUniforms& uniforms) const;
+	CpuRay getShadowRay(const glm::vec3& org, const glm::vec3& hit_position,
+	                    const FrameUniforms& uniforms, float& light_dist) const;
+	void tracePrimaryPacket(const CpuRay* rays, const FrameUniforms* const* uniforms,
+	                        int active_bits, CpuPrimaryHit* primaries) const;
+	void traverse(const CpuRay& ray, int bbox_idx, CpuHit& hit) const;
+	void traverseStack(const CpuRay& ray, CpuHit& hit) const;
+	void traverseWide(const CpuRay& ray, CpuHit& hit) const;
+	bool occludedWide(const CpuRay& ray, float t_max) const;
+	int intersectWideNode(const CpuRay& ray, const glm::vec3& inv_dir, int node_idx,
+	                      float dist, float* t_nears) const;
+	CpuIntersection getIntersection(const CpuRay& ray, const CpuHit& hit) const;
+	void intersectTriangle(const CpuRay& ray, int tri_idx, CpuHit& hit) const;
+	void intersectEdges(const CpuRay& ray, int tri_idx, const glm::vec3& position0,
+	                    const glm::vec3& edge0, const glm::vec3& edge1, CpuHit& hit) const;
+	void intersectWoop(const CpuRay& ray, int tri_idx, const glm::vec4* rows,
+	                   CpuHit& hit) const;
+	// Hit of bbox in [t_min, t_max] of ray
+	bool intersectBBox(const CpuRay& ray, int bbox_idx, float t_min = -CPU_INFINITY,
+	                   float t_max = CPU_INFINITY) const;
+	// Entry distance of bbox in [0, t_max] of ray (-1 : miss)
+	float enterBBox(const CpuRay& ray, const glm::vec3& inv_dir, int bbox_idx,
+	                float t_max) const;
+
+	SceneData scene;
+	int width, height;
+	int accum_frame;
+	std::vector<glm::vec3> pixels;
+	std::vector<float> moments;
+	std::vector<int> sample_counts;
+	std::vector<char> sample_mask;
+	float adaptive_ratio;
+	std::atomic<uint64_t> ray_count;
+	bool pixel_random, packet_traversal, stack_traversal, wavefront;
+	CpuRaySort wavefront_sort;
+	uint64_t random_seed;
+	std::unique_ptr<ThreadPool> pool;
+	const WideBVH* wide;
+	TriRecordType tri_record_type;
+	const glm::vec4* tri_records;
+};
+
+#endif
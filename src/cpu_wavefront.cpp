@@ -0,0 +1,230 @@
+#include "cpu_renderer.h"
+
+#include <algorithm>
+
+using namespace glm;
+using namespace std;
+
+/* Wavefront rendering
+ *   A batch of paths (whole tile rows) advances one bounce at a time:
+ *     generate : camera rays of every path
+ *     extend   : nearest hits of the ray queue, next bounce rays and
+ *                shading terms of each hit
+ *     shadow   : shadow rays of the new hits (direct light is removed)
+ *     shade    : terms of each path are summed up backwards as render()
+ *   Queues are sorted before tracing, so that rays of similar direction and
+ *   origin fetch the same nodes and triangles one after another. Tracing
+ *   results do not depend on the order, so images equal those of render(). */
+
+namespace {
+
+// Shading terms of one path (rays travel in queues)
+//   L = clamp(directs[i] + L * factors[i]) from last hit to first, as render()
+struct PathState {
+	int x, y;         // pixel (x < 0 : unused slot)
+	int hit_count;
+	vec3 directs[CPU_DEPTH_COUNT]; // direct light of each hit (zero when shadowed)
+	vec3 factors[CPU_DEPTH_COUNT]; // diffuse of next ray at each hit
+};
+
+// Rays in SoA (path slot, depth and max distance of each)
+struct RayQueue {
+	vector<float> org[3], dir[3];
+	vector<int> slots, depths;
+	vector<float> dists; // light distance of shadow rays
+
+	int size() const { return int(slots.size()); }
+	void clear(){
+		for(int i = 0; i < 3; i++){
+			org[i].clear();
+			dir[i].clear();
+		}
+		slots.clear();
+		depths.clear();
+		dists.clear();
+	}
+	void push(const vec3& ray_org, const vec3& ray_dir, int slot, int depth,
+	          float dist = CPU_INFINITY){
+		for(int i = 0; i < 3; i++){
+			org[i].push_back(ray_org[i]);
+			dir[i].push_back(ray_dir[i]);
+		}
+		slots.push_back(slot);
+		depths.push_back(depth);
+		dists.push_back(dist);
+	}
+	CpuRay get(int idx) const {
+		CpuRay ray = {vec3(org[0][idx], org[1][idx], org[2][idx]),
+		              vec3(dir[0][idx], dir[1][idx], dir[2][idx])};
+		return ray;
+	}
+};
+
+// Next rays of extended queue (in queue order, compacted afterwards)
+struct ExtendResult {
+	bool hit;
+	CpuRay next_ray, s_ray;
+	float light_dist;
+};
+
+// Insert two zero bits before each of lower 7 bits
+inline uint32_t expandCellBits(uint32_t v){
+	v &= 0x7f;
+	v = (v | v << 8) & 0x0f00f;
+	v = (v | v << 4) & 0xc30c3;
+	v = (v | v << 2) & 0x249249;
+	return v;
+}
+
+// Reorder rays by octant (and origin cell in bounds of scene)
+//   Keys keep queue order of equal ones, so sorting is deterministic.
+void sortRayQueue(RayQueue& queue, CpuRaySort sort, const vec3& min_point,
+                  const vec3& max_point, vector<uint64_t>& keys, RayQueue& buff){
+	if(sort == CPU_SORT_NONE) return;
+	int count = queue.size();
+	const float CELL_MAX = 127.0f;
+	vec3 extent = max_point - min_point;
+	keys.resize(count);
+	for(int i = 0; i < count; i++){
+		uint32_t key = 0;
+		for(int axis = 0; axis < 3; axis++){
+			if(queue.dir[axis][i] < 0.0f) key |= 1 << axis;
+		}
+		if(sort == CPU_SORT_CELL){
+			uint32_t cell = 0;
+			for(int axis = 0; axis < 3; axis++){
+				float coord = (extent[axis] > 0) ?
+				    (queue.org[axis][i] - min_point[axis]) / extent[axis] * CELL_MAX : 0;
+				uint32_t c = uint32_t(std::min(std::max(coord, 0.0f), CELL_MAX));
+				cell |= expandCellBits(c) << (2 - axis);
+			}
+			key = (key << 21) | cell;
+		}
+		keys[i] = ((uint64_t)key << 32) | uint32_t(i);
+	}
+	std::sort(keys.begin(), keys.end());
+	buff.clear();
+	for(int i = 0; i < count; i++){
+		int idx = int(keys[i] & 0xffffffff);
+		buff.push(queue.get(idx).org, queue.get(idx).dir, queue.slots[idx], queue.depths[idx],
+		          queue.dists[idx]);
+	}
+	std::swap(queue, buff);
+}
+
+}
+
+void CpuRenderer::renderWavefront(const FrameUniforms& uniforms){
+	const int TILE_PIXELS = CPU_TILE_SIZE * CPU_TILE_SIZE;
+	int tiles_x = (width + CPU_TILE_SIZE - 1) / CPU_TILE_SIZE;
+	int tiles_y = (height + CPU_TILE_SIZE - 1) / CPU_TILE_SIZE;
+	int batch_rows = std::max(CPU_WAVEFRONT_PATHS / (tiles_x * TILE_PIXELS), 1);
+	vec3 min_point = scene.bbox_minmax[0], max_point = scene.bbox_minmax[1]; // root
+
+	// Path slots of tiles (TILE_PIXELS per tile in row order)
+	vector<PathState> paths(batch_rows * tiles_x * TILE_PIXELS);
+	vector<FrameUniforms> path_uniforms(pixel_random ? paths.size() : 1, uniforms);
+	RayQueue queue, shadow_queue, buff;
+	vector<ExtendResult> extended;
+	vector<uint64_t> keys;
+	for(int tile_y0 = 0; tile_y0 < tiles_y; tile_y0 += batch_rows){
+		int batch_tiles = std::min(batch_rows, tiles_y - tile_y0) * tiles_x;
+
+		/* Generate */
+		parallelFor(*pool, 0, batch_tiles, 1, [&](int begin, int end){
+			for(int tile_idx = begin; tile_idx < end; tile_idx++){
+				int tile_x = tile_idx % tiles_x, tile_y = tile_y0 + tile_idx / tiles_x;
+				if(pixel_random){
+					drawTileUniforms(tile_x, tile_y, uniforms,
+					                 &path_uniforms[tile_idx * TILE_PIXELS]);
+				}
+				for(int i = 0; i < TILE_PIXELS; i++){
+					PathState& path = paths[tile_idx * TILE_PIXELS + i];
+					path.x = tile_x * CPU_TILE_SIZE + i % CPU_TILE_SIZE;
+					path.y = tile_y * CPU_TILE_SIZE + i / CPU_TILE_SIZE;
+					path.hit_count = 0;
+					if(path.x >= width || path.y >= height) path.x = -1; // Tile edge
+					else if(!isPixelSampled(path.x, path.y)) path.x = -1; // Adaptive
+				}
+			}
+		});
+		queue.clear();
+		for(int slot = 0; slot < batch_tiles * TILE_PIXELS; slot++){
+			const PathState& path = paths[slot];
+			if(path.x < 0) continue;
+			CpuRay ray = getCameraRay(vec2(path.x + 0.5f, path.y + 0.5f),
+			                          path_uniforms[pixel_random ? slot : 0]);
+			queue.push(ray.org, ray.dir, slot, 0);
+		}
+
+		for(int depth = 0; depth < CPU_DEPTH_COUNT && queue.size() > 0; depth++){
+			/* Extend */
+			sortRayQueue(queue, wavefront_sort, min_point, max_point, keys, buff);
+			extended.resize(queue.size());
+			parallelFor(*pool, 0, queue.size(), CPU_WAVEFRONT_CHUNK, [&](int begin, int end){
+				for(int i = begin; i < end; i++){
+					CpuRay ray = queue.get(i);
+					CpuIntersection result = intersect(ray);
+					ExtendResult& ext = extended[i];
+					ext.hit = (result.dist < CPU_INFINITY);
+					if(!ext.hit) continue; // miss
+					int slot = queue.slots[i];
+					const FrameUniforms& pixel_uniforms = path_uniforms[pixel_random ? slot : 0];
+					// Next ray (direction of last one is zero)
+					ext.next_ray.org = result.hit_position - 0.001f * ray.dir;
+					ext.next_ray.dir = (depth + 1 < CPU_DEPTH_COUNT) ?
+					    getBounceDir(ray.dir, result.normal, pixel_uniforms) : vec3(0);
+					ext.s_ray = getShadowRay(ext.next_ray.org, result.hit_position,
+					                         pixel_uniforms, ext.light_dist);
+					// Shading terms (direct light until shadow ray is traced)
+					PathState& path = paths[slot];
+					path.hit_count = depth + 1;
+					path.directs[depth] = sampleDiffuse(ext.s_ray.dir, ray.dir, result.normal,
+					                                    result.tri_idx);
+					path.factors[depth] = sampleDiffuse(ext.next_ray.dir, ray.dir, result.normal,
+					                                    result.tri_idx);
+				}
+			});
+			ray_count += queue.size();
+			// Hit paths continue and cast shadow rays
+			shadow_queue.clear();
+			buff.clear();
+			for(int i = 0; i < queue.size(); i++){
+				const ExtendResult& ext = extended[i];
+				if(!ext.hit) continue;
+				int slot = queue.slots[i];
+				shadow_queue.push(ext.s_ray.org, ext.s_ray.dir, slot, depth, ext.light_dist);
+				if(depth + 1 < CPU_DEPTH_COUNT){
+					buff.push(ext.next_ray.org, ext.next_ray.dir, slot, depth + 1);
+				}
+			}
+			std::swap(queue, buff);
+
+			/* Shadow */
+			sortRayQueue(shadow_queue, wavefront_sort, min_point, max_point, keys, buff);
+			parallelFor(*pool, 0, shadow_queue.size(), CPU_WAVEFRONT_CHUNK,
+			            [&](int begin, int end){
+				for(int i = begin; i < end; i++){
+					// Check arrival of the light
+					if(!occluded(shadow_queue.get(i), shadow_queue.dists[i])) continue;
+					paths[shadow_queue.slots[i]].directs[depth] = vec3(0);
+				}
+			});
+			ray_count += shadow_queue.size();
+		}
+
+		/* Shade */
+		parallelFor(*pool, 0, batch_tiles * TILE_PIXELS, CPU_WAVEFRONT_CHUNK,
+		            [&](int begin, int end){
+			for(int slot = begin; slot < end; slot++){
+				const PathState& path = paths[slot];
+				if(path.x < 0) continue;
+				vec3 L = vec3(0);
+				for(int i = path.hit_count - 1; i >= 0; i--){
+					L = clamp(path.directs[i] + L * path.factors[i], 0.0f, 1.0f);
+				}
+				accumulatePixel(path.x, path.y, L);
+			}
+		});
+	}
+}
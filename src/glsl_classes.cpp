@@ -22,6 +22,14 @@ bool readShaderCode(const string& filename, string& dst_code){
 
 	return true;
 }
+// Insert lines after #version line
+void insertShaderLines(string& code, const string& lines){
+	if(lines.empty()) return;
+	size_t pos = code.find("#version");
+	pos = (pos == string::npos) ? 0 : code.find('\n', pos);
+	if(pos == string::npos) pos = code.size();
+	code.insert(pos, "\n" + lines);
+}
 GLint compileShader(int id, const string& code){
 	// Compile Shader
 	char const * code_ptr = code.c_str();
@@ -41,7 +49,7 @@ GLint compileShader(int id, const string& code){
 	}
 	return status;
 }
-GLuint loadShaders(const string& vs_file, const string& fs_file){
+GLuint loadShaders(const string& vs_file, const string& fs_file, const string& fs_defines){
 	// Read vertex shader file
 	string vs_code;
 	if(!readShaderCode(vs_file, vs_code)){
@@ -55,6 +63,7 @@ GLuint loadShaders(const string& vs_file, const string& fs_file){
 		cerr << "Can't open fragment file (" << fs_file << ")." << endl;
 		return 0;
 	}
+	insertShaderLines(fs_code, fs_defines);
 
 	// Create the shaders
 	GLuint vs_id = glCreateShader(GL_VERTEX_SHADER);
@@ -141,7 +150,7 @@ void TextureRect::setResizedBuffer(int width, int height, const GLvoid* data){
 	this->height = height;
 
 	this->active();
-	glTexImage2D(GL_TEXTURE_RECTANGLE, 0, format, width, height, 0, format, type, data);
+	glTexImage2D(GL_TEXTURE_RECTANGLE, 0, internalformat, width, height, 0, format, type, data);
 }
 void TextureRect::copyPixels(int width, int height) {
     this->active();
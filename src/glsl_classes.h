@@ -12,7 +12,9 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 /* Shader loaders */
-GLuint loadShaders(const std::string& vs_file, const std::string& fs_file);
+// fs_defines : lines inserted after #version of fragment shader (variant)
+GLuint loadShaders(const std::string& vs_file, const std::string& fs_file,
+                   const std::string& fs_defines = "");
 
 /* Vertex Attribute */
 template<typename T> 
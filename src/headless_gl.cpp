@@ -0,0 +1,112 @@
+#include "headless_gl.h"
+
+#include <iostream>
+#include <EGL/eglext.h>
+
+using namespace glm;
+using namespace std;
+
+bool HeadlessGL::init(int width, int height){
+	terminate();
+	this->width = width;
+	this->height = height;
+
+	// Display without window system (Mesa surfaceless platform, or default)
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+	    (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if(getPlatformDisplay){
+		display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+	}
+	if(display == EGL_NO_DISPLAY) display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	EGLint major, minor;
+	if(display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)){
+		cerr << "Failed to initialize EGL." << endl;
+		display = EGL_NO_DISPLAY;
+		return false;
+	}
+	cout << " >> EGL " << major << "." << minor << " (" << eglQueryString(display, EGL_VENDOR)
+	     << ")" << endl;
+
+	// Select OpenGL 3.3 Core Profile
+	// (default surface type is window, which surfaceless display has none of)
+	const EGLint config_attribs[] = {
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_NONE
+	};
+	EGLConfig config;
+	EGLint config_count = 0;
+	if(!eglBindAPI(EGL_OPENGL_API) ||
+	   !eglChooseConfig(display, config_attribs, &config, 1, &config_count) ||
+	   config_count == 0){
+		cerr << "Failed to find EGL config of OpenGL." << endl;
+		terminate();
+		return false;
+	}
+	const EGLint context_attribs[] = {
+		EGL_CONTEXT_MAJOR_VERSION_KHR, 3,
+		EGL_CONTEXT_MINOR_VERSION_KHR, 3,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR,
+		EGL_NONE
+	};
+	context = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attribs);
+	// Draw into framebuffer object only (EGL_KHR_surfaceless_context)
+	if(context == EGL_NO_CONTEXT ||
+	   !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)){
+		cerr << "Failed to create surfaceless EGL context." << endl;
+		terminate();
+		return false;
+	}
+
+	// Initialize GLEW (GLX part is not needed)
+	glewExperimental = true; // for core profile
+	GLenum glew_status = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+	if(glew_status == GLEW_ERROR_NO_GLX_DISPLAY) glew_status = GLEW_OK;
+#endif
+	if(glew_status != GLEW_OK){
+		cerr << "Failed to initialize GLEW." << endl;
+		terminate();
+		return false;
+	}
+	glGetError(); // GLEW may leave GL_INVALID_ENUM of core profile
+	cout << " >> " << glGetString(GL_RENDERER) << endl;
+
+	return initFramebuffer();
+}
+bool HeadlessGL::initFramebuffer(){
+	// 32 bit float color, so accumulation is not quantized
+	glGenRenderbuffers(1, &rbo);
+	glBindRenderbuffer(GL_RENDERBUFFER, rbo);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA32F, width, height);
+	glGenFramebuffers(1, &fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, rbo);
+	if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE){
+		cerr << "Failed to create framebuffer." << endl;
+		terminate();
+		return false;
+	}
+	glDrawBuffer(GL_COLOR_ATTACHMENT0);
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+	glViewport(0, 0, (GLsizei)width, (GLsizei)height);
+	return true;
+}
+void HeadlessGL::terminate(){
+	if(display == EGL_NO_DISPLAY) return;
+	if(context != EGL_NO_CONTEXT){
+		if(fbo) glDeleteFramebuffers(1, &fbo);
+		if(rbo) glDeleteRenderbuffers(1, &rbo);
+		eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+		eglDestroyContext(display, context);
+	}
+	eglTerminate(display);
+	display = EGL_NO_DISPLAY;
+	context = EGL_NO_CONTEXT;
+	fbo = rbo = 0;
+}
+void HeadlessGL::readPixels(vector<vec4>& pixels) const {
+	pixels.resize(width * height);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+	glReadPixels(0, 0, width, height, GL_RGBA, GL_FLOAT, &pixels[0]);
+}
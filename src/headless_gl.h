@@ -0,0 +1,34 @@
+#ifndef HEADLESS_GL_H_261017
+#define HEADLESS_GL_H_261017
+
+#include <vector>
+
+#include <GL/glew.h>
+#include <EGL/egl.h>
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+/* OpenGL 3.3 core context without window
+ *   A surfaceless EGL context (Mesa llvmpipe works without GPU) which draws
+ *   into a 32 bit float framebuffer object of the given size. */
+class HeadlessGL {
+public:
+	HeadlessGL() : display(EGL_NO_DISPLAY), context(EGL_NO_CONTEXT), fbo(0), rbo(0) {}
+	~HeadlessGL() { terminate(); }
+	// Create context and framebuffer, and make them current
+	bool init(int width, int height);
+	void terminate();
+	// RGBA pixels of framebuffer (bottom row first)
+	void readPixels(std::vector<glm::vec4>& pixels) const;
+private:
+	HeadlessGL(const HeadlessGL&);
+	HeadlessGL& operator=(const HeadlessGL&);
+	bool initFramebuffer();
+
+	EGLDisplay display;
+	EGLContext context;
+	GLuint fbo, rbo;
+	int width, height;
+};
+
+#endif
@@ -0,0 +1,177 @@
+#include "image_file.h"
+
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include <iostream>
+#include <algorithm>
+
+using namespace glm;
+using namespace std;
+
+bool hasExtension(const string& filename, const string& ext){
+	return filename.size() >= ext.size() &&
+	       filename.compare(filename.size() - ext.size(), ext.size(), ext) == 0;
+}
+
+bool writePfm(FILE* fp, int width, int height, const vector<vec3>& pixels){
+	// Negative scale is little endian, rows are bottom to top
+	fprintf(fp, "PF\n%d %d\n-1.0\n", width, height);
+	return fwrite(&pixels[0], sizeof(vec3), width * height, fp) == width * height;
+}
+bool writePpm(FILE* fp, int width, int height, const vector<vec3>& pixels){
+	fprintf(fp, "P6\n%d %d\n255\n", width, height);
+	vector<unsigned char> row(3 * width);
+	for(int y = height - 1; y >= 0; y--){
+		for(int x = 0; x < width; x++){
+			vec3 color = clamp(pixels[y * width + x], 0.0f, 1.0f);
+			for(int c = 0; c < 3; c++) row[3 * x + c] = (unsigned char)(color[c] * 255.0f + 0.5f);
+		}
+		if(fwrite(&row[0], 1, row.size(), fp) != row.size()) return false;
+	}
+	return true;
+}
+
+// 8 bit RGB in stored (uncompressed) deflate blocks, no zlib needed
+uint32_t updateCrc32(uint32_t crc, const unsigned char* data, size_t size){
+	static uint32_t table[256] = {0};
+	if(table[1] == 0){
+		for(uint32_t n = 0; n < 256; n++){
+			uint32_t c = n;
+			for(int k = 0; k < 8; k++) c = (c & 1) ? 0xedb88320u ^ (c >> 1) : (c >> 1);
+			table[n] = c;
+		}
+	}
+	crc = ~crc;
+	for(size_t i = 0; i < size; i++) crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
+void appendBigEndian(vector<unsigned char>& dst, uint32_t value){
+	for(int i = 3; i >= 0; i--) dst.push_back((unsigned char)(value >> (8 * i)));
+}
+bool writePngChunk(FILE* fp, const char* type, const vector<unsigned char>& data){
+	vector<unsigned char> chunk;
+	chunk.reserve(data.size() + 12);
+	appendBigEndian(chunk, data.size());
+	chunk.insert(chunk.end(), type, type + 4);
+	chunk.insert(chunk.end(), data.begin(), data.end());
+	appendBigEndian(chunk, updateCrc32(0, &chunk[4], data.size() + 4));
+	return fwrite(&chunk[0], 1, chunk.size(), fp) == chunk.size();
+}
+bool writePng(FILE* fp, int width, int height, const vector<vec3>& pixels){
+	// Rows top to bottom, each with filter type 0
+	vector<unsigned char> raw;
+	raw.reserve((size_t)(3 * width + 1) * height);
+	for(int y = height - 1; y >= 0; y--){
+		raw.push_back(0);
+		for(int x = 0; x < width; x++){
+			vec3 color = clamp(pixels[y * width + x], 0.0f, 1.0f);
+			for(int c = 0; c < 3; c++) raw.push_back((unsigned char)(color[c] * 255.0f + 0.5f));
+		}
+	}
+	const size_t BLOCK_SIZE = 65535;
+	vector<unsigned char> idat;
+	idat.reserve(raw.size() + raw.size() / BLOCK_SIZE * 5 + 16);
+	idat.push_back(0x78);
+	idat.push_back(0x01);
+	for(size_t pos = 0; pos < raw.size() || pos == 0; pos += BLOCK_SIZE){
+		size_t size = std::min(BLOCK_SIZE, raw.size() - pos);
+		idat.push_back(pos + size >= raw.size() ? 1 : 0); // final block
+		idat.push_back(size & 0xff);
+		idat.push_back(size >> 8);
+		idat.push_back(~size & 0xff);
+		idat.push_back((~size >> 8) & 0xff);
+		idat.insert(idat.end(), raw.begin() + pos, raw.begin() + pos + size);
+	}
+	uint32_t a = 1, b = 0; // Adler-32
+	for(size_t i = 0; i < raw.size(); i++){
+		a = (a + raw[i]) % 65521;
+		b = (b + a) % 65521;
+	}
+	appendBigEndian(idat, (b << 16) | a);
+
+	vector<unsigned char> ihdr;
+	appendBigEndian(ihdr, width);
+	appendBigEndian(ihdr, height);
+	const unsigned char ihdr_tail[] = {8, 2, 0, 0, 0}; // 8 bit RGB
+	ihdr.insert(ihdr.end(), ihdr_tail, ihdr_tail + 5);
+	const unsigned char signature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+	return fwrite(signature, 1, 8, fp) == 8 && writePngChunk(fp, "IHDR", ihdr) &&
+	       writePngChunk(fp, "IDAT", idat) && writePngChunk(fp, "IEND", vector<unsigned char>());
+}
+// 32 bit float RGB scanlines without compression (little endian host)
+void writeExrAttribute(FILE* fp, const char* name, const char* type, const void* value,
+                       int32_t size){
+	fwrite(name, 1, strlen(name) + 1, fp);
+	fwrite(type, 1, strlen(type) + 1, fp);
+	fwrite(&size, sizeof(size), 1, fp);
+	fwrite(value, 1, size, fp);
+}
+bool writeExr(FILE* fp, int width, int height, const vector<vec3>& pixels){
+	const unsigned char magic[] = {0x76, 0x2f, 0x31, 0x01, 2, 0, 0, 0};
+	fwrite(magic, 1, 8, fp);
+	// Channels in alphabetical order (name, FLOAT type, linear, sampling 1x1)
+	vector<unsigned char> channels;
+	const char* channel_names[] = {"B", "G", "R"};
+	for(int c = 0; c < 3; c++){
+		int32_t values[4] = {2, 0, 1, 1};
+		channels.push_back(channel_names[c][0]);
+		channels.push_back(0);
+		const unsigned char* bytes = reinterpret_cast<const unsigned char*>(values);
+		channels.insert(channels.end(), bytes, bytes + sizeof(values));
+	}
+	channels.push_back(0);
+	writeExrAttribute(fp, "channels", "chlist", &channels[0], channels.size());
+	unsigned char zero = 0;
+	writeExrAttribute(fp, "compression", "compression", &zero, 1);
+	int32_t window[4] = {0, 0, width - 1, height - 1};
+	writeExrAttribute(fp, "dataWindow", "box2i", window, sizeof(window));
+	writeExrAttribute(fp, "displayWindow", "box2i", window, sizeof(window));
+	writeExrAttribute(fp, "lineOrder", "lineOrder", &zero, 1);
+	float aspect = 1.0f, center[2] = {0.0f, 0.0f};
+	writeExrAttribute(fp, "pixelAspectRatio", "float", &aspect, sizeof(aspect));
+	writeExrAttribute(fp, "screenWindowCenter", "v2f", center, sizeof(center));
+	writeExrAttribute(fp, "screenWindowWidth", "float", &aspect, sizeof(aspect));
+	fwrite(&zero, 1, 1, fp);
+
+	// Offsets of scanlines (y, size, B, G, R rows), top row first
+	int32_t line_size = 3 * width * sizeof(float);
+	uint64_t offset = ftell(fp) + (uint64_t)height * sizeof(uint64_t);
+	for(int y = 0; y < height; y++){
+		fwrite(&offset, sizeof(offset), 1, fp);
+		offset += 2 * sizeof(int32_t) + line_size;
+	}
+	vector<float> line(3 * width);
+	for(int32_t y = 0; y < height; y++){
+		const vec3* row = &pixels[(height - 1 - y) * width];
+		for(int x = 0; x < width; x++){
+			for(int c = 0; c < 3; c++) line[c * width + x] = row[x][2 - c];
+		}
+		fwrite(&y, sizeof(y), 1, fp);
+		fwrite(&line_size, sizeof(line_size), 1, fp);
+		if(fwrite(&line[0], sizeof(float), line.size(), fp) != line.size()) return false;
+	}
+	return true;
+}
+
+bool writeImageFile(const string& filename, int width, int height,
+                    const vector<vec3>& pixels){
+	bool (*writer)(FILE*, int, int, const vector<vec3>&) = NULL;
+	if(hasExtension(filename, ".pfm")) writer = writePfm;
+	else if(hasExtension(filename, ".ppm")) writer = writePpm;
+	else if(hasExtension(filename, ".png")) writer = writePng;
+	else if(hasExtension(filename, ".exr")) writer = writeExr;
+	else {
+		cerr << "Unknown image format (" << filename << ")." << endl;
+		return false;
+	}
+	FILE* fp = fopen(filename.c_str(), "wb");
+	if(fp == NULL){
+		cerr << "Failed to open image file (" << filename << ")." << endl;
+		return false;
+	}
+	bool written = writer(fp, width, height, pixels);
+	written = (fclose(fp) == 0) && written;
+	if(!written) cerr << "Failed to write image file (" << filename << ")." << endl;
+	return written;
+}
@@ -0,0 +1,14 @@
+#ifndef IMAGE_FILE_H_261017
+#define IMAGE_FILE_H_261017
+
+#include <string>
+#include <vector>
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+/* Write RGB image by extension (.pfm, .exr : float, .ppm, .png : 8 bit
+ *   clamped), pixels are bottom row first (as OpenGL). */
+bool writeImageFile(const std::string& filename, int width, int height,
+                    const std::vector<glm::vec3>& pixels);
+
+#endif
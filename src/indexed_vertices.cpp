@@ -0,0 +1,62 @@
+#include "indexed_vertices.h"
+
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+
+using namespace glm;
+using namespace std;
+
+// Attributes of a corner (compared bitwise, as copied by obj loader)
+struct VertexKey {
+	vec3 position, normal;
+	vec2 texcoord;
+	bool operator==(const VertexKey& other) const {
+		return memcmp(this, &other, sizeof(VertexKey)) == 0;
+	}
+};
+struct VertexKeyHash {
+	size_t operator()(const VertexKey& key) const {
+		const int WORD_COUNT = sizeof(VertexKey) / 4;
+		uint32_t words[WORD_COUNT];
+		memcpy(words, &key, sizeof(VertexKey));
+		uint64_t hash = 0xcbf29ce484222325ULL;
+		for(int i = 0; i < WORD_COUNT; i++){
+			hash = (hash ^ words[i]) * 0x100000001b3ULL;
+		}
+		return hash ^ (hash >> 32);
+	}
+};
+
+void makeIndexedVertices(const SceneData& scene, IndexedVertices& vertices){
+	int tri_count = scene.info.tri_count;
+	vertices.positions.clear();
+	vertices.normals.clear();
+	vertices.texcoords.clear();
+	vertices.indices.resize(tri_count);
+
+	unordered_map<VertexKey, int, VertexKeyHash> vertex_map(3 * tri_count);
+	for(int i = 0; i < tri_count; i++){
+		for(int j = 0; j < 3; j++){
+			VertexKey key;
+			key.position = scene.triangles[3*i+j];
+			key.normal = scene.normals[3*i+j];
+			key.texcoord = scene.texcoords[3*i+j];
+			pair<unordered_map<VertexKey, int, VertexKeyHash>::iterator, bool> inserted =
+			    vertex_map.insert(make_pair(key, (int)vertices.positions.size()));
+			if(inserted.second){
+				vertices.positions.push_back(key.position);
+				vertices.normals.push_back(key.normal);
+				vertices.texcoords.push_back(key.texcoord);
+			}
+			vertices.indices[i][j] = inserted.first->second;
+		}
+	}
+	vertices.vertex_count = vertices.positions.size();
+
+	// Pad to texture rows
+	padTexRows(vertices.positions, 1, VERTEX_TEX_COL);
+	padTexRows(vertices.normals, 1, VERTEX_TEX_COL);
+	padTexRows(vertices.texcoords, 1, VERTEX_TEX_COL);
+	padTexRows(vertices.indices, 1, TRI_TEX_COL);
+}
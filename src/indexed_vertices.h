@@ -0,0 +1,26 @@
+#ifndef INDEXED_VERTICES_H_261017
+#define INDEXED_VERTICES_H_261017
+
+#include <vector>
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include "scene.h"
+
+/* Indexed vertices of a scene
+ *   Corners with the same position, normal and texcoord share a vertex, whose
+ *   attributes are one texel each in VERTEX_TEX_COL columns. Triangles keep
+ *   their BVH order as index triples (one texel in TRI_TEX_COL columns).
+ *   Made from the per corner arrays of a scene (not cached). */
+struct IndexedVertices {
+	int vertex_count;
+	std::vector<glm::vec3> positions; // |v| * vertex_idx
+	std::vector<glm::vec3> normals;   // |n| * vertex_idx
+	std::vector<glm::vec2> texcoords; // |u,v| * vertex_idx
+	std::vector<glm::ivec3> indices;  // |i0,i1,i2| * tri_idx
+};
+
+// Vertices and indices of every triangle (padded to texture rows)
+void makeIndexedVertices(const SceneData& scene, IndexedVertices& vertices);
+
+#endif
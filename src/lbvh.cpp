@@ -0,0 +1,327 @@
+#include "bvh_build.h"
+
+#include <cstdint>
+
+#include "arena.h"
+
+using namespace glm;
+using namespace std;
+
+/* Linear BVH (LBVH / HLBVH)
+ *   References are sorted by Morton codes of their centers and divided at
+ *   the highest differing bit. When sah_top_bits is set, clusters sharing
+ *   the top Morton bits are divided by binned SAH first (HLBVH). */
+
+struct MortonRef {
+	uint64_t code;
+	int ref_idx;
+};
+struct MortonCluster {
+	BuildRef bounds; // union of references (tri_idx is unused)
+	int begin, count; // range in sorted Morton references
+};
+
+struct LinearContext {
+	BVHNodes* nodes;
+	const BuildRef* refs; // triangle order
+	const MortonRef* morton_refs; // sorted
+	int* leaf_refs; // triangle idx referred by leaves
+	atomic<int> leaf_ref_count;
+	int bin_count, max_depth;
+	ThreadPool* pool;
+};
+
+/* Morton codes */
+// Insert two zero bits before each of lower 21 bits
+inline uint64_t expandBits(uint64_t v){
+	v &= 0x1fffff;
+	v = (v | v << 32) & 0x1f00000000ffffULL;
+	v = (v | v << 16) & 0x1f0000ff0000ffULL;
+	v = (v | v << 8) & 0x100f00f00f00f00fULL;
+	v = (v | v << 4) & 0x10c30c30c30c30c3ULL;
+	v = (v | v << 2) & 0x1249249249249249ULL;
+	return v;
+}
+void calcMortonCodes(const BuildRef* refs, int ref_count, const RefBounds& bounds,
+                     int axis_bits, MortonRef* morton_refs, ThreadPool& pool){
+	float max_coord = float((1 << axis_bits) - 1);
+	vec3 scale;
+	for(int axis = 0; axis < 3; axis++){
+		float extent = bounds.center_max[axis] - bounds.center_min[axis];
+		scale[axis] = (extent > 0) ? max_coord / extent : 0;
+	}
+	parallelFor(pool, 0, ref_count, PARALLEL_CHUNK_TRIS, [&](int begin, int end){
+		for(int i = begin; i < end; i++){
+			vec3 coord = (refs[i].getCenter() - bounds.center_min) * scale;
+			uint64_t code = 0;
+			for(int axis = 0; axis < 3; axis++){
+				uint64_t c = uint64_t(min(max(coord[axis], 0.f), max_coord));
+				code |= expandBits(c) << (2 - axis);
+			}
+			morton_refs[i].code = code;
+			morton_refs[i].ref_idx = i;
+		}
+	});
+}
+
+/* Parallel LSD radix sort (stable, 8 bits per pass) */
+const static int RADIX_BITS = 8, RADIX_SIZE = 1 << RADIX_BITS;
+void sortMortonRefs(MortonRef*& refs, MortonRef*& buff, int ref_count, int key_bits,
+                    ThreadPool& pool){
+	int chunk_count = getChunkCount(ref_count);
+	int begins[MAX_PARALLEL_CHUNKS + 1];
+	for(int c = 0; c <= chunk_count; c++){
+		begins[c] = getChunkBegin(ref_count, chunk_count, c);
+	}
+	vector<int> offsets(chunk_count * RADIX_SIZE);
+	for(int shift = 0; shift < key_bits; shift += RADIX_BITS){
+		// Histogram of each chunk
+		parallelFor(pool, 0, chunk_count, 1, [&](int begin, int end){
+			for(int c = begin; c < end; c++){
+				int* counts = &offsets[c * RADIX_SIZE];
+				fill(counts, counts + RADIX_SIZE, 0);
+				for(int i = begins[c]; i < begins[c + 1]; i++){
+					counts[(refs[i].code >> shift) & (RADIX_SIZE - 1)]++;
+				}
+			}
+		});
+		// Offsets ordered by digit then chunk (skip pass of single digit)
+		int offset = 0;
+		bool single_digit = false;
+		for(int d = 0; d < RADIX_SIZE; d++){
+			int digit_count = 0;
+			for(int c = 0; c < chunk_count; c++){
+				int count = offsets[c * RADIX_SIZE + d];
+				offsets[c * RADIX_SIZE + d] = offset;
+				offset += count;
+				digit_count += count;
+			}
+			if(digit_count == ref_count) single_digit = true;
+		}
+		if(single_digit) continue;
+		// Scatter
+		parallelFor(pool, 0, chunk_count, 1, [&](int begin, int end){
+			for(int c = begin; c < end; c++){
+				int* dsts = &offsets[c * RADIX_SIZE];
+				for(int i = begins[c]; i < begins[c + 1]; i++){
+					buff[dsts[(refs[i].code >> shift) & (RADIX_SIZE - 1)]++] = refs[i];
+				}
+			}
+		});
+		swap(refs, buff);
+	}
+}
+
+/* Hierarchy */
+void setLinearLeaf(LinearContext& ctx, int node_idx, const MortonRef* morton_refs, int ref_count){
+	BVHNodes& nodes = *ctx.nodes;
+	int leaf_begin = ctx.leaf_ref_count.fetch_add(ref_count);
+	vec3 min_point( INFINITY,  INFINITY,  INFINITY);
+	vec3 max_point(-INFINITY, -INFINITY, -INFINITY);
+	for(int i = 0; i < ref_count; i++){
+		const BuildRef& ref = ctx.refs[morton_refs[i].ref_idx];
+		min_point = min(min_point, ref.min_point);
+		max_point = max(max_point, ref.max_point);
+		ctx.leaf_refs[leaf_begin + i] = ref.tri_idx;
+	}
+	nodes.min_points[node_idx] = min_point;
+	nodes.max_points[node_idx] = max_point;
+	nodes.setLeaf(node_idx, leaf_begin, leaf_begin + ref_count);
+}
+void buildMortonNode(LinearContext& ctx, int node_idx, int begin, int ref_count, int depth){
+	BVHNodes& nodes = *ctx.nodes;
+	const MortonRef* morton_refs = ctx.morton_refs + begin;
+	if(ref_count <= LINEAR_MAX_LEAF_TRIS || (ctx.max_depth > 0 && depth >= ctx.max_depth)){
+		setLinearLeaf(ctx, node_idx, morton_refs, ref_count);
+		return;
+	}
+
+	//Devide at highest differing bit (or middle when all codes are same)
+	uint64_t first_code = morton_refs[0].code;
+	uint64_t last_code = morton_refs[ref_count - 1].code;
+	int left_count = ref_count / 2;
+	if(first_code != last_code){
+		uint64_t bit = uint64_t(1) << (63 - __builtin_clzll(first_code ^ last_code));
+		left_count = partition_point(morton_refs, morton_refs + ref_count,
+			[bit](const MortonRef& ref){ return (ref.code & bit) == 0; }) - morton_refs;
+	}
+	int left = nodes.add(2);
+	nodes.setInternal(node_idx, left, left + 1);
+	//Recursive call (large left subtree becomes a task)
+	if(ref_count >= PARALLEL_TASK_MIN_TRIS){
+		TaskGroup tasks(*ctx.pool);
+		tasks.run([=, &ctx](){
+			buildMortonNode(ctx, left, begin, left_count, depth + 1);
+		});
+		buildMortonNode(ctx, left + 1, begin + left_count, ref_count - left_count, depth + 1);
+		tasks.wait();
+	} else {
+		buildMortonNode(ctx, left, begin, left_count, depth + 1);
+		buildMortonNode(ctx, left + 1, begin + left_count, ref_count - left_count, depth + 1);
+	}
+
+	//Bounding Box Coordinates from children
+	nodes.min_points[node_idx] = min(nodes.min_points[left], nodes.min_points[left + 1]);
+	nodes.max_points[node_idx] = max(nodes.max_points[left], nodes.max_points[left + 1]);
+}
+
+/* SAH over clusters (HLBVH top levels) */
+void findMortonClusters(const MortonRef* morton_refs, int ref_count, int shift,
+                        const BuildRef* refs, vector<MortonCluster>& clusters,
+                        ThreadPool& pool){
+	// Cluster begins of each chunk
+	int chunk_count = getChunkCount(ref_count);
+	vector<vector<int> > chunk_begins(chunk_count);
+	parallelFor(pool, 0, chunk_count, 1, [&](int begin, int end){
+		for(int c = begin; c < end; c++){
+			int ref_begin = getChunkBegin(ref_count, chunk_count, c);
+			int ref_end = getChunkBegin(ref_count, chunk_count, c + 1);
+			for(int i = ref_begin; i < ref_end; i++){
+				if(i == 0 || (morton_refs[i].code >> shift) != (morton_refs[i - 1].code >> shift)){
+					chunk_begins[c].push_back(i);
+				}
+			}
+		}
+	});
+	vector<int> begins;
+	for(int c = 0; c < chunk_count; c++){
+		begins.insert(begins.end(), chunk_begins[c].begin(), chunk_begins[c].end());
+	}
+	begins.push_back(ref_count);
+	// Cluster bounds
+	int cluster_count = begins.size() - 1;
+	clusters.resize(cluster_count);
+	parallelFor(pool, 0, cluster_count, 1, [&](int begin, int end){
+		for(int k = begin; k < end; k++){
+			MortonCluster& cluster = clusters[k];
+			cluster.begin = begins[k];
+			cluster.count = begins[k + 1] - begins[k];
+			cluster.bounds.min_point = vec3( INFINITY,  INFINITY,  INFINITY);
+			cluster.bounds.max_point = vec3(-INFINITY, -INFINITY, -INFINITY);
+			cluster.bounds.tri_idx = -1;
+			for(int i = cluster.begin; i < cluster.begin + cluster.count; i++){
+				const BuildRef& ref = refs[morton_refs[i].ref_idx];
+				cluster.bounds.min_point = min(cluster.bounds.min_point, ref.min_point);
+				cluster.bounds.max_point = max(cluster.bounds.max_point, ref.max_point);
+			}
+		}
+	});
+}
+void buildClusterNode(LinearContext& ctx, int node_idx, MortonCluster* clusters,
+                      int cluster_count, int ref_count, int depth){
+	BVHNodes& nodes = *ctx.nodes;
+	if(cluster_count == 1){
+		buildMortonNode(ctx, node_idx, clusters[0].begin, clusters[0].count, depth);
+		return;
+	}
+
+	//Bounding Box Coordinates
+	RefBounds bounds;
+	bounds.init();
+	for(int k = 0; k < cluster_count; k++) bounds.grow(&clusters[k].bounds, 1);
+	nodes.min_points[node_idx] = bounds.min_point;
+	nodes.max_points[node_idx] = bounds.max_point;
+
+	//Put clusters into bins weighted by their reference counts
+	SahBinning binning(bounds.center_min, bounds.center_max, ctx.bin_count);
+	SahBinSet bin_set;
+	bin_set.init(ctx.bin_count);
+	for(int k = 0; k < cluster_count; k++){
+		SahBin cluster_bin;
+		cluster_bin.min_point = clusters[k].bounds.min_point;
+		cluster_bin.max_point = clusters[k].bounds.max_point;
+		cluster_bin.count = clusters[k].count;
+		for(int axis = 0; axis < 3; axis++){
+			bin_set.bins[axis][binning.getBinIdx(clusters[k].bounds, axis)].grow(cluster_bin);
+		}
+	}
+
+	//Search best bin boundary to devide
+	float total_surface = surface(bounds.min_point, bounds.max_point);
+	SahSplit split = findBinnedSplit(bin_set, binning, total_surface, TRI_TIME * ref_count);
+	bool same_centers = (bounds.center_min == bounds.center_max); // devided in half
+	if((split.axis < 0 && !same_centers) || (ctx.max_depth > 0 && depth >= ctx.max_depth)){
+		// Leaf of all clusters
+		int leaf_begin = ctx.leaf_ref_count.fetch_add(ref_count), leaf_end = leaf_begin;
+		for(int k = 0; k < cluster_count; k++){
+			for(int i = 0; i < clusters[k].count; i++){
+				int ref_idx = ctx.morton_refs[clusters[k].begin + i].ref_idx;
+				ctx.leaf_refs[leaf_end++] = ctx.refs[ref_idx].tri_idx;
+			}
+		}
+		nodes.setLeaf(node_idx, leaf_begin, leaf_end);
+		return;
+	}
+
+	int left_cluster_count = cluster_count / 2, left_ref_count = 0;
+	if(split.axis >= 0){
+		left_cluster_count = partition(clusters, clusters + cluster_count,
+			[&](const MortonCluster& cluster){
+				return binning.getBinIdx(cluster.bounds, split.axis) <= split.bin_idx;
+			}) - clusters;
+	}
+	for(int k = 0; k < left_cluster_count; k++) left_ref_count += clusters[k].count;
+	int right_cluster_count = cluster_count - left_cluster_count;
+	int right_ref_count = ref_count - left_ref_count;
+	MortonCluster* right_clusters = clusters + left_cluster_count;
+
+	int left = nodes.add(2);
+	nodes.setInternal(node_idx, left, left + 1);
+	//Recursive call (large left subtree becomes a task)
+	if(ref_count >= PARALLEL_TASK_MIN_TRIS){
+		TaskGroup tasks(*ctx.pool);
+		tasks.run([=, &ctx](){
+			buildClusterNode(ctx, left, clusters, left_cluster_count, left_ref_count, depth + 1);
+		});
+		buildClusterNode(ctx, left + 1, right_clusters, right_cluster_count, right_ref_count,
+		                 depth + 1);
+		tasks.wait();
+	} else {
+		buildClusterNode(ctx, left, clusters, left_cluster_count, left_ref_count, depth + 1);
+		buildClusterNode(ctx, left + 1, right_clusters, right_cluster_count, right_ref_count,
+		                 depth + 1);
+	}
+}
+
+void buildLinearBvh(const vector<vec3>& tri_vertices, const BVHBuildSettings& settings,
+                    ThreadPool& pool, BVHNodes& nodes, vector<int>& tri_refs){
+	int tri_count = tri_vertices.size() / 3;
+	int axis_bits = (settings.morton_bits > 30) ? 21 : 10;
+	int key_bits = 3 * axis_bits;
+	int top_bits = std::min(std::max(settings.sah_top_bits, 0), key_bits);
+
+	// Triangle references and their Morton codes
+	Arena arena;
+	BuildRef* refs = arena.allocArray<BuildRef>(tri_count);
+	initTriangleRefs(tri_vertices, refs, pool);
+	RefBounds bounds;
+	calcRefBounds(refs, tri_count, bounds, pool);
+	MortonRef* morton_refs = arena.allocArray<MortonRef>(tri_count);
+	MortonRef* morton_buff = arena.allocArray<MortonRef>(tri_count);
+	calcMortonCodes(refs, tri_count, bounds, axis_bits, morton_refs, pool);
+	sortMortonRefs(morton_refs, morton_buff, tri_count, key_bits, pool);
+
+	// Node array (a leaf has one triangle at least)
+	nodes.allocate(2 * tri_count - 1);
+	int root = nodes.add(1);
+	tri_refs.resize(tri_count);
+
+	// Start dividing
+	LinearContext ctx;
+	ctx.nodes = &nodes;
+	ctx.refs = refs;
+	ctx.morton_refs = morton_refs;
+	ctx.leaf_refs = &tri_refs[0];
+	ctx.leaf_ref_count = 0;
+	ctx.bin_count = std::min(std::max(settings.bin_count, MIN_BIN_COUNT), MAX_BIN_COUNT);
+	ctx.max_depth = settings.max_depth;
+	ctx.pool = &pool;
+	if(top_bits > 0){
+		vector<MortonCluster> clusters;
+		findMortonClusters(morton_refs, tri_count, key_bits - top_bits, refs, clusters, pool);
+		buildClusterNode(ctx, root, &clusters[0], clusters.size(), tri_count, 1);
+	} else {
+		buildMortonNode(ctx, root, 0, tri_count, 1);
+	}
+	nodes.shrink();
+}
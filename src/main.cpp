@@ -4,6 +4,9 @@
 #include <iostream>
 #include <sstream>
 #include <cassert>
+#include <cstdlib>
+#include <chrono>
+#include <thread>
 
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
@@ -12,12 +15,22 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 
-#include "tinyobjloader/tiny_obj_loader.h"
 
 #include "fps_counter.h"
 #include "glsl_classes.h"
 #include "camera.h"
 #include "bvh.h"
+#include "obj_loader.h"
+#include "memory_usage.h"
+#include "bvh_cache.h"
+#include "scene_file.h"
+#include "scene.h"
+#include "wide_bvh.h"
+#include "tri_records.h"
+#include "indexed_vertices.h"
+#include "headless_gl.h"
+#include "image_file.h"
+#include "pixel_stats.h"
 
 
 using namespace glm;
@@ -29,14 +42,32 @@ vector<vec3> prev_pixel_buff;
 
 const string VS_FILE = "../src/simple.vs";
 const string FS_FILE = "../src/simple.fs";
+const int SHADER_WIDE_STACK_SIZE = 64; // WIDE_STACK_SIZE of simple.fs
+const int SHADER_BVH_STACK_SIZE = 64; // BVH_STACK_SIZE of simple.fs
 
 string OBJ_FILE = "../data/CornellBox-Sphere.obj"; // default
 const int VSYNC_INTERVAL = 0;
 
-const int TRI_TEX_COL = 512;
-const int M_ID_TEX_COL = 512;
-const int M_TEX_COL = 2;
-const int BVH_TEX_COL = 512;
+BVHBuildSettings bvh_settings;
+bool bvh_method_given = false;
+int bvh_linear_threshold = LINEAR_BUILD_MIN_TRIS; // triangles to choose linear BVH
+bool bvh_compare = false;
+BVHLayout bvh_layout = BVH_LAYOUT_DEPTH_FIRST;
+int bvh_width = 2; // children per node in shader (4, 8 : collapsed wide BVH)
+bool bvh_stack_traversal = false; // binary BVH in distance order with a stack in shader
+TriRecordType tri_record_type = TRI_RECORD_VERTICES; // triangle test in shader
+bool indexed_vertices = false; // shared vertices and index triples in shader
+string bvh_cache_dir = "bvh_cache"; // empty : disabled
+string sequence_pattern; // printf pattern of deforming mesh frames (empty : OBJ_FILE)
+int sequence_first = 0;
+bool headless = false; // offscreen EGL context instead of window
+int headless_frames = 64; // accumulation frames of headless mode
+double headless_seconds = 0; // time budget of headless mode (0 : frames only)
+double headless_target_error = 0; // relative error to stop headless mode (0 : none)
+const int NOISE_CHECK_FRAMES = 16; // frames between noise estimates of target error
+float adaptive_ratio = 0; // samples per pixel of each headless frame (0 : every pixel)
+const int ADAPTIVE_MASK_FRAMES = 4; // frames sampling the pixels of one mask
+string output_file = "render.pfm"; // image of headless mode
 
 /* Convert float* to vector<T> */
 template<typename T> 
@@ -65,172 +96,6 @@ void convToVecs(vector<T>& dst_tex, int width, int height,
 		}
 	}
 }
-bool loadObjFile(const string& filename, vector<vec3>& triangle_buff,
-                 vector<vec3>& normal_buff, vector<vec2>& texcoord_buf,
-                 vector<int>& mat_idx_buff, vector<vec3>& material_buff){
-	cout << " obj: " << filename << endl;
-
-	string basepath = ".";
-	size_t slash_idx = filename.find_last_of('/');
-	if(slash_idx != string::npos) {
-		basepath = filename.substr(0, slash_idx + 1);
-	}
-	cout << "material search path: " <<  basepath << endl;
-
-	vector<tinyobj::shape_t> shapes;
-	vector<tinyobj::material_t> materials;
-	string err;
-	bool ret = tinyobj::LoadObj(shapes, materials, err, filename.c_str(),
-	                            basepath.c_str());
-	if (!ret) {
-		cerr << err << endl;
-		return false;
-	}
-
-	// Calc obj buffers
-	for(int shape_idx = 0; shape_idx < shapes.size(); shape_idx++){
-		int tri_count = shapes[shape_idx].mesh.indices.size() / 3;
-		for(int tri_idx = 0; tri_idx < tri_count; tri_idx++){
-			int v_idxs[3]; //vertices' indices
-			vec3 v[3]; //vertices
-			vec3 n[3]; //normals
-			vec2 t[3]; //texcoord
-			for(int i = 0; i < 3; i++){
-				v_idxs[i] = shapes[shape_idx].mesh.indices[tri_idx * 3 + i];
-
-				v[i].x = shapes[shape_idx].mesh.positions[v_idxs[i] * 3 + 0];
-				v[i].y = shapes[shape_idx].mesh.positions[v_idxs[i] * 3 + 1];
-				v[i].z = shapes[shape_idx].mesh.positions[v_idxs[i] * 3 + 2];
-
-				if(shapes[shape_idx].mesh.normals.size() == 0) {
-					n[i].x = n[i].y = n[i].z = 0;
-				} else {
-					n[i].x = shapes[shape_idx].mesh.normals[v_idxs[i] * 3 + 0];
-					n[i].y = shapes[shape_idx].mesh.normals[v_idxs[i] * 3 + 1];
-					n[i].z = shapes[shape_idx].mesh.normals[v_idxs[i] * 3 + 2];
-				}
-
-				if(shapes[shape_idx].mesh.texcoords.size() == 0) {
-					t[i].x = t[i].y = 0;
-				} else {
-					t[i].x = shapes[shape_idx].mesh.texcoords[v_idxs[i] * 2 + 0];
-					t[i].y = shapes[shape_idx].mesh.texcoords[v_idxs[i] * 2 + 1];
-				}
-
-				// Add to triangle_buff
-				triangle_buff.push_back(v[i]);
-
-				// Add to normal_buff
-				normal_buff.push_back((n[i] + 1.f) / 2.f);
-
-				// Add to texcoord_buf
-				texcoord_buf.push_back(t[i]);
-			}
-			// Add to mat_idx_buff
-			mat_idx_buff.push_back(shapes[shape_idx].mesh.material_ids[tri_idx]);
-		}
-	}
-	for(int mat_idx = 0; mat_idx < materials.size(); mat_idx++){
-		vec3 kd, ks;
-		kd.x = materials[mat_idx].diffuse[0];
-		kd.y = materials[mat_idx].diffuse[1];
-		kd.z = materials[mat_idx].diffuse[2];
-		ks.x = materials[mat_idx].specular[0];
-		ks.y = materials[mat_idx].specular[1];
-		ks.z = materials[mat_idx].specular[2];
-		// Add to material_buff
-		material_buff.push_back(kd);
-		material_buff.push_back(ks);
-	}
-}
-
-
-/* Convert Vectors */
-template<typename T> 
-T getMinPoint(const vector<T>& vec){
-	T min_point;
-	int size = sizeof(vec[0]) / sizeof(vec[0][0]);
-	//Init min
-	for(int i = 0; i < size; i++){
-		min_point[i] =  INFINITY;
-	}
-	// Get min
-	for(int i = 0; i < vec.size(); i++){
-		for(int j = 0; j < size; j++){
-			if(min_point[j] > vec[i][j]) min_point[j] = vec[i][j];
-		}
-	}
-	return min_point;
-}
-template<typename T> 
-T getMaxPoint(const vector<T>& vec){
-	T max_point;
-	int size = sizeof(vec[0]) / sizeof(vec[0][0]);
-	//Init max
-	for(int i = 0; i < size; i++){
-		max_point[i] = -INFINITY;
-	}
-	// Get max
-	for(int i = 0; i < vec.size(); i++){
-		for(int j = 0; j < size; j++){
-			if(max_point[j] < vec[i][j]) max_point[j] = vec[i][j];
-		}
-	}
-	return max_point;
-}
-template<typename T> 
-float getClampScale(vector<T>& vec){
-
-	T max_point = getMaxPoint(vec);
-	T min_point = getMinPoint(vec);
-
-	// Max diff
-	T diff = max_point - min_point;
-	float max_diff = -INFINITY;
-	int size = sizeof(vec[0])/sizeof(vec[0][0]);
-	for(int i = 0; i < size; i++){
-		if(max_diff < diff[i]){
-			max_diff = diff[i];
-		}
-	}
-	return 1.0/max_diff;
-}
-template<typename T> 
-void transformVec(vector<T>& vec, float scale, T shift){
-	// Scale
-	for(int i = 0; i < vec.size(); i++){
-		vec[i] = vec[i] + shift;
-		vec[i] *= scale;
-	}
-	return;
-}
-template<typename T> 
-void transformVec(vector<T>& vec, vec3 scale, T shift){
-	// Scale
-	for(int i = 0; i < vec.size(); i++){
-		vec[i] = vec[i] + shift;
-		vec[i] *= scale;
-	}
-	return;
-}
-template<typename T>
-void joinVectors(const vector<T>& src1, const vector<T>& src2, vector<T>& dst,
-                 int src1_cols, int src2_cols){
-	int rows = src1.size() / src1_cols;
-	//check rows
-	assert(src1.size() % src1_cols == 0 && src2.size() % src2_cols == 0);
-	assert(rows == src2.size() / src2_cols);
-
-	dst.clear();
-	for(int row = 0; row < rows; row++){
-		for(int col1 = 0; col1 < src1_cols; col1++){
-			dst.push_back(src1[row*src1_cols + col1]);
-		}
-		for(int col2 = 0; col2 < src2_cols; col2++){
-			dst.push_back(src2[row*src2_cols + col2]);
-		}
-	}
-}
 
 
 /* GLFW Callback */
@@ -284,7 +149,10 @@ void motionFunc(GLFWwindow* window, double mouse_x, double mouse_y){
 }
 /* OpenGL Initializer */
 GLFWwindow* window;
+HeadlessGL headless_gl;
 bool initGL(){
+	if(headless) return headless_gl.init(WIDTH, HEIGHT);
+
 	// Initialise GLFW
 	if(!glfwInit()){
 		cerr << "Failed to initialize GLFW." << endl;
@@ -323,68 +191,440 @@ bool initGL(){
 	return true;
 }
 
-/* Main */
-int main(int argc, char const* argv[]){
-	if(argc == 1) {
-		cout << endl;
-		cout << " > usage: ./render.out [mesh.obj]" << endl;
-		cout << endl;
-	} else {
-		OBJ_FILE = argv[1];
+/* Command line */
+void printUsage(){
+	cout << endl;
+	cout << " > usage: ./render.out [options] [mesh.obj or scene.scene]" << endl;
+	cout << "     --bvh <sweep|binned|sbvh|linear> : BVH builder (default: binned, linear"
+	     << " for large meshes)" << endl;
+	cout << "     --bvh-bins <n>            : SAH bins per axis [" << MIN_BIN_COUNT
+	     << ", " << MAX_BIN_COUNT << "] (default: 32)" << endl;
+	cout << "     --bvh-threads <n>         : BVH build threads (default: all cores)" << endl;
+	cout << "     --bvh-split-budget <f>    : duplicated references per triangle for sbvh"
+	     << " (default: 0.3)" << endl;
+	cout << "     --bvh-linear-threshold <n> : triangles to choose linear by default (default: "
+	     << LINEAR_BUILD_MIN_TRIS << ", 0 : never)" << endl;
+	cout << "     --bvh-morton-bits <30|63> : Morton code bits for linear (default: 30)" << endl;
+	cout << "     --bvh-sah-top-bits <n>    : top Morton bits built with SAH for linear"
+	     << " (default: 15, 0 : LBVH)" << endl;
+	cout << "     --bvh-treelet-passes <n>  : treelet optimization passes after build"
+	     << " (default: 0)" << endl;
+	cout << "     --bvh-treelet-size <n>    : leaves per treelet [3, " << MAX_TREELET_SIZE
+	     << "] (default: 7)" << endl;
+	cout << "     --bvh-layout <dfs|veb>    : node order in texture (default: dfs)" << endl;
+	cout << "     --bvh-width <2|4|8>       : children per node in shader, 4 and 8 are"
+	     << " traversed nearest first (default: 2)" << endl;
+	cout << "     --bvh-traversal <stackless|stack> : binary BVH by miss links, or nearer"
+	     << " child first with a stack (default: stackless)" << endl;
+	cout << "     --tri-records <vertices|edges|woop> : precomputed triangles of"
+	     << " intersection (default: vertices)" << endl;
+	cout << "     --vertices <corners|indexed> : vertex textures of each triangle corner, or"
+	     << " of shared vertices with indices (default: corners)" << endl;
+	cout << "     --cache-dir <dir>         : BVH cache directory (default: bvh_cache)" << endl;
+	cout << "     --no-cache                : always build BVH without cache" << endl;
+	cout << "     --bvh-compare             : build with every builder and compare" << endl;
+	cout << "     --sequence <pattern>      : deforming mesh frames (e.g. frame_%04d.obj),"
+	     << " BVH is refitted" << endl;
+	cout << "     --bvh-refit-ratio <f>     : SAH cost ratio to rebuild after refit"
+	     << " (default: 1.5)" << endl;
+	cout << "     --width <n>, --height <n> : image size (default: 360x240)" << endl;
+	cout << "     --headless                : render offscreen without window (EGL) and"
+	     << " write image" << endl;
+	cout << "     --frames <n>              : accumulation frames of headless (default: 64)"
+	     << endl;
+	cout << "     --time <sec>              : time budget of headless, stops at first of"
+	     << " frames, time and error (default: 0, none)" << endl;
+	cout << "     --target-error <f>        : relative error of image to stop headless"
+	     << " (default: 0, none)" << endl;
+	cout << "     --adaptive <f>            : samples per pixel of each headless frame, given"
+	     << " to noisiest pixels (default: 1, every pixel)" << endl;
+	cout << "     --output <file>           : .pfm, .exr, .ppm or .png image of headless"
+	     << " (default: render.pfm)" << endl;
+	cout << endl;
+}
+bool parseArgs(int argc, char const* argv[]){
+	for(int i = 1; i < argc; i++){
+		string arg = argv[i];
+		bool has_value = (i + 1 < argc);
+		if(arg == "--bvh" && has_value){
+			string method = argv[++i];
+			if(method == "sweep") bvh_settings.method = BVH_BUILD_SWEEP;
+			else if(method == "binned") bvh_settings.method = BVH_BUILD_BINNED;
+			else if(method == "sbvh") bvh_settings.method = BVH_BUILD_SPATIAL;
+			else if(method == "linear") bvh_settings.method = BVH_BUILD_LINEAR;
+			else {
+				cerr << "Unknown BVH builder (" << method << ")." << endl;
+				return false;
+			}
+			bvh_method_given = true;
+		} else if(arg == "--bvh-bins" && has_value){
+			bvh_settings.bin_count = atoi(argv[++i]);
+		} else if(arg == "--bvh-threads" && has_value){
+			bvh_settings.thread_count = atoi(argv[++i]);
+		} else if(arg == "--bvh-split-budget" && has_value){
+			bvh_settings.split_budget = atof(argv[++i]);
+		} else if(arg == "--bvh-linear-threshold" && has_value){
+			bvh_linear_threshold = atoi(argv[++i]);
+		} else if(arg == "--bvh-morton-bits" && has_value){
+			bvh_settings.morton_bits = atoi(argv[++i]);
+		} else if(arg == "--bvh-sah-top-bits" && has_value){
+			bvh_settings.sah_top_bits = atoi(argv[++i]);
+		} else if(arg == "--bvh-treelet-passes" && has_value){
+			bvh_settings.treelet_passes = atoi(argv[++i]);
+		} else if(arg == "--bvh-treelet-size" && has_value){
+			bvh_settings.treelet_size = atoi(argv[++i]);
+		} else if(arg == "--bvh-layout" && has_value){
+			string layout = argv[++i];
+			if(layout == "dfs") bvh_layout = BVH_LAYOUT_DEPTH_FIRST;
+			else if(layout == "veb") bvh_layout = BVH_LAYOUT_VEB;
+			else {
+				cerr << "Unknown BVH layout (" << layout << ")." << endl;
+				return false;
+			}
+		} else if(arg == "--bvh-width" && has_value){
+			bvh_width = atoi(argv[++i]);
+			if(bvh_width != 2 && bvh_width != 4 && bvh_width != 8){
+				cerr << "BVH width must be 2, 4 or 8 (" << bvh_width << ")." << endl;
+				return false;
+			}
+		} else if(arg == "--bvh-traversal" && has_value){
+			string traversal = argv[++i];
+			if(traversal == "stackless") bvh_stack_traversal = false;
+			else if(traversal == "stack") bvh_stack_traversal = true;
+			else {
+				cerr << "Unknown BVH traversal (" << traversal << ")." << endl;
+				return false;
+			}
+		} else if(arg == "--tri-records" && has_value){
+			string type = argv[++i];
+			if(!getTriRecordType(type, tri_record_type)){
+				cerr << "Unknown triangle records (" << type << ")." << endl;
+				return false;
+			}
+		} else if(arg == "--vertices" && has_value){
+			string vertices = argv[++i];
+			if(vertices == "corners") indexed_vertices = false;
+			else if(vertices == "indexed") indexed_vertices = true;
+			else {
+				cerr << "Unknown vertices (" << vertices << ")." << endl;
+				return false;
+			}
+		} else if(arg == "--cache-dir" && has_value){
+			bvh_cache_dir = argv[++i];
+		} else if(arg == "--no-cache"){
+			bvh_cache_dir.clear();
+		} else if(arg == "--bvh-compare"){
+			bvh_compare = true;
+		} else if(arg == "--sequence" && has_value){
+			sequence_pattern = argv[++i];
+		} else if(arg == "--bvh-refit-ratio" && has_value){
+			bvh_settings.refit_max_cost_ratio = atof(argv[++i]);
+		} else if(arg == "--width" && has_value){
+			WIDTH = atoi(argv[++i]);
+		} else if(arg == "--height" && has_value){
+			HEIGHT = atoi(argv[++i]);
+		} else if(arg == "--headless"){
+			headless = true;
+		} else if(arg == "--frames" && has_value){
+			headless_frames = atoi(argv[++i]);
+		} else if(arg == "--time" && has_value){
+			headless_seconds = atof(argv[++i]);
+		} else if(arg == "--target-error" && has_value){
+			headless_target_error = atof(argv[++i]);
+		} else if(arg == "--adaptive" && has_value){
+			adaptive_ratio = atof(argv[++i]);
+			if(adaptive_ratio >= 1.0f) adaptive_ratio = 0; // every pixel
+		} else if(arg == "--output" && has_value){
+			output_file = argv[++i];
+		} else if(arg.size() > 0 && arg[0] == '-'){
+			cerr << "Unknown option (" << arg << ")." << endl;
+			return false;
+		} else {
+			OBJ_FILE = arg;
+		}
+	}
+	if(WIDTH <= 0 || HEIGHT <= 0){
+		cerr << "Image size must be positive (" << WIDTH << "x" << HEIGHT << ")." << endl;
+		return false;
+	}
+	if(headless && headless_frames <= 0 && headless_seconds <= 0 &&
+	   headless_target_error <= 0){
+		cerr << "Headless mode needs frames, time budget or target error." << endl;
+		return false;
+	}
+	if(!headless && (headless_target_error > 0 || adaptive_ratio > 0)){
+		cerr << "Target error and adaptive sampling need headless mode." << endl;
+		return false;
+	}
+	return true;
+}
+double getElapsedMsec(const chrono::steady_clock::time_point& start){
+	chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+	return elapsed.count();
+}
+/* Headless mode ends at accumulation frames, time budget or target error */
+bool continueHeadless(int frame_count, double elapsed_msec, const ImageNoise& noise){
+	if(headless_frames > 0 && frame_count >= headless_frames) return false;
+	if(headless_target_error > 0 && noise.relative_error > 0 &&
+	   noise.relative_error <= headless_target_error) return false;
+	return headless_seconds <= 0 || elapsed_msec < headless_seconds * 1e3;
+}
+// Accumulated pixels and their noise (alpha is mean of squared luminance)
+ImageNoise readHeadlessImage(const HeadlessGL& gl, const vector<int>& sample_counts,
+                             vector<vec3>& pixels, vector<float>& moments){
+	vector<vec4> accum_pixels;
+	gl.readPixels(accum_pixels); // waits for the last frame
+	pixels.resize(accum_pixels.size());
+	moments.resize(accum_pixels.size());
+	for(size_t i = 0; i < accum_pixels.size(); i++){
+		pixels[i] = vec3(accum_pixels[i]);
+		moments[i] = accum_pixels[i].w;
+	}
+	return estimateImageNoise(pixels, moments, sample_counts);
+}
+/* Compare build time and quality of each BVH builder */
+void compareBvhBuild(const vector<vec3>& triangle_buff, const string& name,
+                     const BVHBuildSettings& settings){
+	resetPeakRss();
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	BVH bvh;
+	bvh.build(triangle_buff, settings);
+	double build_msec = getElapsedMsec(start);
+	cout << " >> " << name << ": " << build_msec << " ms, SAH cost "
+	     << bvh.getSahCost() << ", " << bvh.getTriRefs().size() << " refs, peak memory "
+	     << (getPeakRss() >> 20) << " MB" << endl;
+}
+void compareBvhBuilders(const vector<vec3>& triangle_buff){
+	BVHBuildSettings settings = bvh_settings;
+	settings.treelet_passes = 0;
+	settings.method = BVH_BUILD_SWEEP;
+	compareBvhBuild(triangle_buff, "sweep", settings);
+	// Binned builder for each thread count
+	settings.method = BVH_BUILD_BINNED;
+	int max_threads = max((int)thread::hardware_concurrency(), 1);
+	for(int threads = 1; ; threads *= 2){
+		if(threads > max_threads) threads = max_threads;
+		settings.thread_count = threads;
+		stringstream name;
+		name << "binned (" << threads << " threads)";
+		compareBvhBuild(triangle_buff, name.str(), settings);
+		if(threads >= max_threads) break;
 	}
+	// Spatial splits with current thread setting
+	settings.method = BVH_BUILD_SPATIAL;
+	settings.thread_count = bvh_settings.thread_count;
+	compareBvhBuild(triangle_buff, "sbvh", settings);
+	// Linear BVH
+	settings.method = BVH_BUILD_LINEAR;
+	compareBvhBuild(triangle_buff, "linear", settings);
+	// Treelet optimization after each of binned and linear
+	settings.treelet_passes = max(bvh_settings.treelet_passes, 2);
+	stringstream passes;
+	passes << " + " << settings.treelet_passes << " treelet passes";
+	settings.method = BVH_BUILD_BINNED;
+	compareBvhBuild(triangle_buff, "binned" + passes.str(), settings);
+	settings.method = BVH_BUILD_LINEAR;
+	compareBvhBuild(triangle_buff, "linear" + passes.str(), settings);
+}
 
+/* Deforming mesh sequence (frames share triangle order and materials) */
+string getSceneFile(int frame_idx){
+	if(sequence_pattern.empty()) return OBJ_FILE;
+	char filename[1024];
+	snprintf(filename, sizeof(filename), sequence_pattern.c_str(), frame_idx);
+	return filename;
+}
+bool initSequence(){
+	if(sequence_pattern.empty()) return true;
+	// First frame is 0 or 1
+	for(sequence_first = 0; sequence_first <= 1; sequence_first++){
+		if(ifstream(getSceneFile(sequence_first).c_str())) return true;
+	}
+	cerr << "Failed to find first frame (" << sequence_pattern << ")." << endl;
+	return false;
+}
+// Load positions of frame with the transform of first frame
+bool loadSequenceFrame(int frame_idx, const SceneInfo& info, ObjBuffers& frame){
+	string filename = getSceneFile(frame_idx);
+	if(!ifstream(filename.c_str())) return false;
+	if(!loadObjFile(filename, frame.triangle_buff, frame.normal_buff, frame.texcoord_buf,
+	                frame.mat_idx_buff, frame.material_buff)) return false;
+	transformVec(frame.triangle_buff, info.point_scale, info.min_point * -1.f);
+	return true;
+}
+
+/* Build scene from obj file */
+bool buildScene(BVH& bvh, ObjBuffers& obj, SceneBuffers& buffs){
 	// Load Obj file
 	cout << "* Loading obj file." << endl;
-	vector<vec3> triangle_buff; // |v0,v1,v2| * tri_idx
-	vector<vec3> normal_buff;   // |n0,n1,n2| * tri_idx
-	vector<vec2> texcoord_buf;   // |u,v| * tri_idx
-	vector<int>  mat_idx_buff;  // |mat_idx| * tri_idx
-	vector<vec3> material_buff; // |Kd, Ks| * mat_idx
-	{
-		if(!loadObjFile(OBJ_FILE, triangle_buff, normal_buff, texcoord_buf,
-		                mat_idx_buff, material_buff)) return 1;
-		// Clamp triangle_buff to [0,1]
-		float point_scale = getClampScale(triangle_buff); // base scale
-		vec3 min_point = getMinPoint(triangle_buff); // base min_point
-		transformVec(triangle_buff, point_scale, min_point * -1.f);
-	}
+	resetPeakRss();
+	ObjAttributes attributes; // expanded after BVH build
+	if(!loadObjScene(getSceneFile(sequence_first), obj, attributes, buffs.info)) return false;
 
-	cout << " >> " << triangle_buff.size()/3 << " triangles" << endl;
+	cout << " >> " << obj.triangle_buff.size()/3 << " triangles, peak memory "
+	     << (getPeakRss() >> 20) << " MB" << endl;
 
 	// BVH
+	if(bvh_compare){
+		cout << "* Comparing BVH builders." << endl;
+		compareBvhBuilders(obj.triangle_buff);
+	}
+	int tri_count = obj.triangle_buff.size() / 3;
+	if(!bvh_method_given && bvh_linear_threshold > 0 && tri_count >= bvh_linear_threshold){
+		bvh_settings.method = BVH_BUILD_LINEAR;
+		cout << "* Large mesh, linear BVH builder is used." << endl;
+	}
 	cout << "* Building BVH." << endl;
-	BVH bvh;
-	bvh.build(triangle_buff);
-	vector<int> bbox_tri_array; // triangle indices in bvh order
-	vector<vec3> bbox_minmax_array;  // |min, max| * bbox_idx
-	vector<int> bbox_tri_idx_array;  // |start_idx, end_idx| * bbox_idx
-	vector<int> bbox_miss_idx_array; // |miss_idx| * bbox_idx
-	bvh.getInfo(bbox_minmax_array, bbox_tri_array, bbox_tri_idx_array,
-	            bbox_miss_idx_array);
-	cout << " >> " << bbox_minmax_array.size()/2 << " bboxes" << endl;
-
-	// Sort triangle_buff in bvh order
-	vector<vec3> orl_triangle_buff = triangle_buff;
-	vector<vec3> orl_normal_buff = normal_buff;
-	vector<vec2> orl_texcoord_buf = texcoord_buf;
-	vector<int> orl_mat_idx_buff = mat_idx_buff;
-	for(int i = 0; i < bbox_tri_array.size(); i++){
-		mat_idx_buff[i] = orl_mat_idx_buff[bbox_tri_array[i]];
-		triangle_buff[3*i+0] = orl_triangle_buff[3*bbox_tri_array[i]+0];
-		triangle_buff[3*i+1] = orl_triangle_buff[3*bbox_tri_array[i]+1];
-		triangle_buff[3*i+2] = orl_triangle_buff[3*bbox_tri_array[i]+2];
-		normal_buff[3*i+0] = orl_normal_buff[3*bbox_tri_array[i]+0];
-		normal_buff[3*i+1] = orl_normal_buff[3*bbox_tri_array[i]+1];
-		normal_buff[3*i+2] = orl_normal_buff[3*bbox_tri_array[i]+2];
-		texcoord_buf[3*i+0] = orl_texcoord_buf[3*bbox_tri_array[i]+0];
-		texcoord_buf[3*i+1] = orl_texcoord_buf[3*bbox_tri_array[i]+1];
-		texcoord_buf[3*i+2] = orl_texcoord_buf[3*bbox_tri_array[i]+2];
+	resetPeakRss();
+	chrono::steady_clock::time_point bvh_start = chrono::steady_clock::now();
+	bvh.build(obj.triangle_buff, bvh_settings);
+	cout << " >> " << getElapsedMsec(bvh_start) << " ms, peak memory "
+	     << (getPeakRss() >> 20) << " MB" << endl;
+	resetPeakRss();
+	expandObjScene(attributes, obj);
+	if(sequence_pattern.empty()){
+		// Obj buffers become scene buffers, and tree is not refitted
+		orderScene(bvh, bvh_layout, std::move(obj), buffs);
+		bvh.release();
+	} else {
+		orderScene(bvh, bvh_layout, obj, buffs);
+	}
+	cout << " >> " << buffs.info.bbox_count << " bboxes, peak memory "
+	     << (getPeakRss() >> 20) << " MB, current " << (getCurrentRss() >> 20) << " MB"
+	     << endl;
+	return true;
+}
+/* BVH cache of scene */
+// Hash of obj, build settings and texture layout
+bool getSceneCacheKey(uint64_t& key){
+	if(!hashObjFile(OBJ_FILE, key)) return false;
+	int method = bvh_method_given ? bvh_settings.method : -1; // -1 : by threshold
+	key = hashValue(method, key);
+	key = hashValue(bvh_method_given ? 0 : bvh_linear_threshold, key);
+	key = hashValue(bvh_settings.bin_count, key);
+	key = hashValue(bvh_settings.max_depth, key);
+	key = hashValue(bvh_settings.split_budget, key);
+	key = hashValue(bvh_settings.morton_bits, key);
+	key = hashValue(bvh_settings.sah_top_bits, key);
+	key = hashValue(bvh_settings.treelet_passes, key);
+	key = hashValue(bvh_settings.treelet_size, key);
+	key = hashValue(bvh_layout, key);
+	key = getSceneLayoutKey(key);
+	return true;
+}
+
+/* Uniform locations of render shader */
+struct ShaderUniforms {
+	GLuint bbox_size, camera_org, camera_dir_base, camera_xvec, camera_yvec, screen_size;
+	GLuint rand_vec2_a, rand_vec2_b, rand_vec3, accum_frame, mask_frame;
+};
+/* Render shader of current options (0 : failed) */
+GLuint loadRenderShader(ShaderUniforms& uniforms){
+	stringstream fs_defines;
+	if(bvh_width > 2) fs_defines << "#define WIDE_BVH_WIDTH " << bvh_width << endl;
+	else if(bvh_stack_traversal) fs_defines << "#define BVH_STACK_TRAVERSAL" << endl;
+	if(headless) fs_defines << "#define PIXEL_VARIANCE" << endl;
+	if(adaptive_ratio > 0) fs_defines << "#define ADAPTIVE_SAMPLING" << endl;
+	if(getTriRecordDefine(tri_record_type)){
+		fs_defines << "#define " << getTriRecordDefine(tri_record_type) << endl;
+	}
+	if(indexed_vertices) fs_defines << "#define INDEXED_VERTICES" << endl;
+	GLuint program_id = loadShaders(VS_FILE, FS_FILE, fs_defines.str());
+	if(program_id == 0) return 0;
+	uniforms.bbox_size = glGetUniformLocation(program_id, "bbox_size");
+	uniforms.camera_org = glGetUniformLocation(program_id, "camera_org");
+	uniforms.camera_dir_base = glGetUniformLocation(program_id, "camera_dir_base");
+	uniforms.camera_xvec = glGetUniformLocation(program_id, "camera_xvec");
+	uniforms.camera_yvec = glGetUniformLocation(program_id, "camera_yvec");
+	uniforms.screen_size = glGetUniformLocation(program_id, "screen_size");
+	uniforms.rand_vec2_a = glGetUniformLocation(program_id, "rand_vec2_a");
+	uniforms.rand_vec2_b = glGetUniformLocation(program_id, "rand_vec2_b");
+	uniforms.rand_vec3 = glGetUniformLocation(program_id, "rand_vec3");
+	uniforms.accum_frame = glGetUniformLocation(program_id, "accum_frame");
+	uniforms.mask_frame = glGetUniformLocation(program_id, "mask_frame");
+	return program_id;
+}
+
+/* Main */
+int main(int argc, char const* argv[]){
+	if(argc == 1) printUsage();
+	if(!parseArgs(argc, argv)){
+		printUsage();
+		return 1;
+	}
+
+	// Scene
+	if(!initSequence()) return 1;
+	BVH bvh;                  // kept to refit sequence
+	ObjBuffers obj_buffs;
+	SceneBuffers scene_buffs; // owner of built scene
+	BVHCacheFile cache_file;  // owner of cached scene or scene file
+	SceneData scene;
+	uint64_t cache_key = 0;
+	bool scene_file = (sequence_pattern.empty() && isSceneFile(OBJ_FILE));
+	bool use_cache = (!scene_file && !bvh_cache_dir.empty() && !bvh_compare &&
+	                  sequence_pattern.empty() && getSceneCacheKey(cache_key));
+	string cache_path = use_cache ? getBVHCachePath(bvh_cache_dir, cache_key) : "";
+	chrono::steady_clock::time_point load_start = chrono::steady_clock::now();
+	if(scene_file){
+		// Converted by scene_convert, BVH options are of the conversion
+		if(!loadSceneFile(OBJ_FILE, getSceneLayoutKey(), cache_file, scene)){
+			cerr << "Failed to load scene file (" << OBJ_FILE << "), it may be of other"
+			     << " texture layout." << endl;
+			return 1;
+		}
+		cout << "* Loaded scene file (" << OBJ_FILE << ")." << endl;
+	} else if(use_cache && loadSceneFile(cache_path, cache_key, cache_file, scene)){
+		cout << "* Loaded BVH cache (" << cache_path << ")." << endl;
+	} else {
+		if(!buildScene(bvh, obj_buffs, scene_buffs)) return 1;
+		setSceneData(scene_buffs, scene);
+		if(use_cache){
+			if(writeSceneFile(cache_path, cache_key, scene_buffs)){
+				cout << "* Wrote BVH cache (" << cache_path << ")." << endl;
+			} else {
+				cerr << "Failed to write BVH cache (" << cache_path << ")." << endl;
+			}
+		}
+	}
+	cout << " >> " << scene.info.tri_count << " triangles, " << scene.info.bbox_count
+	     << " bboxes, scale " << scene.info.point_scale << " (" << getElapsedMsec(load_start)
+	     << " ms)" << endl;
+
+	// Wide BVH (made from scene arrays, not cached)
+	WideBVH wide_bvh;
+	if(bvh_width > 2){
+		collapseBVH(scene, bvh_width, wide_bvh);
+		if(getWideStackSize(wide_bvh) > SHADER_WIDE_STACK_SIZE){
+			cerr << "BVH" << bvh_width << " is too deep for shader stack, binary BVH is used."
+			     << endl;
+			bvh_width = 2;
+		} else {
+			cout << " >> " << wide_bvh.node_count << " nodes of BVH" << bvh_width << endl;
+		}
+	}
+	if(bvh_stack_traversal && bvh_width == 2 &&
+	   getBVHStackSize(scene) > SHADER_BVH_STACK_SIZE){
+		cerr << "BVH is too deep for shader stack, miss links are used." << endl;
+		bvh_stack_traversal = false;
 	}
 
-	// Join arrays
-	vector<int> bbox_info_array;  // |start_idx, end_idx, miss_idx| * bbox_idx
-	joinVectors(bbox_tri_idx_array, bbox_miss_idx_array, bbox_info_array, 2, 1);
+	// Triangle records (made from scene arrays, not cached)
+	vector<vec4> tri_records;
+	makeTriRecords(scene, tri_record_type, tri_records);
 
+	// Indexed vertices (made from scene arrays, not cached)
+	IndexedVertices vertices;
+	if(indexed_vertices && !sequence_pattern.empty()){
+		cerr << "Indexed vertices are not used with --sequence." << endl;
+		indexed_vertices = false;
+	}
+	if(indexed_vertices){
+		makeIndexedVertices(scene, vertices);
+		cout << " >> " << vertices.vertex_count << " vertices of " << 3 * scene.info.tri_count
+		     << " corners (" << float(vertices.vertex_count) / scene.info.tri_count
+		     << " per triangle)" << endl;
+	}
 
 	// Init OpenGL
 	cout << "* Initializing OpenGL." << endl;
@@ -392,7 +632,8 @@ int main(int argc, char const* argv[]){
 
 	// Compile shader
 	cout << "* Compiling shaders." << endl;
-	GLuint program_id = loadShaders(VS_FILE, FS_FILE);
+	ShaderUniforms uniforms;
+	GLuint program_id = loadRenderShader(uniforms);
 	if(program_id == 0) return 1;
 
 	cout << "* Generating gl varients." << endl;
@@ -412,50 +653,185 @@ int main(int argc, char const* argv[]){
 	glGenBuffers(1, &vertex_buffer);
 	bindVertexAttribute(0, vertex_buffer, vertex_positions, GL_FLOAT, GL_STATIC_DRAW);
 
-	// ===== Uniforms =====
-	GLuint bbox_size_id = glGetUniformLocation(program_id, "bbox_size");
-	GLuint camera_org_id = glGetUniformLocation(program_id, "camera_org");
-	GLuint camera_dir_base_id = glGetUniformLocation(program_id, "camera_dir_base");
-	GLuint camera_xvec_id = glGetUniformLocation(program_id, "camera_xvec");
-	GLuint camera_yvec_id = glGetUniformLocation(program_id, "camera_yvec");
-	GLuint screen_size_id = glGetUniformLocation(program_id, "screen_size");
-	GLuint rand_vec2_a_id = glGetUniformLocation(program_id, "rand_vec2_a");
-	GLuint rand_vec2_b_id = glGetUniformLocation(program_id, "rand_vec2_b");
-	GLuint rand_vec3_id = glGetUniformLocation(program_id, "rand_vec3");
-	GLuint accum_frame_id = glGetUniformLocation(program_id, "accum_frame");
-
 	// ===== Textures =====
-	// General
-	TextureRect triangle_tex(1, 3*TRI_TEX_COL, triangle_buff.size()/3/TRI_TEX_COL+1, GL_RGB, GL_RGB, GL_FLOAT);//triangle
-	triangle_tex.setBuffer(&triangle_buff[0]);
-	TextureRect normal_tex(2, 3*TRI_TEX_COL, normal_buff.size()/3/TRI_TEX_COL+1, GL_RGB, GL_RGB, GL_FLOAT);//normal
-	normal_tex.setBuffer(&normal_buff[0]);
-	TextureRect texcoord_tex(3, 3*TRI_TEX_COL, texcoord_buf.size()/3/TRI_TEX_COL+1, GL_RG, GL_RG, GL_FLOAT);//texcoord
-	texcoord_tex.setBuffer(&texcoord_buf[0]);
-	TextureRect mat_idx_tex(4, 1*M_ID_TEX_COL, mat_idx_buff.size()/M_ID_TEX_COL + 1, GL_R32I, GL_RED_INTEGER, GL_INT);//material_idx
-	mat_idx_tex.setBuffer(&mat_idx_buff[0]);
-	TextureRect material_tex(5, 2*M_TEX_COL, material_buff.size()/2/M_TEX_COL + 1, GL_RGB, GL_RGB, GL_FLOAT);//material
-	material_tex.setBuffer(&material_buff[0]);
-	TextureRect accum_pixel_tex(6, WIDTH, HEIGHT, GL_RGB, GL_RGB, GL_FLOAT);//accum_pixel
+	// General (texels of corners, or of shared vertices with index triples)
+	int vertex_tex_width = indexed_vertices ? VERTEX_TEX_COL : 3*TRI_TEX_COL;
+	int vertex_tex_height = indexed_vertices ? getTexHeight(vertices.vertex_count, VERTEX_TEX_COL)
+	                                         : getTexHeight(scene.info.tri_count, TRI_TEX_COL);
+	TextureRect triangle_tex(1, vertex_tex_width, vertex_tex_height, GL_RGB, GL_RGB, GL_FLOAT);//triangle
+	triangle_tex.setBuffer(indexed_vertices ? &vertices.positions[0] : scene.triangles);
+	TextureRect normal_tex(2, vertex_tex_width, vertex_tex_height, GL_RGB, GL_RGB, GL_FLOAT);//normal
+	normal_tex.setBuffer(indexed_vertices ? &vertices.normals[0] : scene.normals);
+	TextureRect texcoord_tex(3, vertex_tex_width, vertex_tex_height, GL_RG, GL_RG, GL_FLOAT);//texcoord
+	texcoord_tex.setBuffer(indexed_vertices ? &vertices.texcoords[0] : scene.texcoords);
+	TextureRect mat_idx_tex(4, 1*M_ID_TEX_COL, getTexHeight(scene.info.tri_count, M_ID_TEX_COL), GL_R32I, GL_RED_INTEGER, GL_INT);//material_idx
+	mat_idx_tex.setBuffer(scene.mat_idxs);
+	TextureRect material_tex(5, 2*M_TEX_COL, getTexHeight(scene.info.material_count, M_TEX_COL), GL_RGB, GL_RGB, GL_FLOAT);//material
+	material_tex.setBuffer(scene.materials);
+	// (32 bit in headless mode as its framebuffer, alpha is for pixel variance)
+	GLenum accum_format = headless ? GL_RGBA32F : GL_RGB;
+	TextureRect accum_pixel_tex(6, WIDTH, HEIGHT, accum_format, headless ? GL_RGBA : GL_RGB, GL_FLOAT);//accum_pixel
 	// BVH
-	TextureRect bbox_minmax_tex(7, 2*BVH_TEX_COL, bbox_minmax_array.size()/2/BVH_TEX_COL+1, GL_RGB, GL_RGB, GL_FLOAT);//bbox_minmax
-	bbox_minmax_tex.setBuffer(&bbox_minmax_array[0]);
-	TextureRect bbox_info_tex(8, 3*BVH_TEX_COL, bbox_info_array.size()/3/BVH_TEX_COL+1, GL_R32I, GL_RED_INTEGER, GL_INT);//bbox triangle idx
-	bbox_info_tex.setBuffer(&bbox_info_array[0]);
+	TextureRect bbox_minmax_tex(7, 2*BVH_TEX_COL, getTexHeight(scene.info.bbox_count, BVH_TEX_COL), GL_RGB, GL_RGB, GL_FLOAT);//bbox_minmax
+	bbox_minmax_tex.setBuffer(scene.bbox_minmax);
+	TextureRect bbox_info_tex(8, 3*BVH_TEX_COL, getTexHeight(scene.info.bbox_count, BVH_TEX_COL), GL_R32I, GL_RED_INTEGER, GL_INT);//bbox triangle idx
+	bbox_info_tex.setBuffer(scene.bbox_info);
+	// Wide BVH (RGBA texels of 4 children, 32 bit for bounds of empty children,
+	//   a texel with binary BVH)
+	int wide_groups = std::max(bvh_width / 4, 1);
+	int wide_height = (bvh_width > 2) ? getTexHeight(wide_bvh.node_count, BVH_TEX_COL) : 1;
+	TextureRect wide_bounds_tex(9, (bvh_width > 2) ? 6*wide_groups*BVH_TEX_COL : 1, wide_height,
+	                            GL_RGBA32F, GL_RGBA, GL_FLOAT);//wide child bounds
+	TextureRect wide_links_tex(10, (bvh_width > 2) ? 2*wide_groups*BVH_TEX_COL : 1, wide_height,
+	                           GL_RGBA32I, GL_RGBA_INTEGER, GL_INT);//wide child links
+	if(bvh_width > 2){
+		wide_bounds_tex.setBuffer(&wide_bvh.bounds[0]);
+		wide_links_tex.setBuffer(&wide_bvh.links[0]);
+	}
+	// Triangle records (32 bit, Woop rows are not in [0, 1], a texel with vertices)
+	bool tri_record_used = (tri_record_type != TRI_RECORD_VERTICES);
+	TextureRect tri_record_tex(11, tri_record_used ? 3*TRI_TEX_COL : 1,
+	                           tri_record_used ? getTexHeight(scene.info.tri_count, TRI_TEX_COL) : 1,
+	                           GL_RGBA32F, GL_RGBA, GL_FLOAT);//triangle records
+	if(!tri_records.empty()) tri_record_tex.setBuffer(&tri_records[0]);
+	// Adaptive sampling mask (samples of pixel, -1 : not sampled, a texel without it)
+	TextureRect sample_mask_tex(12, (adaptive_ratio > 0) ? WIDTH : 1, (adaptive_ratio > 0) ? HEIGHT : 1,
+	                            GL_R32I, GL_RED_INTEGER, GL_INT);//sample mask
+	// Vertex index triples of triangles (a texel without indexed vertices)
+	TextureRect vertex_index_tex(13, indexed_vertices ? TRI_TEX_COL : 1,
+	                             indexed_vertices ? getTexHeight(scene.info.tri_count, TRI_TEX_COL) : 1,
+	                             GL_RGB32I, GL_RGB_INTEGER, GL_INT);//vertex indices
+	if(indexed_vertices) vertex_index_tex.setBuffer(&vertices.indices[0]);
 
 	// ===== Main loop =====
 	cout << "* Start rendering." << endl;
 	accum_frame = 0;
 	FpsCounter fps;
-	while(glfwWindowShouldClose(window) == GL_FALSE) {
+	int sequence_frame = sequence_first;
+	ObjBuffers frame_buffs;
+	chrono::steady_clock::time_point render_start = chrono::steady_clock::now();
+	int rendered_frames = 0;
+	ImageNoise noise = {0, 0, 0};
+	vector<vec3> headless_pixels;
+	vector<float> headless_moments;
+	vector<int> pixel_samples(WIDTH * HEIGHT, 0); // of headless mode
+	vector<char> sample_mask(WIDTH * HEIGHT, 1);
+	vector<int> mask_values(WIDTH * HEIGHT, 0);
+	int mask_start_frame = 0; // accum_frame of sample_mask
+	uint64_t headless_samples = 0;
+	while(headless ? continueHeadless(rendered_frames, getElapsedMsec(render_start), noise)
+	               : glfwWindowShouldClose(window) == GL_FALSE) {
+		// Deforming mesh
+		if(!sequence_pattern.empty()){
+			// Next frame (loop at missing one)
+			if(!loadSequenceFrame(++sequence_frame, scene.info, frame_buffs)){
+				sequence_frame = sequence_first;
+				loadSequenceFrame(sequence_frame, scene.info, frame_buffs);
+			}
+			if(frame_buffs.triangle_buff.size() != obj_buffs.triangle_buff.size()){
+				cerr << "Triangle count of frame " << sequence_frame << " differs, "
+				     << "sequence is stopped." << endl;
+				sequence_pattern.clear();
+			} else {
+				obj_buffs.triangle_buff.swap(frame_buffs.triangle_buff);
+				chrono::steady_clock::time_point refit_start = chrono::steady_clock::now();
+				bool refitted = bvh.refit(obj_buffs.triangle_buff);
+				if(refitted){
+					// Same topology, only positions and bboxes
+					orderSceneTriangles(bvh, bvh_layout, obj_buffs, scene_buffs);
+					triangle_tex.setBuffer(scene.triangles);
+					bbox_minmax_tex.setBuffer(scene.bbox_minmax);
+				} else {
+					// Rebuilt, sizes may change
+					orderScene(bvh, bvh_layout, obj_buffs, scene_buffs);
+					setSceneData(scene_buffs, scene);
+					int tri_height = getTexHeight(scene.info.tri_count, TRI_TEX_COL);
+					int bbox_height = getTexHeight(scene.info.bbox_count, BVH_TEX_COL);
+					triangle_tex.setResizedBuffer(3*TRI_TEX_COL, tri_height, scene.triangles);
+					normal_tex.setResizedBuffer(3*TRI_TEX_COL, tri_height, scene.normals);
+					texcoord_tex.setResizedBuffer(3*TRI_TEX_COL, tri_height, scene.texcoords);
+					mat_idx_tex.setResizedBuffer(1*M_ID_TEX_COL,
+					                             getTexHeight(scene.info.tri_count, M_ID_TEX_COL),
+					                             scene.mat_idxs);
+					bbox_minmax_tex.setResizedBuffer(2*BVH_TEX_COL, bbox_height, scene.bbox_minmax);
+					bbox_info_tex.setResizedBuffer(3*BVH_TEX_COL, bbox_height, scene.bbox_info);
+				}
+				bool reload_shader = false;
+				if(bvh_width > 2){
+					collapseBVH(scene, bvh_width, wide_bvh);
+					if(getWideStackSize(wide_bvh) > SHADER_WIDE_STACK_SIZE){
+						// Binary textures already hold this frame
+						cerr << "BVH" << bvh_width << " of frame " << sequence_frame
+						     << " is too deep for shader stack, binary BVH is used." << endl;
+						bvh_width = 2;
+						reload_shader = true;
+					} else {
+						int height = getTexHeight(wide_bvh.node_count, BVH_TEX_COL);
+						wide_bounds_tex.setResizedBuffer(6*wide_groups*BVH_TEX_COL, height,
+						                                 &wide_bvh.bounds[0]);
+						wide_links_tex.setResizedBuffer(2*wide_groups*BVH_TEX_COL, height,
+						                                &wide_bvh.links[0]);
+					}
+				}
+				// Binary tree is new to the shader after rebuild or wide fallback
+				if(bvh_stack_traversal && bvh_width == 2 && (!refitted || reload_shader) &&
+				   getBVHStackSize(scene) > SHADER_BVH_STACK_SIZE){
+					cerr << "BVH of frame " << sequence_frame << " is too deep for shader stack,"
+					     << " miss links are used." << endl;
+					bvh_stack_traversal = false;
+					reload_shader = true;
+				}
+				if(!tri_records.empty()){
+					makeTriRecords(scene, tri_record_type, tri_records);
+					tri_record_tex.setResizedBuffer(3*TRI_TEX_COL,
+					                                getTexHeight(scene.info.tri_count, TRI_TEX_COL),
+					                                &tri_records[0]);
+				}
+				if(reload_shader){
+					glDeleteProgram(program_id);
+					program_id = loadRenderShader(uniforms);
+					if(program_id == 0) return 1;
+					glUseProgram(program_id); // for uniforms of next draw
+				}
+				double refit_msec = getElapsedMsec(refit_start);
+				cout << " >> frame " << sequence_frame << (refitted ? " refitted" : " rebuilt")
+				     << " (" << refit_msec << " ms, SAH "
+				     << bvh.getSahCost() / bvh.getBuiltSahCost() << "x)" << endl;
+				accum_frame = 0;
+			}
+		}
+
 		// Accumulator
 		if(accum_frame == 0){
+			if(headless){
+				pixel_samples.assign(WIDTH * HEIGHT, 0);
+				sample_mask.assign(WIDTH * HEIGHT, 1);
+			}
+			if(adaptive_ratio > 0){
+				mask_values.assign(WIDTH * HEIGHT, 0);
+				sample_mask_tex.setBuffer(&mask_values[0]);
+				mask_start_frame = 0;
+			}
 		} else {
 			accum_pixel_tex.copyPixels(WIDTH, HEIGHT);
 		}
 
+		// Adaptive sampling (noisiest pixels for next frames)
+		if(adaptive_ratio > 0 && accum_frame >= ADAPTIVE_MIN_SAMPLES &&
+		   accum_frame - mask_start_frame >= ADAPTIVE_MASK_FRAMES){
+			readHeadlessImage(headless_gl, pixel_samples, headless_pixels, headless_moments);
+			int budget = (int)(adaptive_ratio * WIDTH * HEIGHT + 0.5f);
+			selectNoisyPixels(headless_pixels, headless_moments, pixel_samples, budget,
+			                  sample_mask);
+			for(size_t i = 0; i < mask_values.size(); i++){
+				mask_values[i] = sample_mask[i] ? pixel_samples[i] : -1;
+			}
+			sample_mask_tex.setBuffer(&mask_values[0]);
+			mask_start_frame = accum_frame;
+		}
+
 		// FPS
-		fps.update();
+		if(!headless) fps.update();
 
 		// Camera
 		vec3 dir_base, x_vec, y_vec;
@@ -465,16 +841,17 @@ int main(int argc, char const* argv[]){
 		// ===== Buffers =====
 		glEnableVertexAttribArray(0);
 		// ===== Uniforms =====
-		glUniform1i(bbox_size_id, bbox_minmax_array.size()/2);
-		glUniform3f(camera_org_id, camera_org.x, camera_org.y, camera_org.z);
-		glUniform3f(camera_dir_base_id, dir_base.x, dir_base.y, dir_base.z);
-		glUniform3f(camera_xvec_id, x_vec.x, x_vec.y, x_vec.z);
-		glUniform3f(camera_yvec_id, y_vec.x, y_vec.y, y_vec.z);
-		glUniform2f(screen_size_id, WIDTH, HEIGHT);
-		glUniform2f(rand_vec2_a_id, random()/float(RAND_MAX), random()/float(RAND_MAX));
-		glUniform2f(rand_vec2_b_id, random()/float(RAND_MAX), random()/float(RAND_MAX));
-		glUniform3f(rand_vec3_id, rand()/float(RAND_MAX), rand()/float(RAND_MAX), rand()/float(RAND_MAX));
-		glUniform1i(accum_frame_id, accum_frame);
+		glUniform1i(uniforms.bbox_size, scene.info.bbox_count);
+		glUniform3f(uniforms.camera_org, camera_org.x, camera_org.y, camera_org.z);
+		glUniform3f(uniforms.camera_dir_base, dir_base.x, dir_base.y, dir_base.z);
+		glUniform3f(uniforms.camera_xvec, x_vec.x, x_vec.y, x_vec.z);
+		glUniform3f(uniforms.camera_yvec, y_vec.x, y_vec.y, y_vec.z);
+		glUniform2f(uniforms.screen_size, WIDTH, HEIGHT);
+		glUniform2f(uniforms.rand_vec2_a, random()/float(RAND_MAX), random()/float(RAND_MAX));
+		glUniform2f(uniforms.rand_vec2_b, random()/float(RAND_MAX), random()/float(RAND_MAX));
+		glUniform3f(uniforms.rand_vec3, rand()/float(RAND_MAX), rand()/float(RAND_MAX), rand()/float(RAND_MAX));
+		glUniform1i(uniforms.accum_frame, accum_frame);
+		glUniform1i(uniforms.mask_frame, accum_frame - mask_start_frame);
 		// ===== Textures =====
 		// General
 		triangle_tex.active();
@@ -494,20 +871,60 @@ int main(int argc, char const* argv[]){
 		bbox_minmax_tex.bindUniform(program_id, "bbox_minmax_tex");
 		bbox_info_tex.active();
 		bbox_info_tex.bindUniform(program_id, "bbox_info_tex");
+		wide_bounds_tex.active();
+		wide_bounds_tex.bindUniform(program_id, "wide_bounds_tex");
+		wide_links_tex.active();
+		wide_links_tex.bindUniform(program_id, "wide_links_tex");
+		tri_record_tex.active();
+		tri_record_tex.bindUniform(program_id, "tri_record_tex");
+		sample_mask_tex.active();
+		sample_mask_tex.bindUniform(program_id, "sample_mask_tex");
+		vertex_index_tex.active();
+		vertex_index_tex.bindUniform(program_id, "vertex_index_tex");
 
 		accum_frame++;// next frame
+		rendered_frames++;
+		if(headless){
+			for(size_t i = 0; i < sample_mask.size(); i++){
+				if(!sample_mask[i]) continue;
+				pixel_samples[i]++;
+				headless_samples++;
+			}
+		}
 
 		// ====== Draw =====
-		// Clear screen
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		// Clear screen (skipped pixels of adaptive sampling are kept)
+		if(adaptive_ratio <= 0) glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 		// Use shader
 		glUseProgram(program_id);
 		// Draw
 		glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-		// Swap screen buffers
-		glfwSwapBuffers(window);
-		// Poll callbacks
-		glfwPollEvents();
+		if(headless && headless_target_error > 0 && accum_frame % NOISE_CHECK_FRAMES == 0){
+			noise = readHeadlessImage(headless_gl, pixel_samples, headless_pixels,
+			                          headless_moments);
+			cout << " >> frame " << accum_frame << ", relative error " << noise.relative_error
+			     << endl;
+		}
+		if(!headless){
+			// Swap screen buffers
+			glfwSwapBuffers(window);
+			// Poll callbacks
+			glfwPollEvents();
+		}
+	}
+
+	// ===== Headless image =====
+	if(headless){
+		noise = readHeadlessImage(headless_gl, pixel_samples, headless_pixels, headless_moments);
+		double render_msec = getElapsedMsec(render_start);
+		cout << " >> " << rendered_frames << " frames, " << render_msec << " ms ("
+		     << rendered_frames * 1e3 / render_msec << " fps, "
+		     << headless_samples / render_msec * 1e-3 << " Msamples/s)" << endl;
+		cout << " >> " << (double)headless_samples / (WIDTH * HEIGHT) << " spp, noise "
+		     << noise.std_error << " (relative error " << noise.relative_error
+		     << ")" << endl;
+		if(!writeImageFile(output_file, WIDTH, HEIGHT, headless_pixels)) return 1;
+		cout << "* Wrote " << output_file << "." << endl;
 	}
 
 	// ===== Termination Process =====
@@ -515,8 +932,9 @@ int main(int argc, char const* argv[]){
 	glDeleteProgram(program_id);
 	glDeleteVertexArrays(1, &vao);
 	glDeleteBuffers(1, &vertex_buffer);
-	// Close OpenGL window and terminate GLFW
-	glfwTerminate();
+	// Close OpenGL window and terminate GLFW (or EGL)
+	if(headless) headless_gl.terminate();
+	else glfwTerminate();
 
 	return 0;
 }
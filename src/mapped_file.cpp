@@ -0,0 +1,31 @@
+#include "mapped_file.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+bool MappedFile::open(const string& filename){
+	close();
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if(fd < 0) return false;
+	struct stat st;
+	if(fstat(fd, &st) != 0 || st.st_size == 0){
+		::close(fd);
+		return false;
+	}
+	void* mapped = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd); // mapping stays valid
+	if(mapped == MAP_FAILED) return false;
+	this->ptr = static_cast<const char*>(mapped);
+	this->length = st.st_size;
+	return true;
+}
+void MappedFile::close(){
+	if(ptr == NULL) return;
+	munmap(const_cast<char*>(ptr), length);
+	ptr = NULL;
+	length = 0;
+}
@@ -0,0 +1,24 @@
+#ifndef MAPPED_FILE_H_261017
+#define MAPPED_FILE_H_261017
+
+#include <cstddef>
+#include <string>
+
+/* Read only memory mapped file */
+class MappedFile {
+public:
+	MappedFile() : ptr(NULL), length(0) {}
+	~MappedFile() { close(); }
+	bool open(const std::string& filename);
+	void close();
+	bool isOpen() const { return ptr != NULL; }
+	const char* data() const { return ptr; }
+	size_t size() const { return length; }
+private:
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+	const char* ptr;
+	size_t length;
+};
+
+#endif
@@ -0,0 +1,54 @@
+#include "memory_usage.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <sys/resource.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+using namespace std;
+
+size_t getCurrentRss(){
+#ifdef __linux__
+	ifstream status("/proc/self/status");
+	string line;
+	while(getline(status, line)){
+		if(line.compare(0, 6, "VmRSS:") == 0){
+			return (size_t)atol(line.c_str() + 6) * 1024;
+		}
+	}
+#endif
+	return 0;
+}
+size_t getPeakRss(){
+#ifdef __linux__
+	// VmHWM follows resetPeakRss()
+	ifstream status("/proc/self/status");
+	string line;
+	while(getline(status, line)){
+		if(line.compare(0, 6, "VmHWM:") == 0){
+			return (size_t)atol(line.c_str() + 6) * 1024;
+		}
+	}
+#endif
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+	return usage.ru_maxrss; // bytes
+#else
+	return (size_t)usage.ru_maxrss * 1024; // kilobytes
+#endif
+}
+void resetPeakRss(){
+#ifdef __linux__
+	ofstream clear_refs("/proc/self/clear_refs");
+	clear_refs << "5";
+#endif
+}
+void releaseFreeMemory(){
+#ifdef __GLIBC__
+	malloc_trim(0);
+#endif
+}
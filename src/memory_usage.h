@@ -0,0 +1,16 @@
+#ifndef MEMORY_USAGE_H_261017
+#define MEMORY_USAGE_H_261017
+
+#include <cstddef>
+
+/* Current resident memory of this process [bytes] (0 if unknown) */
+size_t getCurrentRss();
+/* Peak resident memory of this process [bytes] */
+size_t getPeakRss();
+/* Reset peak resident memory to current one (Linux only) */
+void resetPeakRss();
+/* Return freed heap pages to the system (glibc only)
+ *   Temporaries of worker threads otherwise stay resident in their arenas. */
+void releaseFreeMemory();
+
+#endif
@@ -0,0 +1,406 @@
+#include "obj_loader.h"
+
+#include <iostream>
+#include <map>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+#include "mapped_file.h"
+#include "memory_usage.h"
+#include "thread_pool.h"
+#include "tinyobjloader/tiny_obj_loader.h"
+
+using namespace glm;
+using namespace std;
+
+/* Parallel obj parser
+ *   The memory mapped file is split into line aligned chunks, which are
+ *   parsed by tasks of the thread pool into their own arrays. Indices of a
+ *   chunk are absolute, except for negative (relative) ones which are known
+ *   only after the counts of preceding chunks. Faces are triangulated as
+ *   fans and materials follow usemtl across chunks, as tinyobj::LoadObj. */
+static const size_t OBJ_CHUNK_MIN_BYTES = 1 << 20;
+
+// Corner of triangle (0-based, -1 : none)
+struct ObjCorner {
+	int v, vt, vn;
+};
+enum { RELATIVE_V = 1, RELATIVE_VT = 2, RELATIVE_VN = 4 };
+struct ObjChunk {
+	const char *begin, *end;
+	vector<vec3> positions, normals;
+	vector<vec2> texcoords;
+	vector<ObjCorner> corners; // 3 per triangle
+	vector<pair<int, int> > relative_corners; // corner idx, RELATIVE_* flags
+	vector<pair<int, string> > usemtls; // first triangle idx, material name
+	vector<string> mtllibs;
+	int v_offset, vt_offset, vn_offset; // of preceding chunks
+};
+
+inline bool isObjSpace(char c){ return c == ' ' || c == '\t' || c == '\r'; }
+inline void skipSpaces(const char*& p, const char* end){
+	while(p < end && isObjSpace(*p)) p++;
+}
+inline bool isCommand(const char* p, const char* end, const char* command, size_t size){
+	return (size_t)(end - p) > size && memcmp(p, command, size) == 0 &&
+	       isObjSpace(p[size]);
+}
+// Word until space (as sscanf "%s")
+inline string parseWord(const char*& p, const char* end){
+	skipSpaces(p, end);
+	const char* start = p;
+	while(p < end && !isObjSpace(*p)) p++;
+	return string(start, p);
+}
+
+// Decimal float ([sign] digits [. digits] [e [sign] digits]), 0 if none
+inline float parseFloat(const char*& p, const char* end){
+	static const double POW10[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+	skipSpaces(p, end);
+	bool negative = (p < end && *p == '-');
+	if(p < end && (*p == '-' || *p == '+')) p++;
+	uint64_t mantissa = 0;
+	int exponent = 0, digit_count = 0;
+	for(; p < end && (unsigned)(*p - '0') < 10; p++, digit_count++){
+		if(mantissa < 1000000000000000000ull) mantissa = mantissa * 10 + (*p - '0');
+		else exponent++; // digits beyond precision
+	}
+	if(p < end && *p == '.'){
+		for(p++; p < end && (unsigned)(*p - '0') < 10; p++, digit_count++){
+			if(mantissa < 1000000000000000000ull){
+				mantissa = mantissa * 10 + (*p - '0');
+				exponent--;
+			}
+		}
+	}
+	if(digit_count > 0 && p < end && (*p == 'e' || *p == 'E')){
+		const char* q = p + 1;
+		bool exp_negative = (q < end && *q == '-');
+		if(q < end && (*q == '-' || *q == '+')) q++;
+		int exp_value = 0;
+		if(q < end && (unsigned)(*q - '0') < 10){
+			for(; q < end && (unsigned)(*q - '0') < 10; q++){
+				if(exp_value < 10000) exp_value = exp_value * 10 + (*q - '0');
+			}
+			exponent += exp_negative ? -exp_value : exp_value;
+			p = q;
+		}
+	}
+	while(p < end && !isObjSpace(*p)) p++; // rest of token
+	if(digit_count == 0) return 0.0f;
+	double value = (double)mantissa;
+	if(exponent < 0){
+		value = (exponent >= -22) ? value / POW10[-exponent] : value * pow(10.0, exponent);
+	} else if(exponent > 0){
+		value = (exponent <= 22) ? value * POW10[exponent] : value * pow(10.0, exponent);
+	}
+	return (float)(negative ? -value : value);
+}
+inline int parseInt(const char*& p, const char* end){
+	bool negative = (p < end && *p == '-');
+	if(p < end && (*p == '-' || *p == '+')) p++;
+	int value = 0;
+	for(; p < end && (unsigned)(*p - '0') < 10; p++) value = value * 10 + (*p - '0');
+	return negative ? -value : value;
+}
+// Index of v/vt/vn (count : parsed items of chunk, same as fixIndex of tinyobj)
+inline int parseIndex(const char*& p, const char* end, int count, int relative_flag,
+                      int& flags){
+	int idx = parseInt(p, end);
+	if(idx > 0) return idx - 1;
+	if(idx == 0) return 0;
+	flags |= relative_flag;
+	return count + idx; // chunk offset is added later
+}
+// Triples : v, v/vt, v//vn, v/vt/vn
+void parseFace(const char* p, const char* end, ObjChunk& chunk,
+               vector<pair<ObjCorner, int> >& face){
+	face.clear();
+	while(true){
+		skipSpaces(p, end);
+		if(p >= end) break;
+		ObjCorner corner = {-1, -1, -1};
+		int flags = 0;
+		corner.v = parseIndex(p, end, chunk.positions.size(), RELATIVE_V, flags);
+		if(p < end && *p == '/'){
+			p++;
+			if(p < end && *p != '/'){
+				corner.vt = parseIndex(p, end, chunk.texcoords.size(), RELATIVE_VT, flags);
+			}
+			if(p < end && *p == '/'){
+				p++;
+				corner.vn = parseIndex(p, end, chunk.normals.size(), RELATIVE_VN, flags);
+			}
+		}
+		while(p < end && !isObjSpace(*p)) p++;
+		face.push_back(make_pair(corner, flags));
+	}
+	// Polygon to triangle fan
+	for(size_t k = 2; k < face.size(); k++){
+		const pair<ObjCorner, int>* tri[3] = {&face[0], &face[k - 1], &face[k]};
+		for(int i = 0; i < 3; i++){
+			if(tri[i]->second){
+				chunk.relative_corners.push_back(make_pair((int)chunk.corners.size(),
+				                                           tri[i]->second));
+			}
+			chunk.corners.push_back(tri[i]->first);
+		}
+	}
+}
+void parseChunk(ObjChunk& chunk){
+	vector<pair<ObjCorner, int> > face;
+	for(const char* line = chunk.begin; line < chunk.end; ){
+		const char* end = static_cast<const char*>(memchr(line, '\n', chunk.end - line));
+		if(end == NULL) end = chunk.end;
+		const char* p = line;
+		line = end + 1;
+		skipSpaces(p, end);
+		if(end - p < 2) continue;
+		if(p[0] == 'v' && isObjSpace(p[1])){
+			p += 2;
+			float x = parseFloat(p, end), y = parseFloat(p, end), z = parseFloat(p, end);
+			chunk.positions.push_back(vec3(x, y, z));
+		} else if(p[0] == 'v' && p[1] == 'n' && isCommand(p, end, "vn", 2)){
+			p += 3;
+			float x = parseFloat(p, end), y = parseFloat(p, end), z = parseFloat(p, end);
+			chunk.normals.push_back(vec3(x, y, z));
+		} else if(p[0] == 'v' && p[1] == 't' && isCommand(p, end, "vt", 2)){
+			p += 3;
+			float x = parseFloat(p, end), y = parseFloat(p, end);
+			chunk.texcoords.push_back(vec2(x, y));
+		} else if(p[0] == 'f' && isObjSpace(p[1])){
+			parseFace(p + 2, end, chunk, face);
+		} else if(isCommand(p, end, "usemtl", 6)){
+			p += 7;
+			chunk.usemtls.push_back(make_pair((int)chunk.corners.size() / 3,
+			                                  parseWord(p, end)));
+		} else if(isCommand(p, end, "mtllib", 6)){
+			p += 7;
+			chunk.mtllibs.push_back(parseWord(p, end));
+		}
+		// Others (comments, groups, ...) are ignored
+	}
+}
+
+// Triangles reserved for padding to rows (one extra row as getTexHeight() of scene)
+static size_t getReserveTriCount(size_t tri_count, int reserve_cols){
+	return (tri_count / reserve_cols + 1) * reserve_cols;
+}
+
+bool loadObjFile(const string& filename, vector<vec3>& triangle_buff,
+                 vector<int>& mat_idx_buff, vector<vec3>& material_buff,
+                 ObjAttributes& attributes, int thread_count, int reserve_cols){
+	cout << " obj: " << filename << endl;
+
+	string basepath = ".";
+	size_t slash_idx = filename.find_last_of('/');
+	if(slash_idx != string::npos) {
+		basepath = filename.substr(0, slash_idx + 1);
+	}
+	cout << "material search path: " <<  basepath << endl;
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	MappedFile file;
+	if(!file.open(filename)){
+		cerr << "Failed to open obj file (" << filename << ")." << endl;
+		return false;
+	}
+	ThreadPool pool(thread_count);
+
+	// Line aligned chunks
+	const char* data = file.data();
+	size_t size = file.size();
+	size_t chunk_count = std::min(size / OBJ_CHUNK_MIN_BYTES + 1,
+	                              (size_t)pool.getThreadCount() * 4);
+	vector<ObjChunk> chunks(chunk_count);
+	const char* chunk_begin = data;
+	for(size_t i = 0; i < chunk_count; i++){
+		const char* chunk_end = data + size * (i + 1) / chunk_count;
+		if(chunk_end < chunk_begin) chunk_end = chunk_begin;
+		if(i + 1 < chunk_count){
+			const char* newline = static_cast<const char*>(
+			    memchr(chunk_end, '\n', data + size - chunk_end));
+			chunk_end = newline ? newline + 1 : data + size;
+		}
+		chunks[i].begin = chunk_begin;
+		chunks[i].end = chunk_end;
+		chunk_begin = chunk_end;
+	}
+	parallelFor(pool, 0, chunk_count, 1, [&](int begin, int end){
+		for(int i = begin; i < end; i++) parseChunk(chunks[i]);
+	});
+
+	// Offsets of chunks and materials (in file order)
+	int v_count = 0, vt_count = 0, vn_count = 0, tri_count = 0;
+	vector<tinyobj::material_t> materials;
+	map<string, int> material_map;
+	tinyobj::MaterialFileReader material_reader(basepath);
+	for(size_t i = 0; i < chunk_count; i++){
+		ObjChunk& chunk = chunks[i];
+		chunk.v_offset = v_count;
+		chunk.vt_offset = vt_count;
+		chunk.vn_offset = vn_count;
+		v_count += chunk.positions.size();
+		vt_count += chunk.texcoords.size();
+		vn_count += chunk.normals.size();
+		tri_count += chunk.corners.size() / 3;
+		for(size_t j = 0; j < chunk.mtllibs.size(); j++){
+			string err;
+			if(!material_reader(chunk.mtllibs[j], materials, material_map, err)){
+				cerr << err << endl;
+				return false;
+			}
+		}
+	}
+	// Material of first triangle of each chunk (-1 before usemtl)
+	vector<int> chunk_materials(chunk_count, -1);
+	for(size_t i = 0; i + 1 < chunk_count; i++){
+		chunk_materials[i + 1] = chunk_materials[i];
+		if(chunks[i].usemtls.empty()) continue;
+		map<string, int>::const_iterator it = material_map.find(chunks[i].usemtls.back().second);
+		chunk_materials[i + 1] = (it != material_map.end()) ? it->second : -1;
+	}
+
+	// Chunks keep copies of names, so pages of the file are released here
+	file.close();
+
+	// Merge attributes
+	vector<vec3> positions(v_count), normals(vn_count);
+	vector<vec2> texcoords(vt_count);
+	parallelFor(pool, 0, chunk_count, 1, [&](int begin, int end){
+		for(int i = begin; i < end; i++){
+			ObjChunk& chunk = chunks[i];
+			std::copy(chunk.positions.begin(), chunk.positions.end(),
+			          positions.begin() + chunk.v_offset);
+			std::copy(chunk.normals.begin(), chunk.normals.end(),
+			          normals.begin() + chunk.vn_offset);
+			std::copy(chunk.texcoords.begin(), chunk.texcoords.end(),
+			          texcoords.begin() + chunk.vt_offset);
+			vector<vec3>().swap(chunk.positions);
+			vector<vec3>().swap(chunk.normals);
+			vector<vec2>().swap(chunk.texcoords);
+			for(size_t j = 0; j < chunk.relative_corners.size(); j++){
+				ObjCorner& corner = chunk.corners[chunk.relative_corners[j].first];
+				int flags = chunk.relative_corners[j].second;
+				if(flags & RELATIVE_V) corner.v += chunk.v_offset;
+				if(flags & RELATIVE_VT) corner.vt += chunk.vt_offset;
+				if(flags & RELATIVE_VN) corner.vn += chunk.vn_offset;
+			}
+			vector<pair<int, int> >().swap(chunk.relative_corners);
+		}
+	});
+	releaseFreeMemory(); // grown arrays of parsing threads
+
+	// Expand corners chunk by chunk in file order, releasing each chunk
+	//   (buffers are appended, not zero filled, so only one chunk of corners
+	//    is alive beside them)
+	size_t reserve_tri_count = getReserveTriCount(tri_count, reserve_cols);
+	triangle_buff.clear();
+	mat_idx_buff.clear();
+	attributes.normal_idxs.clear();
+	attributes.texcoord_idxs.clear();
+	triangle_buff.reserve(3 * reserve_tri_count);
+	mat_idx_buff.reserve(reserve_tri_count);
+	attributes.normal_idxs.reserve(3 * tri_count);
+	attributes.texcoord_idxs.reserve(3 * tri_count);
+	bool valid = true;
+	for(size_t i = 0; i < chunk_count; i++){
+		ObjChunk& chunk = chunks[i];
+		int mat_idx = chunk_materials[i];
+		size_t usemtl_idx = 0;
+		int chunk_tri_count = chunk.corners.size() / 3;
+		for(int tri_idx = 0; tri_idx < chunk_tri_count; tri_idx++){
+			for(; usemtl_idx < chunk.usemtls.size() &&
+			      chunk.usemtls[usemtl_idx].first <= tri_idx; usemtl_idx++){
+				map<string, int>::const_iterator it =
+				    material_map.find(chunk.usemtls[usemtl_idx].second);
+				mat_idx = (it != material_map.end()) ? it->second : -1;
+			}
+			mat_idx_buff.push_back(mat_idx);
+			for(int k = 0; k < 3; k++){
+				const ObjCorner& corner = chunk.corners[3 * tri_idx + k];
+				if(corner.v < 0 || corner.v >= v_count){
+					valid = false;
+					triangle_buff.push_back(vec3(0.f));
+				} else {
+					triangle_buff.push_back(positions[corner.v]);
+				}
+				attributes.normal_idxs.push_back(corner.vn);
+				attributes.texcoord_idxs.push_back(corner.vt);
+			}
+		}
+		vector<ObjCorner>().swap(chunk.corners);
+	}
+	vector<vec3>().swap(positions);
+	attributes.normals.swap(normals);
+	attributes.texcoords.swap(texcoords);
+	releaseFreeMemory();
+	if(!valid){
+		cerr << "Invalid vertex index in obj file (" << filename << ")." << endl;
+		return false;
+	}
+
+	material_buff.clear();
+	for(int mat_idx = 0; mat_idx < materials.size(); mat_idx++){
+		vec3 kd, ks;
+		kd.x = materials[mat_idx].diffuse[0];
+		kd.y = materials[mat_idx].diffuse[1];
+		kd.z = materials[mat_idx].diffuse[2];
+		ks.x = materials[mat_idx].specular[0];
+		ks.y = materials[mat_idx].specular[1];
+		ks.z = materials[mat_idx].specular[2];
+		// Add to material_buff
+		material_buff.push_back(kd);
+		material_buff.push_back(ks);
+	}
+
+	chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+	cout << " >> parsed " << size / 1048576.0 << " MB in " << elapsed.count() * 1000
+	     << " ms (" << size / 1048576.0 / elapsed.count() << " MB/s, "
+	     << pool.getThreadCount() << " threads)" << endl;
+	return true;
+}
+void expandObjAttributes(ObjAttributes& attributes, vector<vec3>& normal_buff,
+                         vector<vec2>& texcoord_buf, int reserve_cols){
+	// One attribute at a time, releasing its indices
+	//   (missing normal and texcoord are zero)
+	size_t corner_count = attributes.normal_idxs.size();
+	size_t reserve_count = 3 * getReserveTriCount(corner_count / 3, reserve_cols);
+	int normal_count = attributes.normals.size();
+	normal_buff.clear();
+	normal_buff.reserve(reserve_count);
+	for(size_t i = 0; i < corner_count; i++){
+		int idx = attributes.normal_idxs[i];
+		vec3 n = (idx >= 0 && idx < normal_count) ? attributes.normals[idx] : vec3(0.f);
+		normal_buff.push_back((n + 1.f) / 2.f);
+	}
+	vector<int>().swap(attributes.normal_idxs);
+	vector<vec3>().swap(attributes.normals);
+	releaseFreeMemory();
+
+	int texcoord_count = attributes.texcoords.size();
+	texcoord_buf.clear();
+	texcoord_buf.reserve(reserve_count);
+	for(size_t i = 0; i < corner_count; i++){
+		int idx = attributes.texcoord_idxs[i];
+		texcoord_buf.push_back((idx >= 0 && idx < texcoord_count) ?
+		                       attributes.texcoords[idx] : vec2(0.f));
+	}
+	vector<int>().swap(attributes.texcoord_idxs);
+	vector<vec2>().swap(attributes.texcoords);
+	releaseFreeMemory();
+}
+bool loadObjFile(const string& filename, vector<vec3>& triangle_buff,
+                 vector<vec3>& normal_buff, vector<vec2>& texcoord_buf,
+                 vector<int>& mat_idx_buff, vector<vec3>& material_buff, int thread_count,
+                 int reserve_cols){
+	ObjAttributes attributes;
+	if(!loadObjFile(filename, triangle_buff, mat_idx_buff, material_buff, attributes,
+	                thread_count, reserve_cols)) return false;
+	expandObjAttributes(attributes, normal_buff, texcoord_buf, reserve_cols);
+	return true;
+}
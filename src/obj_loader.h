@@ -0,0 +1,35 @@
+#ifndef OBJ_LOADER_H_261017
+#define OBJ_LOADER_H_261017
+
+#include <string>
+#include <vector>
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+/* Normals and texcoords of obj file, indexed by triangle corner (-1 : none) */
+struct ObjAttributes {
+	std::vector<glm::vec3> normals;
+	std::vector<glm::vec2> texcoords;
+	std::vector<int> normal_idxs, texcoord_idxs; // |i0,i1,i2| * tri_idx
+};
+
+/* Load obj file into per triangle buffers
+ *   The file is memory mapped and parsed in line aligned chunks by
+ *   `thread_count` threads (0 : hardware concurrency). Only materials (.mtl)
+ *   are read by tinyobjloader. Buffers are reserved for padding to rows of
+ *   `reserve_cols` triangles, so that later padding does not reallocate. */
+bool loadObjFile(const std::string& filename, std::vector<glm::vec3>& triangle_buff,
+                 std::vector<glm::vec3>& normal_buff, std::vector<glm::vec2>& texcoord_buf,
+                 std::vector<int>& mat_idx_buff, std::vector<glm::vec3>& material_buff,
+                 int thread_count = 0, int reserve_cols = 1);
+/* Load obj file leaving normals and texcoords indexed
+ *   Indices take less memory than per corner buffers, which are expanded
+ *   later by expandObjAttributes() (e.g. after BVH build). */
+bool loadObjFile(const std::string& filename, std::vector<glm::vec3>& triangle_buff,
+                 std::vector<int>& mat_idx_buff, std::vector<glm::vec3>& material_buff,
+                 ObjAttributes& attributes, int thread_count = 0, int reserve_cols = 1);
+/* Expand normals and texcoords to per triangle buffers (attributes are empty after) */
+void expandObjAttributes(ObjAttributes& attributes, std::vector<glm::vec3>& normal_buff,
+                         std::vector<glm::vec2>& texcoord_buf, int reserve_cols = 1);
+
+#endif
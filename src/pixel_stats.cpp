@@ -0,0 +1,64 @@
+#include "pixel_stats.h"
+
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+#include <functional>
+
+using namespace glm;
+using namespace std;
+
+float getMeanVariance(const vec3& mean, float moment, int sample_count){
+	if(sample_count < 2) return 0.0f;
+	float luminance = getLuminance(mean);
+	// Unbiased sample variance (rounding may make it negative)
+	float variance = std::max(moment - luminance * luminance, 0.0f) * sample_count /
+	                 (sample_count - 1);
+	return variance / sample_count;
+}
+
+ImageNoise estimateImageNoise(const vector<vec3>& means, const vector<float>& moments,
+                              int sample_count){
+	return estimateImageNoise(means, moments, vector<int>(means.size(), sample_count));
+}
+ImageNoise estimateImageNoise(const vector<vec3>& means, const vector<float>& moments,
+                              const vector<int>& sample_counts){
+	ImageNoise noise = {0.0, 0.0, 0.0};
+	if(means.empty()) return noise;
+	double variance_sum = 0.0, luminance_sum = 0.0;
+	for(size_t i = 0; i < means.size(); i++){
+		variance_sum += getMeanVariance(means[i], moments[i], sample_counts[i]);
+		luminance_sum += getLuminance(means[i]);
+	}
+	noise.std_error = sqrt(variance_sum / means.size());
+	noise.mean_luminance = luminance_sum / means.size();
+	noise.relative_error = (noise.mean_luminance > 0.0) ?
+	                       noise.std_error / noise.mean_luminance : 0.0;
+	return noise;
+}
+
+void selectNoisyPixels(const vector<vec3>& means, const vector<float>& moments,
+                       const vector<int>& sample_counts, int budget, vector<char>& mask){
+	// Sample variances and their floor
+	vector<float> variances(means.size());
+	double variance_sum = 0.0;
+	for(size_t i = 0; i < means.size(); i++){
+		variances[i] = getMeanVariance(means[i], moments[i], sample_counts[i]) * sample_counts[i];
+		variance_sum += variances[i];
+	}
+	float variance_floor = means.empty() ? 0.0f :
+	                       ADAPTIVE_VARIANCE_FLOOR * variance_sum / means.size();
+	// Drop of mean variance by one more sample : var / n - var / (n + 1)
+	vector<pair<float, int> > priorities(means.size());
+	for(size_t i = 0; i < means.size(); i++){
+		int count = sample_counts[i];
+		float priority = (count < 2) ? FLT_MAX :
+		                 std::max(variances[i], variance_floor) / count / (count + 1);
+		priorities[i] = make_pair(priority, (int)i);
+	}
+	budget = std::max(std::min(budget, (int)means.size()), 0);
+	nth_element(priorities.begin(), priorities.begin() + budget, priorities.end(),
+	            greater<pair<float, int> >());
+	mask.assign(means.size(), 0);
+	for(int i = 0; i < budget; i++) mask[priorities[i].second] = 1;
+}
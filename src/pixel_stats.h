@@ -0,0 +1,44 @@
+#ifndef PIXEL_STATS_H_261017
+#define PIXEL_STATS_H_261017
+
+#include <vector>
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+/* Convergence of accumulated pixels
+ *   Next to the mean color of its samples, each pixel keeps the mean of their
+ *   squared luminance (alpha of accumulation texture in the shader). The
+ *   variance of a pixel mean is estimated from both.
+ *   Adaptive sampling gives the samples of a frame to the pixels whose mean
+ *   variance drops most by one more sample, after ADAPTIVE_MIN_SAMPLES
+ *   samples of every pixel. Sample variance of a pixel is taken as at least
+ *   ADAPTIVE_VARIANCE_FLOOR of the image mean, so a pixel whose first samples
+ *   happened to be the same (e.g. a nearly blocked light) is not starved. */
+const glm::vec3 PIXEL_LUMINANCE(0.2126f, 0.7152f, 0.0722f);
+const int ADAPTIVE_MIN_SAMPLES = 8;
+const float ADAPTIVE_VARIANCE_FLOOR = 0.05f;
+
+inline float getLuminance(const glm::vec3& color){ return glm::dot(color, PIXEL_LUMINANCE); }
+
+// Variance of mean luminance after sample_count samples (0 with less than 2)
+float getMeanVariance(const glm::vec3& mean, float moment, int sample_count);
+
+struct ImageNoise {
+	double std_error;      // RMS standard error of pixel means (luminance)
+	double mean_luminance; // of image
+	double relative_error; // std_error / mean_luminance
+};
+// Noise of image whose pixels have sample_count samples each
+ImageNoise estimateImageNoise(const std::vector<glm::vec3>& means,
+                              const std::vector<float>& moments, int sample_count);
+// Noise of image with samples of each pixel
+ImageNoise estimateImageNoise(const std::vector<glm::vec3>& means,
+                              const std::vector<float>& moments,
+                              const std::vector<int>& sample_counts);
+
+// Mask of budget pixels to sample next (noisiest first, 1 : sampled)
+void selectNoisyPixels(const std::vector<glm::vec3>& means, const std::vector<float>& moments,
+                       const std::vector<int>& sample_counts, int budget,
+                       std::vector<char>& mask);
+
+#endif
@@ -0,0 +1,378 @@
+#include "bvh_build.h"
+
+using namespace glm;
+using namespace std;
+
+/* Spatial split BVH (SBVH)
+ *   Object splits are compared with spatial splits which clip triangle
+ *   references at bin boundaries. Duplicated references are limited by
+ *   split budget, which is shared by children in proportion to their sizes. */
+
+struct SpatialContext {
+	const vector<vec3>* tri_vertices;
+	BVHNodes* nodes;
+	int* leaf_refs; // triangle idx referred by leaves
+	atomic<int> leaf_ref_count;
+	int bin_count, max_depth;
+	float min_overlap; // overlap surface to try spatial splits
+	ThreadPool* pool;
+};
+
+// Reference bounds
+inline void initRefBounds(BuildRef& ref){
+	ref.min_point = vec3( INFINITY,  INFINITY,  INFINITY);
+	ref.max_point = vec3(-INFINITY, -INFINITY, -INFINITY);
+}
+inline void growRefBounds(BuildRef& ref, const vec3& point){
+	ref.min_point = min(ref.min_point, point);
+	ref.max_point = max(ref.max_point, point);
+}
+inline bool isEmptyRef(const BuildRef& ref){
+	return ref.min_point.x > ref.max_point.x || ref.min_point.y > ref.max_point.y ||
+	       ref.min_point.z > ref.max_point.z;
+}
+// Clip reference by plane (axis, pos)
+void splitRef(const SpatialContext& ctx, const BuildRef& ref, int axis, float pos,
+              BuildRef& left, BuildRef& right){
+	initRefBounds(left);
+	initRefBounds(right);
+	left.tri_idx = right.tri_idx = ref.tri_idx;
+	const vec3* v = &(*ctx.tri_vertices)[3 * ref.tri_idx];
+	for(int i = 0; i < 3; i++){
+		const vec3& v0 = v[i];
+		const vec3& v1 = v[(i + 1) % 3];
+		float p0 = v0[axis], p1 = v1[axis];
+		if(p0 <= pos) growRefBounds(left, v0);
+		if(p0 >= pos) growRefBounds(right, v0);
+		// Edge crosses the plane
+		if((p0 < pos && pos < p1) || (p1 < pos && pos < p0)){
+			float t = (pos - p0) / (p1 - p0);
+			vec3 cross_point = v0 + (v1 - v0) * t;
+			cross_point[axis] = pos;
+			growRefBounds(left, cross_point);
+			growRefBounds(right, cross_point);
+		}
+	}
+	// Clip by current bounds
+	left.max_point[axis] = pos;
+	right.min_point[axis] = pos;
+	left.min_point = max(left.min_point, ref.min_point);
+	left.max_point = min(left.max_point, ref.max_point);
+	right.min_point = max(right.min_point, ref.min_point);
+	right.max_point = min(right.max_point, ref.max_point);
+}
+
+/* Spatial split search */
+struct SpatialBin {
+	void init(){
+		initRefBounds(bounds);
+		enter_count = exit_count = 0;
+	}
+	void grow(const BuildRef& ref){
+		bounds.min_point = min(bounds.min_point, ref.min_point);
+		bounds.max_point = max(bounds.max_point, ref.max_point);
+	}
+	void grow(const SpatialBin& bin){
+		grow(bin.bounds);
+		enter_count += bin.enter_count;
+		exit_count += bin.exit_count;
+	}
+	BuildRef bounds;
+	int enter_count, exit_count;
+};
+struct SpatialBinSet {
+	void init(int bin_count){
+		for(int axis = 0; axis < 3; axis++){
+			for(int b = 0; b < bin_count; b++) bins[axis][b].init();
+		}
+	}
+	SpatialBin bins[3][MAX_BIN_COUNT];
+};
+struct SpatialSplit {
+	int axis;
+	float pos, cost;
+	BuildRef left, right; // bounds of children
+	int left_count, right_count;
+};
+// Put clipped references into bins placed in node bounds
+void putRefsIntoSpatialBins(const SpatialContext& ctx, const BuildRef* refs, int ref_count,
+                            const RefBounds& bounds, SpatialBinSet& bin_set){
+	int bin_count = ctx.bin_count;
+	for(int axis = 0; axis < 3; axis++){
+		float extent = bounds.max_point[axis] - bounds.min_point[axis];
+		if(extent <= 0) continue;
+		float bin_width = extent / bin_count;
+		SpatialBin* bins = bin_set.bins[axis];
+		for(int i = 0; i < ref_count; i++){
+			int first = int((refs[i].min_point[axis] - bounds.min_point[axis]) / bin_width);
+			int last = int((refs[i].max_point[axis] - bounds.min_point[axis]) / bin_width);
+			first = std::min(std::max(first, 0), bin_count - 1);
+			last = std::min(std::max(last, first), bin_count - 1);
+			// Clip at each bin boundary
+			BuildRef rest = refs[i];
+			for(int b = first; b < last; b++){
+				BuildRef left, right;
+				splitRef(ctx, rest, axis, bounds.min_point[axis] + bin_width * (b + 1), left, right);
+				if(!isEmptyRef(left)) bins[b].grow(left);
+				rest = right;
+			}
+			if(!isEmptyRef(rest)) bins[last].grow(rest);
+			bins[first].enter_count++;
+			bins[last].exit_count++;
+		}
+	}
+}
+SpatialSplit findSpatialSplit(const SpatialContext& ctx, const BuildRef* refs, int ref_count,
+                              const RefBounds& bounds, float total_surface){
+	int bin_count = ctx.bin_count;
+	// Binning (large nodes in parallel chunks)
+	SpatialBinSet bin_set;
+	bin_set.init(bin_count);
+	int chunk_count = getChunkCount(ref_count);
+	if(chunk_count == 1){
+		putRefsIntoSpatialBins(ctx, refs, ref_count, bounds, bin_set);
+	} else {
+		vector<SpatialBinSet> chunk_bin_sets(chunk_count);
+		parallelFor(*ctx.pool, 0, chunk_count, 1, [&](int begin, int end){
+			for(int c = begin; c < end; c++){
+				int ref_begin = getChunkBegin(ref_count, chunk_count, c);
+				int ref_end = getChunkBegin(ref_count, chunk_count, c + 1);
+				chunk_bin_sets[c].init(bin_count);
+				putRefsIntoSpatialBins(ctx, refs + ref_begin, ref_end - ref_begin,
+				                       bounds, chunk_bin_sets[c]);
+			}
+		});
+		for(int c = 0; c < chunk_count; c++){
+			for(int axis = 0; axis < 3; axis++){
+				for(int b = 0; b < bin_count; b++){
+					bin_set.bins[axis][b].grow(chunk_bin_sets[c].bins[axis][b]);
+				}
+			}
+		}
+	}
+
+	// Sweep bins
+	SpatialSplit best;
+	best.axis = -1;
+	best.cost = INFINITY;
+	SpatialBin right_bins[MAX_BIN_COUNT];
+	for(int axis = 0; axis < 3; axis++){
+		float extent = bounds.max_point[axis] - bounds.min_point[axis];
+		if(extent <= 0) continue;
+		const SpatialBin* bins = bin_set.bins[axis];
+		// Sweep from right (right_bins[b] : union of bins[b, bin_count))
+		right_bins[bin_count - 1] = bins[bin_count - 1];
+		for(int b = bin_count - 2; b > 0; b--){
+			right_bins[b] = right_bins[b + 1];
+			right_bins[b].grow(bins[b]);
+		}
+		// Sweep from left (devide between b and b+1)
+		SpatialBin left_bin;
+		left_bin.init();
+		for(int b = 0; b < bin_count - 1; b++){
+			left_bin.grow(bins[b]);
+			const SpatialBin& right_bin = right_bins[b + 1];
+			int left_count = left_bin.enter_count, right_count = right_bin.exit_count;
+			if(left_count == 0 || right_count == 0) continue;
+			// Calc SAH
+			float cost = 2 * AABB_TIME +
+				(surface(left_bin.bounds.min_point, left_bin.bounds.max_point) * left_count +
+				 surface(right_bin.bounds.min_point, right_bin.bounds.max_point) * right_count) *
+				TRI_TIME / total_surface;
+			// Update
+			if(cost < best.cost){
+				best.cost = cost;
+				best.axis = axis;
+				best.pos = bounds.min_point[axis] + extent * (b + 1) / bin_count;
+				best.left = left_bin.bounds;
+				best.right = right_bin.bounds;
+				best.left_count = left_count;
+				best.right_count = right_count;
+			}
+		}
+	}
+	return best;
+}
+// Devide references by spatial split returning duplicated count
+int splitRefsSpatially(const SpatialContext& ctx, const vector<BuildRef>& refs,
+                       const SpatialSplit& split, int budget,
+                       vector<BuildRef>& left_refs, vector<BuildRef>& right_refs){
+	int axis = split.axis;
+	BuildRef left_bounds = split.left, right_bounds = split.right;
+	int left_count = split.left_count, right_count = split.right_count;
+	int dup_count = 0;
+	for(int i = 0; i < refs.size(); i++){
+		const BuildRef& ref = refs[i];
+		if(ref.max_point[axis] <= split.pos){
+			left_refs.push_back(ref);
+			continue;
+		}
+		if(ref.min_point[axis] >= split.pos){
+			right_refs.push_back(ref);
+			continue;
+		}
+		// Straddling reference
+		BuildRef left, right;
+		splitRef(ctx, ref, axis, split.pos, left, right);
+		if(isEmptyRef(left)){
+			right_refs.push_back(ref);
+			continue;
+		}
+		if(isEmptyRef(right)){
+			left_refs.push_back(ref);
+			continue;
+		}
+		// Unsplit when one side is cheaper than duplication
+		BuildRef left_unsplit = left_bounds, right_unsplit = right_bounds;
+		growRefBounds(left_unsplit, ref.min_point);
+		growRefBounds(left_unsplit, ref.max_point);
+		growRefBounds(right_unsplit, ref.min_point);
+		growRefBounds(right_unsplit, ref.max_point);
+		float left_surface = surface(left_bounds.min_point, left_bounds.max_point);
+		float right_surface = surface(right_bounds.min_point, right_bounds.max_point);
+		float split_cost = left_surface * left_count + right_surface * right_count;
+		float left_cost = surface(left_unsplit.min_point, left_unsplit.max_point) * left_count +
+		                  right_surface * (right_count - 1);
+		float right_cost = left_surface * (left_count - 1) +
+		                   surface(right_unsplit.min_point, right_unsplit.max_point) * right_count;
+		if(dup_count < budget && split_cost < left_cost && split_cost < right_cost){
+			left_refs.push_back(left);
+			right_refs.push_back(right);
+			dup_count++;
+		} else if(left_cost <= right_cost){
+			left_refs.push_back(ref);
+			left_bounds = left_unsplit;
+			right_count--;
+		} else {
+			right_refs.push_back(ref);
+			right_bounds = right_unsplit;
+			left_count--;
+		}
+	}
+	return dup_count;
+}
+
+/* Build */
+void buildSpatialNode(SpatialContext& ctx, int node_idx, vector<BuildRef>& refs,
+                      int depth, int budget){
+	BVHNodes& nodes = *ctx.nodes;
+	int ref_count = refs.size();
+
+	//Bounding Box Coordinates
+	RefBounds bounds;
+	calcRefBounds(&refs[0], ref_count, bounds, *ctx.pool);
+	nodes.min_points[node_idx] = bounds.min_point;
+	nodes.max_points[node_idx] = bounds.max_point;
+	float total_surface = surface(bounds.min_point, bounds.max_point);
+	float leaf_cost = TRI_TIME * ref_count;
+
+	vector<BuildRef> left_refs, right_refs;
+	if(ctx.max_depth <= 0 || depth < ctx.max_depth){
+		//Object split
+		SahBinning binning(bounds.center_min, bounds.center_max, ctx.bin_count);
+		SahBinSet bin_set;
+		putRefsIntoBins(&refs[0], ref_count, binning, bin_set, *ctx.pool);
+		SahSplit object_split = findBinnedSplit(bin_set, binning, total_surface, leaf_cost);
+		//Spatial split (only when children of object split overlap)
+		SpatialSplit spatial_split;
+		spatial_split.axis = -1;
+		spatial_split.cost = INFINITY;
+		if(budget > 0 && total_surface > 0){
+			float overlap_surface = total_surface;
+			if(object_split.axis >= 0){
+				vec3 overlap_min = max(object_split.left.min_point, object_split.right.min_point);
+				vec3 overlap_max = min(object_split.left.max_point, object_split.right.max_point);
+				overlap_surface = (overlap_min.x < overlap_max.x && overlap_min.y < overlap_max.y &&
+				                   overlap_min.z < overlap_max.z) ?
+				                  surface(overlap_min, overlap_max) : 0;
+			}
+			if(overlap_surface > ctx.min_overlap){
+				spatial_split = findSpatialSplit(ctx, &refs[0], ref_count, bounds, total_surface);
+			}
+		}
+
+		//Devide
+		if(spatial_split.axis >= 0 && spatial_split.cost < object_split.cost &&
+		   spatial_split.cost < leaf_cost){
+			int dup_count = splitRefsSpatially(ctx, refs, spatial_split, budget,
+			                                   left_refs, right_refs);
+			budget -= dup_count;
+		}
+		if(left_refs.empty() || right_refs.empty()){
+			left_refs.clear();
+			right_refs.clear();
+			if(object_split.axis >= 0){
+				for(int i = 0; i < ref_count; i++){
+					if(binning.getBinIdx(refs[i], object_split.axis) <= object_split.bin_idx){
+						left_refs.push_back(refs[i]);
+					} else {
+						right_refs.push_back(refs[i]);
+					}
+				}
+			}
+		}
+	}
+
+	if(left_refs.empty() || right_refs.empty()){
+		//Leaf
+		int start = ctx.leaf_ref_count.fetch_add(ref_count);
+		for(int i = 0; i < ref_count; i++){
+			ctx.leaf_refs[start + i] = refs[i].tri_idx;
+		}
+		nodes.setLeaf(node_idx, start, start + ref_count);
+		return;
+	}
+	vector<BuildRef>().swap(refs); // free
+
+	//Share remaining budget
+	int left_count = left_refs.size(), right_count = right_refs.size();
+	int left_budget = (long long)budget * left_count / (left_count + right_count);
+	int right_budget = budget - left_budget;
+	int left = nodes.add(2);
+	nodes.setInternal(node_idx, left, left + 1);
+	//Recursive call (large left subtree becomes a task)
+	if(left_count + right_count >= PARALLEL_TASK_MIN_TRIS){
+		TaskGroup tasks(*ctx.pool);
+		tasks.run([&, left, left_budget, depth](){
+			buildSpatialNode(ctx, left, left_refs, depth + 1, left_budget);
+		});
+		buildSpatialNode(ctx, left + 1, right_refs, depth + 1, right_budget);
+		tasks.wait();
+	} else {
+		buildSpatialNode(ctx, left, left_refs, depth + 1, left_budget);
+		buildSpatialNode(ctx, left + 1, right_refs, depth + 1, right_budget);
+	}
+}
+void buildSpatialBvh(const vector<vec3>& tri_vertices, const BVHBuildSettings& settings,
+                     ThreadPool& pool, BVHNodes& nodes, vector<int>& tri_refs){
+	int tri_count = tri_vertices.size() / 3;
+	int budget = int(max(settings.split_budget, 0.f) * tri_count);
+	int max_ref_count = tri_count + budget;
+
+	// Triangle references
+	vector<BuildRef> refs(tri_count);
+	initTriangleRefs(tri_vertices, &refs[0], pool);
+
+	// Node array (a leaf has one reference at least)
+	nodes.allocate(2 * max_ref_count - 1);
+	int root = nodes.add(1);
+	tri_refs.resize(max_ref_count);
+
+	// Start dividing
+	SpatialContext ctx;
+	ctx.tri_vertices = &tri_vertices;
+	ctx.nodes = &nodes;
+	ctx.leaf_refs = &tri_refs[0];
+	ctx.leaf_ref_count = 0;
+	ctx.bin_count = std::min(std::max(settings.bin_count, MIN_BIN_COUNT), MAX_BIN_COUNT);
+	ctx.max_depth = settings.max_depth;
+	ctx.pool = &pool;
+	RefBounds root_bounds;
+	calcRefBounds(&refs[0], tri_count, root_bounds, pool);
+	ctx.min_overlap = SPATIAL_SPLIT_ALPHA * surface(root_bounds.min_point, root_bounds.max_point);
+	buildSpatialNode(ctx, root, refs, 1, budget);
+
+	nodes.shrink();
+	tri_refs.resize(ctx.leaf_ref_count);
+	tri_refs.shrink_to_fit();
+}
@@ -0,0 +1,207 @@
+#include "scene.h"
+
+#include <iostream>
+#include <algorithm>
+
+#include "obj_loader.h"
+#include "memory_usage.h"
+
+using namespace glm;
+using namespace std;
+
+int getTexHeight(int item_count, int cols){
+	return item_count / cols + 1;
+}
+
+bool loadObjScene(const string& filename, ObjBuffers& obj, SceneInfo& info){
+	ObjAttributes attributes;
+	if(!loadObjScene(filename, obj, attributes, info)) return false;
+	expandObjScene(attributes, obj);
+	return true;
+}
+bool loadObjScene(const string& filename, ObjBuffers& obj, ObjAttributes& attributes,
+                  SceneInfo& info){
+	if(!loadObjFile(filename, obj.triangle_buff, obj.mat_idx_buff, obj.material_buff,
+	                attributes, 0, TRI_TEX_COL)) return false;
+	// Clamp triangle_buff to [0,1]
+	info.point_scale = getClampScale(obj.triangle_buff); // base scale
+	info.min_point = getMinPoint(obj.triangle_buff); // base min_point
+	transformVec(obj.triangle_buff, info.point_scale, info.min_point * -1.f);
+	return true;
+}
+void expandObjScene(ObjAttributes& attributes, ObjBuffers& obj){
+	expandObjAttributes(attributes, obj.normal_buff, obj.texcoord_buf, TRI_TEX_COL);
+}
+
+// Bboxes and triangle order of bvh (tri_count of info is set)
+static void setSceneBboxes(const BVH& bvh, BVHLayout layout, SceneBuffers& buffs){
+	vector<int> bbox_tri_idx_array;  // |start_idx, end_idx| * bbox_idx
+	vector<int> bbox_miss_idx_array; // |miss_idx| * bbox_idx
+	// Reserve padded sizes (padding does not reallocate)
+	int padded_bbox_count = BVH_TEX_COL * getTexHeight(bvh.getNodeCount(), BVH_TEX_COL);
+	buffs.bbox_minmax_array.reserve(2 * padded_bbox_count);
+	buffs.bbox_info_array.reserve(3 * padded_bbox_count);
+	bvh.getInfo(buffs.bbox_minmax_array, buffs.bbox_tri_array, bbox_tri_idx_array,
+	            bbox_miss_idx_array, layout);
+
+	// Join arrays
+	joinVectors(bbox_tri_idx_array, bbox_miss_idx_array, buffs.bbox_info_array, 2, 1);
+
+	buffs.info.tri_count = buffs.bbox_tri_array.size();
+	buffs.info.bbox_count = buffs.bbox_minmax_array.size() / 2;
+	padTexRows(buffs.bbox_minmax_array, 2, BVH_TEX_COL);
+	padTexRows(buffs.bbox_info_array, 3, BVH_TEX_COL);
+}
+void orderScene(const BVH& bvh, BVHLayout layout, const ObjBuffers& obj, SceneBuffers& buffs){
+	setSceneBboxes(bvh, layout, buffs);
+
+	// Sort triangle_buff in bvh order
+	//   (spatial splits may refer a triangle more than once)
+	const vector<int>& bbox_tri_array = buffs.bbox_tri_array;
+	int ref_count = bbox_tri_array.size();
+	buffs.mat_idx_buff.resize(ref_count);
+	buffs.triangle_buff.resize(3 * ref_count);
+	buffs.normal_buff.resize(3 * ref_count);
+	buffs.texcoord_buf.resize(3 * ref_count);
+	for(int i = 0; i < ref_count; i++){
+		buffs.mat_idx_buff[i] = obj.mat_idx_buff[bbox_tri_array[i]];
+		buffs.triangle_buff[3*i+0] = obj.triangle_buff[3*bbox_tri_array[i]+0];
+		buffs.triangle_buff[3*i+1] = obj.triangle_buff[3*bbox_tri_array[i]+1];
+		buffs.triangle_buff[3*i+2] = obj.triangle_buff[3*bbox_tri_array[i]+2];
+		buffs.normal_buff[3*i+0] = obj.normal_buff[3*bbox_tri_array[i]+0];
+		buffs.normal_buff[3*i+1] = obj.normal_buff[3*bbox_tri_array[i]+1];
+		buffs.normal_buff[3*i+2] = obj.normal_buff[3*bbox_tri_array[i]+2];
+		buffs.texcoord_buf[3*i+0] = obj.texcoord_buf[3*bbox_tri_array[i]+0];
+		buffs.texcoord_buf[3*i+1] = obj.texcoord_buf[3*bbox_tri_array[i]+1];
+		buffs.texcoord_buf[3*i+2] = obj.texcoord_buf[3*bbox_tri_array[i]+2];
+	}
+	buffs.material_buff = obj.material_buff;
+
+	// Pad to texture rows
+	buffs.info.material_count = buffs.material_buff.size() / 2;
+	padTexRows(buffs.triangle_buff, 3, TRI_TEX_COL);
+	padTexRows(buffs.normal_buff, 3, TRI_TEX_COL);
+	padTexRows(buffs.texcoord_buf, 3, TRI_TEX_COL);
+	padTexRows(buffs.mat_idx_buff, 1, M_ID_TEX_COL);
+	padTexRows(buffs.material_buff, 2, M_TEX_COL);
+}
+// Triangle of all obj buffers
+struct ObjTriangle {
+	vec3 vertices[3], normals[3];
+	vec2 texcoords[3];
+	int mat_idx;
+};
+static inline void loadObjTriangle(const ObjBuffers& obj, int tri_idx, ObjTriangle& tri){
+	for(int k = 0; k < 3; k++){
+		tri.vertices[k] = obj.triangle_buff[3 * tri_idx + k];
+		tri.normals[k] = obj.normal_buff[3 * tri_idx + k];
+		tri.texcoords[k] = obj.texcoord_buf[3 * tri_idx + k];
+	}
+	tri.mat_idx = obj.mat_idx_buff[tri_idx];
+}
+static inline void storeObjTriangle(const ObjTriangle& tri, int tri_idx, ObjBuffers& obj){
+	for(int k = 0; k < 3; k++){
+		obj.triangle_buff[3 * tri_idx + k] = tri.vertices[k];
+		obj.normal_buff[3 * tri_idx + k] = tri.normals[k];
+		obj.texcoord_buf[3 * tri_idx + k] = tri.texcoords[k];
+	}
+	obj.mat_idx_buff[tri_idx] = tri.mat_idx;
+}
+// Follow cycles of order once for all buffers (dst[i] = src[order[i]])
+static void permuteObjTriangles(ObjBuffers& obj, const vector<int>& order){
+	int tri_count = order.size();
+	vector<bool> visited(tri_count, false);
+	ObjTriangle start_tri, tri;
+	for(int start = 0; start < tri_count; start++){
+		if(visited[start]) continue;
+		loadObjTriangle(obj, start, start_tri);
+		int dst_idx = start;
+		while(true){
+			visited[dst_idx] = true;
+			int src_idx = order[dst_idx];
+			if(src_idx == start) break;
+			loadObjTriangle(obj, src_idx, tri);
+			storeObjTriangle(tri, dst_idx, obj);
+			dst_idx = src_idx;
+		}
+		storeObjTriangle(start_tri, dst_idx, obj);
+	}
+}
+void orderScene(const BVH& bvh, BVHLayout layout, ObjBuffers&& obj, SceneBuffers& buffs){
+	setSceneBboxes(bvh, layout, buffs);
+
+	// Permutation unless spatial splits refer a triangle more or less than once
+	const vector<int>& bbox_tri_array = buffs.bbox_tri_array;
+	int obj_tri_count = obj.mat_idx_buff.size();
+	bool permutation = (bbox_tri_array.size() == obj_tri_count);
+	{
+		vector<bool> visited(obj_tri_count, false);
+		for(int i = 0; permutation && i < bbox_tri_array.size(); i++){
+			if(visited[bbox_tri_array[i]]) permutation = false;
+			visited[bbox_tri_array[i]] = true;
+		}
+	}
+
+	// Sort buffers in bvh order (and pad to texture rows)
+	if(permutation){
+		permuteObjTriangles(obj, bbox_tri_array);
+		padTexRows(obj.triangle_buff, 3, TRI_TEX_COL);
+		padTexRows(obj.normal_buff, 3, TRI_TEX_COL);
+		padTexRows(obj.texcoord_buf, 3, TRI_TEX_COL);
+		padTexRows(obj.mat_idx_buff, 1, M_ID_TEX_COL);
+	} else {
+		// One by one, so that one extra buffer is alive at a time
+		reorderTexItems(obj.triangle_buff, 3, bbox_tri_array, TRI_TEX_COL);
+		reorderTexItems(obj.normal_buff, 3, bbox_tri_array, TRI_TEX_COL);
+		reorderTexItems(obj.texcoord_buf, 3, bbox_tri_array, TRI_TEX_COL);
+		reorderTexItems(obj.mat_idx_buff, 1, bbox_tri_array, M_ID_TEX_COL);
+	}
+	buffs.triangle_buff = std::move(obj.triangle_buff);
+	buffs.normal_buff = std::move(obj.normal_buff);
+	buffs.texcoord_buf = std::move(obj.texcoord_buf);
+	buffs.mat_idx_buff = std::move(obj.mat_idx_buff);
+	buffs.material_buff = std::move(obj.material_buff);
+	buffs.info.material_count = buffs.material_buff.size() / 2;
+	padTexRows(buffs.material_buff, 2, M_TEX_COL);
+	obj = ObjBuffers();
+	releaseFreeMemory(); // temporaries of bboxes
+}
+void orderSceneTriangles(const BVH& bvh, BVHLayout layout, const ObjBuffers& obj,
+                         SceneBuffers& buffs){
+	const vector<int>& bbox_tri_array = buffs.bbox_tri_array;
+	for(int i = 0; i < bbox_tri_array.size(); i++){
+		buffs.triangle_buff[3*i+0] = obj.triangle_buff[3*bbox_tri_array[i]+0];
+		buffs.triangle_buff[3*i+1] = obj.triangle_buff[3*bbox_tri_array[i]+1];
+		buffs.triangle_buff[3*i+2] = obj.triangle_buff[3*bbox_tri_array[i]+2];
+	}
+	bvh.getBoundsInfo(buffs.bbox_minmax_array, layout);
+	padTexRows(buffs.bbox_minmax_array, 2, BVH_TEX_COL);
+}
+void setSceneData(const SceneBuffers& buffs, SceneData& scene){
+	scene.info = buffs.info;
+	scene.triangles = &buffs.triangle_buff[0];
+	scene.normals = &buffs.normal_buff[0];
+	scene.texcoords = &buffs.texcoord_buf[0];
+	scene.mat_idxs = &buffs.mat_idx_buff[0];
+	scene.materials = &buffs.material_buff[0];
+	scene.bbox_minmax = &buffs.bbox_minmax_array[0];
+	scene.bbox_info = &buffs.bbox_info_array[0];
+}
+int getBVHStackSize(const SceneData& scene){
+	// Deepest path of serialized tree (right child is miss link of left child)
+	if(scene.info.bbox_count == 0) return 0;
+	int max_depth = 0;
+	vector<pair<int, int> > stack(1, make_pair(0, 1)); // bbox idx, depth
+	while(!stack.empty()){
+		int bbox_idx = stack.back().first, depth = stack.back().second;
+		stack.pop_back();
+		max_depth = std::max(max_depth, depth);
+		const int* info = &scene.bbox_info[3 * bbox_idx];
+		if(info[0] >= 0) continue; // leaf
+		int left = info[1];
+		stack.push_back(make_pair(left, depth + 1));
+		stack.push_back(make_pair(scene.bbox_info[3 * left + 2], depth + 1));
+	}
+	// Every internal node on the path defers its farther child
+	return max_depth - 1;
+}
@@ -0,0 +1,187 @@
+#ifndef SCENE_H_261017
+#define SCENE_H_261017
+
+#include <string>
+#include <vector>
+#include <cassert>
+#include <cmath>
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include "bvh.h"
+#include "obj_loader.h"
+
+/* Texture layout (items per row, same as simple.fs) */
+const static int TRI_TEX_COL = 512;
+const static int M_ID_TEX_COL = 512;
+const static int M_TEX_COL = 2;
+const static int BVH_TEX_COL = 512;
+const static int VERTEX_TEX_COL = 1024; // of indexed vertices
+
+/* Convert Vectors */
+template<typename T> 
+T getMinPoint(const std::vector<T>& vec){
+	T min_point;
+	int size = sizeof(vec[0]) / sizeof(vec[0][0]);
+	//Init min
+	for(int i = 0; i < size; i++){
+		min_point[i] =  INFINITY;
+	}
+	// Get min
+	for(int i = 0; i < vec.size(); i++){
+		for(int j = 0; j < size; j++){
+			if(min_point[j] > vec[i][j]) min_point[j] = vec[i][j];
+		}
+	}
+	return min_point;
+}
+template<typename T> 
+T getMaxPoint(const std::vector<T>& vec){
+	T max_point;
+	int size = sizeof(vec[0]) / sizeof(vec[0][0]);
+	//Init max
+	for(int i = 0; i < size; i++){
+		max_point[i] = -INFINITY;
+	}
+	// Get max
+	for(int i = 0; i < vec.size(); i++){
+		for(int j = 0; j < size; j++){
+			if(max_point[j] < vec[i][j]) max_point[j] = vec[i][j];
+		}
+	}
+	return max_point;
+}
+template<typename T> 
+float getClampScale(std::vector<T>& vec){
+
+	T max_point = getMaxPoint(vec);
+	T min_point = getMinPoint(vec);
+
+	// Max diff
+	T diff = max_point - min_point;
+	float max_diff = -INFINITY;
+	int size = sizeof(vec[0])/sizeof(vec[0][0]);
+	for(int i = 0; i < size; i++){
+		if(max_diff < diff[i]){
+			max_diff = diff[i];
+		}
+	}
+	return 1.0/max_diff;
+}
+template<typename T> 
+void transformVec(std::vector<T>& vec, float scale, T shift){
+	// Scale
+	for(int i = 0; i < vec.size(); i++){
+		vec[i] = vec[i] + shift;
+		vec[i] *= scale;
+	}
+	return;
+}
+template<typename T> 
+void transformVec(std::vector<T>& vec, glm::vec3 scale, T shift){
+	// Scale
+	for(int i = 0; i < vec.size(); i++){
+		vec[i] = vec[i] + shift;
+		vec[i] *= scale;
+	}
+	return;
+}
+template<typename T>
+void joinVectors(const std::vector<T>& src1, const std::vector<T>& src2, std::vector<T>& dst,
+                 int src1_cols, int src2_cols){
+	int rows = src1.size() / src1_cols;
+	//check rows
+	assert(src1.size() % src1_cols == 0 && src2.size() % src2_cols == 0);
+	assert(rows == src2.size() / src2_cols);
+
+	int dst_cols = src1_cols + src2_cols;
+	dst.resize(rows * dst_cols);
+	for(int row = 0; row < rows; row++){
+		for(int col1 = 0; col1 < src1_cols; col1++){
+			dst[row*dst_cols + col1] = src1[row*src1_cols + col1];
+		}
+		for(int col2 = 0; col2 < src2_cols; col2++){
+			dst[row*dst_cols + src1_cols + col2] = src2[row*src2_cols + col2];
+		}
+	}
+}
+/* Texture height of items (cols items per row, always one extra row) */
+int getTexHeight(int item_count, int cols);
+// Pad vector to fill its texture (item_size elements per item)
+template<typename T>
+void padTexRows(std::vector<T>& vec, int item_size, int cols){
+	int item_count = vec.size() / item_size;
+	vec.resize(item_size * cols * getTexHeight(item_count, cols));
+}
+// Items (item_size elements) of vec gathered in order, padded to texture rows
+template<typename T>
+void reorderTexItems(std::vector<T>& vec, int item_size, const std::vector<int>& order,
+                     int cols){
+	int item_count = order.size();
+	std::vector<T> dst;
+	dst.reserve(item_size * cols * getTexHeight(item_count, cols));
+	for(int i = 0; i < item_count; i++){
+		const T* src = &vec[item_size * order[i]];
+		dst.insert(dst.end(), src, src + item_size);
+	}
+	padTexRows(dst, item_size, cols);
+	vec.swap(dst);
+}
+
+/* Scene in BVH order */
+struct SceneInfo {
+	int tri_count, material_count, bbox_count;
+	float point_scale; // clamp scale of obj
+	glm::vec3 min_point; // base min_point of obj
+};
+// Obj buffers in obj order
+struct ObjBuffers {
+	std::vector<glm::vec3> triangle_buff; // |v0,v1,v2| * tri_idx
+	std::vector<glm::vec3> normal_buff;   // |n0,n1,n2| * tri_idx
+	std::vector<glm::vec2> texcoord_buf;   // |u,v| * tri_idx
+	std::vector<int>  mat_idx_buff;  // |mat_idx| * tri_idx
+	std::vector<glm::vec3> material_buff; // |Kd, Ks| * mat_idx
+};
+struct SceneBuffers {
+	SceneInfo info;
+	std::vector<int>  bbox_tri_array; // obj triangle idx * bvh order
+	std::vector<glm::vec3> triangle_buff; // |v0,v1,v2| * tri_idx
+	std::vector<glm::vec3> normal_buff;   // |n0,n1,n2| * tri_idx
+	std::vector<glm::vec2> texcoord_buf;   // |u,v| * tri_idx
+	std::vector<int>  mat_idx_buff;  // |mat_idx| * tri_idx
+	std::vector<glm::vec3> material_buff; // |Kd, Ks| * mat_idx
+	std::vector<glm::vec3> bbox_minmax_array; // |min, max| * bbox_idx
+	std::vector<int>  bbox_info_array;  // |start_idx or -1, end_idx or hit_idx, miss_idx| * bbox_idx
+};
+// Arrays to upload (in SceneBuffers or mapped cache, padded to texture rows)
+struct SceneData {
+	SceneInfo info;
+	const glm::vec3* triangles;
+	const glm::vec3* normals;
+	const glm::vec2* texcoords;
+	const int* mat_idxs;
+	const glm::vec3* materials;
+	const glm::vec3* bbox_minmax;
+	const int* bbox_info;
+};
+
+// Load obj file and clamp it to [0,1] (base scale and min_point go to info)
+bool loadObjScene(const std::string& filename, ObjBuffers& obj, SceneInfo& info);
+// Same leaving normals and texcoords indexed in attributes until expandObjScene()
+//   (they are not resident while BVH is built)
+bool loadObjScene(const std::string& filename, ObjBuffers& obj, ObjAttributes& attributes,
+                  SceneInfo& info);
+void expandObjScene(ObjAttributes& attributes, ObjBuffers& obj);
+// Sort obj buffers in bvh order
+void orderScene(const BVH& bvh, BVHLayout layout, const ObjBuffers& obj, SceneBuffers& buffs);
+// Sort obj buffers in bvh order reusing their memory (obj is empty after)
+//   Buffers are permuted in place together, or one by one with spatial splits.
+void orderScene(const BVH& bvh, BVHLayout layout, ObjBuffers&& obj, SceneBuffers& buffs);
+// Update only triangles and bboxes (topology is kept by refit)
+void orderSceneTriangles(const BVH& bvh, BVHLayout layout, const ObjBuffers& obj,
+                         SceneBuffers& buffs);
+void setSceneData(const SceneBuffers& buffs, SceneData& scene);
+// Stack entries needed by distance ordered traversal of the binary tree
+int getBVHStackSize(const SceneData& scene);
+
+#endif
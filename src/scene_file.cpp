@@ -0,0 +1,65 @@
+#include "scene_file.h"
+
+using namespace glm;
+using namespace std;
+
+enum SceneFileArray {
+	SCENE_INFO, SCENE_TRIANGLE, SCENE_NORMAL, SCENE_TEXCOORD, SCENE_MAT_IDX,
+	SCENE_MATERIAL, SCENE_BBOX_MINMAX, SCENE_BBOX_INFO, SCENE_ARRAY_COUNT
+};
+
+uint64_t getSceneLayoutKey(uint64_t hash){
+	int tex_cols[] = {TRI_TEX_COL, M_ID_TEX_COL, M_TEX_COL, BVH_TEX_COL};
+	return hashValue(tex_cols, hash);
+}
+bool isSceneFile(const string& filename){
+	const string EXT = ".scene";
+	return filename.size() > EXT.size() &&
+	       filename.compare(filename.size() - EXT.size(), EXT.size(), EXT) == 0;
+}
+
+bool writeSceneFile(const string& path, uint64_t key, const SceneBuffers& buffs){
+	BVHCacheWriter writer;
+	writer.addArray(&buffs.info, sizeof(SceneInfo), 1);
+	writer.addArray(&buffs.triangle_buff[0], sizeof(vec3), buffs.triangle_buff.size());
+	writer.addArray(&buffs.normal_buff[0], sizeof(vec3), buffs.normal_buff.size());
+	writer.addArray(&buffs.texcoord_buf[0], sizeof(vec2), buffs.texcoord_buf.size());
+	writer.addArray(&buffs.mat_idx_buff[0], sizeof(int), buffs.mat_idx_buff.size());
+	writer.addArray(&buffs.material_buff[0], sizeof(vec3), buffs.material_buff.size());
+	writer.addArray(&buffs.bbox_minmax_array[0], sizeof(vec3), buffs.bbox_minmax_array.size());
+	writer.addArray(&buffs.bbox_info_array[0], sizeof(int), buffs.bbox_info_array.size());
+	return writer.write(path, key);
+}
+
+template<typename T>
+bool getSceneArray(const BVHCacheFile& file, int idx, int item_size, int item_count,
+                   int cols, const T*& array){
+	size_t count;
+	array = static_cast<const T*>(file.getArray(idx, sizeof(T), count));
+	return array != NULL && count >= item_size * cols * getTexHeight(item_count, cols);
+}
+bool loadSceneFile(const string& path, uint64_t key, BVHCacheFile& file, SceneData& scene){
+	if(!file.open(path, key)) return false;
+	const SceneInfo* info;
+	bool valid = file.getArrayCount() == SCENE_ARRAY_COUNT &&
+	             getSceneArray(file, SCENE_INFO, 1, 0, 1, info);
+	if(valid){
+		scene.info = *info;
+		valid = getSceneArray(file, SCENE_TRIANGLE, 3, info->tri_count, TRI_TEX_COL,
+		                      scene.triangles) &&
+		        getSceneArray(file, SCENE_NORMAL, 3, info->tri_count, TRI_TEX_COL,
+		                      scene.normals) &&
+		        getSceneArray(file, SCENE_TEXCOORD, 3, info->tri_count, TRI_TEX_COL,
+		                      scene.texcoords) &&
+		        getSceneArray(file, SCENE_MAT_IDX, 1, info->tri_count, M_ID_TEX_COL,
+		                      scene.mat_idxs) &&
+		        getSceneArray(file, SCENE_MATERIAL, 2, info->material_count, M_TEX_COL,
+		                      scene.materials) &&
+		        getSceneArray(file, SCENE_BBOX_MINMAX, 2, info->bbox_count, BVH_TEX_COL,
+		                      scene.bbox_minmax) &&
+		        getSceneArray(file, SCENE_BBOX_INFO, 3, info->bbox_count, BVH_TEX_COL,
+		                      scene.bbox_info);
+	}
+	if(!valid) file.close();
+	return valid;
+}
@@ -0,0 +1,25 @@
+#ifndef SCENE_FILE_H_261017
+#define SCENE_FILE_H_261017
+
+#include <cstdint>
+#include <string>
+
+#include "scene.h"
+#include "bvh_cache.h"
+
+/* Binary scene file
+ *   BVH ordered scene arrays, bboxes and normalization (SceneInfo) padded to
+ *   texture rows, in the container of BVH cache. Arrays are used in the
+ *   mapped file, so textures are uploaded without parsing or copying.
+ *   Written by tools/scene_convert (.scene) and by the BVH cache. */
+
+// Key of scene files of this texture layout (TRI_TEX_COL, BVH_TEX_COL, ...)
+uint64_t getSceneLayoutKey(uint64_t hash = HASH_SEED);
+bool isSceneFile(const std::string& filename); // by .scene extension
+
+bool writeSceneFile(const std::string& path, uint64_t key, const SceneBuffers& buffs);
+// Fails when arrays are missing or don't fill their texture rows
+bool loadSceneFile(const std::string& path, uint64_t key, BVHCacheFile& file,
+                   SceneData& scene);
+
+#endif
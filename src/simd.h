@@ -0,0 +1,107 @@
+#ifndef SIMD_H_261017
+#define SIMD_H_261017
+
+/* Float lanes of widest enabled instruction set
+ *   AVX-512 : 16 lanes, AVX2 : 8 lanes, SSE2 : 4 lanes (select by -m flags).
+ *   SIMD_WIDTH is 1 when none is enabled, and packet code is disabled. */
+
+#if defined(__AVX512F__)
+#include <immintrin.h>
+#define SIMD_WIDTH 16
+typedef __m512 SimdFloat;
+typedef __mmask16 SimdMask;
+
+inline SimdFloat simdSet(float v){ return _mm512_set1_ps(v); }
+inline SimdFloat simdLoad(const float* p){ return _mm512_loadu_ps(p); }
+inline SimdFloat simdLoadPartial(const float* p, int count){ // zero after count
+	return _mm512_maskz_loadu_ps((__mmask16)((1 << count) - 1), p);
+}
+inline void simdStore(float* p, SimdFloat a){ _mm512_storeu_ps(p, a); }
+inline SimdFloat simdAdd(SimdFloat a, SimdFloat b){ return _mm512_add_ps(a, b); }
+inline SimdFloat simdSub(SimdFloat a, SimdFloat b){ return _mm512_sub_ps(a, b); }
+inline SimdFloat simdMul(SimdFloat a, SimdFloat b){ return _mm512_mul_ps(a, b); }
+inline SimdFloat simdDiv(SimdFloat a, SimdFloat b){ return _mm512_div_ps(a, b); }
+inline SimdFloat simdMin(SimdFloat a, SimdFloat b){ return _mm512_min_ps(a, b); }
+inline SimdFloat simdMax(SimdFloat a, SimdFloat b){ return _mm512_max_ps(a, b); }
+inline SimdMask simdLess(SimdFloat a, SimdFloat b){ return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+inline SimdMask simdAnd(SimdMask a, SimdMask b){ return a & b; }
+inline SimdMask simdOr(SimdMask a, SimdMask b){ return a | b; }
+inline SimdMask simdAndNot(SimdMask a, SimdMask b){ return ~a & b; } // !a && b
+inline SimdMask simdMaskFromBits(int bits){ return (SimdMask)bits; }
+inline int simdMaskBits(SimdMask a){ return a; }
+inline SimdFloat simdSelect(SimdMask mask, SimdFloat a, SimdFloat b){ // mask ? a : b
+	return _mm512_mask_blend_ps(mask, b, a);
+}
+
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#define SIMD_WIDTH 8
+typedef __m256 SimdFloat;
+typedef __m256 SimdMask;
+
+inline SimdFloat simdSet(float v){ return _mm256_set1_ps(v); }
+inline SimdFloat simdLoad(const float* p){ return _mm256_loadu_ps(p); }
+inline SimdMask simdMaskFromBits(int bits);
+inline SimdFloat simdLoadPartial(const float* p, int count){
+	return _mm256_maskload_ps(p, _mm256_castps_si256(simdMaskFromBits((1 << count) - 1)));
+}
+inline void simdStore(float* p, SimdFloat a){ _mm256_storeu_ps(p, a); }
+inline SimdFloat simdAdd(SimdFloat a, SimdFloat b){ return _mm256_add_ps(a, b); }
+inline SimdFloat simdSub(SimdFloat a, SimdFloat b){ return _mm256_sub_ps(a, b); }
+inline SimdFloat simdMul(SimdFloat a, SimdFloat b){ return _mm256_mul_ps(a, b); }
+inline SimdFloat simdDiv(SimdFloat a, SimdFloat b){ return _mm256_div_ps(a, b); }
+inline SimdFloat simdMin(SimdFloat a, SimdFloat b){ return _mm256_min_ps(a, b); }
+inline SimdFloat simdMax(SimdFloat a, SimdFloat b){ return _mm256_max_ps(a, b); }
+inline SimdMask simdLess(SimdFloat a, SimdFloat b){ return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+inline SimdMask simdAnd(SimdMask a, SimdMask b){ return _mm256_and_ps(a, b); }
+inline SimdMask simdOr(SimdMask a, SimdMask b){ return _mm256_or_ps(a, b); }
+inline SimdMask simdAndNot(SimdMask a, SimdMask b){ return _mm256_andnot_ps(a, b); }
+inline SimdMask simdMaskFromBits(int bits){
+	__m256i lane_bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+	__m256i masked = _mm256_and_si256(_mm256_set1_epi32(bits), lane_bits);
+	return _mm256_castsi256_ps(_mm256_cmpeq_epi32(masked, lane_bits));
+}
+inline int simdMaskBits(SimdMask a){ return _mm256_movemask_ps(a); }
+inline SimdFloat simdSelect(SimdMask mask, SimdFloat a, SimdFloat b){
+	return _mm256_blendv_ps(b, a, mask);
+}
+
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define SIMD_WIDTH 4
+typedef __m128 SimdFloat;
+typedef __m128 SimdMask;
+
+inline SimdFloat simdSet(float v){ return _mm_set1_ps(v); }
+inline SimdFloat simdLoad(const float* p){ return _mm_loadu_ps(p); }
+inline SimdFloat simdLoadPartial(const float* p, int count){
+	float lanes[4] = {0, 0, 0, 0};
+	for(int i = 0; i < count; i++) lanes[i] = p[i];
+	return _mm_loadu_ps(lanes);
+}
+inline void simdStore(float* p, SimdFloat a){ _mm_storeu_ps(p, a); }
+inline SimdFloat simdAdd(SimdFloat a, SimdFloat b){ return _mm_add_ps(a, b); }
+inline SimdFloat simdSub(SimdFloat a, SimdFloat b){ return _mm_sub_ps(a, b); }
+inline SimdFloat simdMul(SimdFloat a, SimdFloat b){ return _mm_mul_ps(a, b); }
+inline SimdFloat simdDiv(SimdFloat a, SimdFloat b){ return _mm_div_ps(a, b); }
+inline SimdFloat simdMin(SimdFloat a, SimdFloat b){ return _mm_min_ps(a, b); }
+inline SimdFloat simdMax(SimdFloat a, SimdFloat b){ return _mm_max_ps(a, b); }
+inline SimdMask simdLess(SimdFloat a, SimdFloat b){ return _mm_cmplt_ps(a, b); }
+inline SimdMask simdAnd(SimdMask a, SimdMask b){ return _mm_and_ps(a, b); }
+inline SimdMask simdOr(SimdMask a, SimdMask b){ return _mm_or_ps(a, b); }
+inline SimdMask simdAndNot(SimdMask a, SimdMask b){ return _mm_andnot_ps(a, b); }
+inline SimdMask simdMaskFromBits(int bits){
+	__m128i lane_bits = _mm_setr_epi32(1, 2, 4, 8);
+	__m128i masked = _mm_and_si128(_mm_set1_epi32(bits), lane_bits);
+	return _mm_castsi128_ps(_mm_cmpeq_epi32(masked, lane_bits));
+}
+inline int simdMaskBits(SimdMask a){ return _mm_movemask_ps(a); }
+inline SimdFloat simdSelect(SimdMask mask, SimdFloat a, SimdFloat b){
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+#else
+#define SIMD_WIDTH 1
+#endif
+
+#endif
@@ -23,6 +23,50 @@ uniform sampler2DRect accum_pixel_tex;
 uniform sampler2DRect bbox_minmax_tex;
 uniform isampler2DRect bbox_info_tex;
 
+//Wide BVH textures (WIDE_BVH_WIDTH is defined by renderer, 4 or 8)
+//  bounds : |min x, min y, min z, max x, max y, max z| texels of 4 children
+//  links : |first, second| texels of 4 children
+#ifdef WIDE_BVH_WIDTH
+uniform sampler2DRect wide_bounds_tex;
+uniform isampler2DRect wide_links_tex;
+const int WIDE_GROUPS = WIDE_BVH_WIDTH / 4;
+const int WIDE_STACK_SIZE = 64;
+#endif
+
+//Binary BVH traversal (BVH_STACK_TRAVERSAL is defined by renderer)
+//  nearer child first, farther one is deferred in a stack (miss links otherwise)
+#ifdef BVH_STACK_TRAVERSAL
+const int BVH_STACK_SIZE = 64;
+#endif
+
+//Pixel variance (PIXEL_VARIANCE is defined by renderer)
+//  alpha of accum_pixel_tex is the mean of squared luminance of samples
+#ifdef PIXEL_VARIANCE
+const vec3 PIXEL_LUMINANCE = vec3(0.2126, 0.7152, 0.0722);
+#endif
+
+//Adaptive sampling mask (ADAPTIVE_SAMPLING is defined by renderer)
+//  samples of pixel when the mask was made (-1 : not sampled), mask_frame is
+//  frames since then
+#ifdef ADAPTIVE_SAMPLING
+uniform isampler2DRect sample_mask_tex;
+uniform int mask_frame;
+#endif
+
+//Triangle record texture (TRI_RECORD_EDGES or TRI_RECORD_WOOP is defined by renderer)
+//  edges : v0, edge0, edge1 texels, woop : rows of world to unit triangle transform
+#if defined(TRI_RECORD_EDGES) || defined(TRI_RECORD_WOOP)
+uniform sampler2DRect tri_record_tex;
+#endif
+
+//Indexed vertices (INDEXED_VERTICES is defined by renderer)
+//  triangle, normal and texcoord textures have a texel of each shared vertex
+//  in VERTEX_TEX_COL columns, vertex_index_tex has indices of each triangle
+#ifdef INDEXED_VERTICES
+uniform isampler2DRect vertex_index_tex;
+const int VERTEX_TEX_COL = 1024;
+#endif
+
 const int TRI_TEX_COL = 512;
 const int M_ID_TEX_COL = 512;
 const int M_TEX_COL = 2;
@@ -48,65 +92,111 @@ struct Intersection {
 	vec3 normal;
 	vec2 texcoord;
 };
-void intersectTriangle(const Ray ray, const int tri_idx, inout Intersection result) {
+// Texels of triangle corners in triangle, normal and texcoord textures
+void getCornerTexels(const int tri_idx, out vec2 texel0, out vec2 texel1, out vec2 texel2) {
+	int col_idx = tri_idx % TRI_TEX_COL;
+	int row_idx = tri_idx / TRI_TEX_COL;
+#ifdef INDEXED_VERTICES
+	ivec3 vertex_idxs = texture(vertex_index_tex, vec2(col_idx, row_idx)).xyz;
+	texel0 = vec2(vertex_idxs.x % VERTEX_TEX_COL, vertex_idxs.x / VERTEX_TEX_COL);
+	texel1 = vec2(vertex_idxs.y % VERTEX_TEX_COL, vertex_idxs.y / VERTEX_TEX_COL);
+	texel2 = vec2(vertex_idxs.z % VERTEX_TEX_COL, vertex_idxs.z / VERTEX_TEX_COL);
+#else
+	texel0 = vec2(3*col_idx+0, row_idx);
+	texel1 = vec2(3*col_idx+1, row_idx);
+	texel2 = vec2(3*col_idx+2, row_idx);
+#endif
+}
+// Distance and barycentric u, v of hit nearer than t_max
+bool hitTriangle(const Ray ray, const int tri_idx, const float t_max, out vec3 tuv) {
 	int col_idx = tri_idx % TRI_TEX_COL;
 	int row_idx = tri_idx / TRI_TEX_COL;
-	vec3 position0 = texture(triangle_tex, vec2(3*col_idx+0, row_idx)).xyz;
-	vec3 edge0 = texture(triangle_tex, vec2(3*col_idx+1, row_idx)).xyz - position0;
-	vec3 edge1 = texture(triangle_tex, vec2(3*col_idx+2, row_idx)).xyz - position0;
+#if defined(TRI_RECORD_WOOP)
+	/* Woop intersection (ray in unit triangle space) */
+	vec4 row0 = texture(tri_record_tex, vec2(3*col_idx+0, row_idx));
+	vec4 row1 = texture(tri_record_tex, vec2(3*col_idx+1, row_idx));
+	vec4 row2 = texture(tri_record_tex, vec2(3*col_idx+2, row_idx));
+	float t = -(row2.w + dot(row2.xyz, ray.org)) / dot(row2.xyz, ray.dir);
+	if(!(NEAR_ZERO < t && t < t_max)) return false;
+	float u = row0.w + dot(row0.xyz, ray.org) + t * dot(row0.xyz, ray.dir);
+	if(u < 0.0 || 1.0 < u) return false;
+	float v = row1.w + dot(row1.xyz, ray.org) + t * dot(row1.xyz, ray.dir);
+	if(v < 0.0 || 1.0 < u + v) return false;
+#else
+#if defined(TRI_RECORD_EDGES)
+	vec3 position0 = texture(tri_record_tex, vec2(3*col_idx+0, row_idx)).xyz;
+	vec3 edge0 = texture(tri_record_tex, vec2(3*col_idx+1, row_idx)).xyz;
+	vec3 edge1 = texture(tri_record_tex, vec2(3*col_idx+2, row_idx)).xyz;
+#else
+	vec2 texel0, texel1, texel2;
+	getCornerTexels(tri_idx, texel0, texel1, texel2);
+	vec3 position0 = texture(triangle_tex, texel0).xyz;
+	vec3 edge0 = texture(triangle_tex, texel1).xyz - position0;
+	vec3 edge1 = texture(triangle_tex, texel2).xyz - position0;
+#endif
 
 	/* Möller–Trumbore intersection algorithm */
 	vec3 P = cross(ray.dir, edge1);
 	float det = dot(P, edge0);
-	if(-NEAR_ZERO < det && det < NEAR_ZERO) return;
+	if(-NEAR_ZERO < det && det < NEAR_ZERO) return false;
 	float inv_det = 1.0 / det;
 	vec3 T = ray.org - position0;
 	float u = dot(T, P) * inv_det;
-	if(u < 0.0 || 1.0 < u) return;
+	if(u < 0.0 || 1.0 < u) return false;
 	vec3 Q = cross(T, edge0);
 	float v = dot(ray.dir, Q) * inv_det;
-	if(v < 0.0 || 1.0 < u + v) return;
+	if(v < 0.0 || 1.0 < u + v) return false;
 	float t = dot(edge1, Q) * inv_det;
-	if(NEAR_ZERO < t){ // Hit
-		// Check distance
-		if(t < result.dist){
-			// Get nearest triangle info
-			result.dist = t;
-			result.tri_idx = tri_idx;
-			result.hit_position = ray.dir * t + ray.org;
-
-			float uv1 = 1.0 - u - v;
-
-			vec3 n0 = texture(normal_tex, vec2(3*col_idx+0, row_idx)).xyz;
-			vec3 n1 = texture(normal_tex, vec2(3*col_idx+1, row_idx)).xyz;
-			vec3 n2 = texture(normal_tex, vec2(3*col_idx+2, row_idx)).xyz;
-			n0 = n0 * 2.0 - 1.0;
-			n1 = n1 * 2.0 - 1.0;
-			n2 = n2 * 2.0 - 1.0;
-
-			if((length(n0) < 0.5) && (length(n1) < 0.5) && (length(n2) < 0.5)){
-				vec3 ref_normal = normalize(cross(edge0, edge1));
-				result.normal = ref_normal;
-			}else{
-				if(dot(n1, n0) < 0) n1 *= -1.0;
-				if(dot(n2, n0) < 0) n2 *= -1.0;
-
-				result.normal = n0 * uv1 + n1 * u + n2 * v;
-			}
-
-			vec2 t0 = texture(texcoord_tex, vec2(3*col_idx+0, row_idx)).xy;
-			vec2 t1 = texture(texcoord_tex, vec2(3*col_idx+1, row_idx)).xy;
-			vec2 t2 = texture(texcoord_tex, vec2(3*col_idx+2, row_idx)).xy;
-			result.texcoord = t0 * uv1 + t1 * u + t2 * v;
+	// Hit and nearer
+	if(!(NEAR_ZERO < t && t < t_max)) return false;
+#endif
+	tuv = vec3(t, u, v);
+	return true;
+}
+void intersectTriangle(const Ray ray, const int tri_idx, inout Intersection result) {
+	vec3 tuv;
+	if(!hitTriangle(ray, tri_idx, result.dist, tuv)) return;
+	float t = tuv.x, u = tuv.y, v = tuv.z;
+	vec2 texel0, texel1, texel2;
+	getCornerTexels(tri_idx, texel0, texel1, texel2);
+
+	// Get nearest triangle info
+	result.dist = t;
+	result.tri_idx = tri_idx;
+	result.hit_position = ray.dir * t + ray.org;
+
+	float uv1 = 1.0 - u - v;
+
+	vec3 n0 = texture(normal_tex, texel0).xyz;
+	vec3 n1 = texture(normal_tex, texel1).xyz;
+	vec3 n2 = texture(normal_tex, texel2).xyz;
+	n0 = n0 * 2.0 - 1.0;
+	n1 = n1 * 2.0 - 1.0;
+	n2 = n2 * 2.0 - 1.0;
+
+	if((length(n0) < 0.5) && (length(n1) < 0.5) && (length(n2) < 0.5)){
+		// Vertices only for flat normal
+		vec3 position0 = texture(triangle_tex, texel0).xyz;
+		vec3 edge0 = texture(triangle_tex, texel1).xyz - position0;
+		vec3 edge1 = texture(triangle_tex, texel2).xyz - position0;
+		vec3 ref_normal = normalize(cross(edge0, edge1));
+		result.normal = ref_normal;
+	}else{
+		if(dot(n1, n0) < 0) n1 *= -1.0;
+		if(dot(n2, n0) < 0) n2 *= -1.0;
 
-		}
-		return;
+		result.normal = n0 * uv1 + n1 * u + n2 * v;
 	}
-	return;
+
+	vec2 t0 = texture(texcoord_tex, texel0).xy;
+	vec2 t1 = texture(texcoord_tex, texel1).xy;
+	vec2 t2 = texture(texcoord_tex, texel2).xy;
+	result.texcoord = t0 * uv1 + t1 * u + t2 * v;
 }
-bool intersectBBox(const Ray ray, const int bbox_idx){
-	float t_far = INFINITY;
-	float t_near =  -INFINITY;
+// Hit of bbox in [t_min, t_max] of ray
+bool intersectBBox(const Ray ray, const int bbox_idx, const float t_min, const float t_max){
+	float t_far = t_max;
+	float t_near = t_min;
 
 	int col_idx = bbox_idx % BVH_TEX_COL;
 	int row_idx = bbox_idx / BVH_TEX_COL;
@@ -128,6 +218,179 @@ bool intersectBBox(const Ray ray, const int bbox_idx){
 
 	return true;
 }
+#ifdef WIDE_BVH_WIDTH
+Intersection intersect(const Ray ray){
+	Intersection result = Intersection(INFINITY, 0, vec3(0), vec3(0), vec2(0));
+
+	vec3 inv_dir = 1.0 / ray.dir;
+	ivec2 stack_links[WIDE_STACK_SIZE]; // leaf : start and end, internal : -1 and node
+	float stack_dists[WIDE_STACK_SIZE];
+	int stack_size = 0;
+	int node_idx = 0;
+	while(node_idx >= 0){
+		int col_idx = node_idx % BVH_TEX_COL;
+		int row_idx = node_idx / BVH_TEX_COL;
+		int base = stack_size;
+		for(int g = 0; g < WIDE_GROUPS; g++){
+			// Slab test of 4 children (nearer than current hit)
+			vec4 t_near = vec4(0.0);
+			vec4 t_far = vec4(result.dist);
+			for(int i = 0; i < 3; i++){
+				vec4 min_i = texture(wide_bounds_tex,
+				                     vec2(6*WIDE_GROUPS*col_idx + i*WIDE_GROUPS + g, row_idx));
+				vec4 max_i = texture(wide_bounds_tex,
+				                     vec2(6*WIDE_GROUPS*col_idx + (3+i)*WIDE_GROUPS + g, row_idx));
+				vec4 t1 = (min_i - ray.org[i]) * inv_dir[i];
+				vec4 t2 = (max_i - ray.org[i]) * inv_dir[i];
+				t_near = max(t_near, min(t1, t2));
+				t_far = min(t_far, max(t1, t2));
+			}
+			ivec4 firsts = texture(wide_links_tex, vec2(2*WIDE_GROUPS*col_idx + g, row_idx));
+			ivec4 seconds = texture(wide_links_tex,
+			                        vec2(2*WIDE_GROUPS*col_idx + WIDE_GROUPS + g, row_idx));
+			// Push hit children, nearest on top
+			for(int c = 0; c < 4; c++){
+				if(t_far[c] < t_near[c] || stack_size >= WIDE_STACK_SIZE) continue;
+				int i = stack_size++;
+				for(; i > base && stack_dists[i-1] < t_near[c]; i--){
+					stack_links[i] = stack_links[i-1];
+					stack_dists[i] = stack_dists[i-1];
+				}
+				stack_links[i] = ivec2(firsts[c], seconds[c]);
+				stack_dists[i] = t_near[c];
+			}
+		}
+		// Pop next node (leaves are searched on the way)
+		node_idx = -1;
+		while(stack_size > 0){
+			stack_size--;
+			if(stack_dists[stack_size] > result.dist) continue; // behind nearest hit
+			ivec2 link = stack_links[stack_size];
+			if(link.x < 0){
+				node_idx = link.y;
+				break;
+			}
+			// Linear search
+			for(int tri_idx = link.x; tri_idx < link.y; tri_idx++){
+				intersectTriangle(ray, tri_idx, result);
+			}
+		}
+	}
+	return result;
+}
+// Any hit nearer than t_max (children are pushed without order)
+bool occluded(const Ray ray, const float t_max){
+	vec3 inv_dir = 1.0 / ray.dir;
+	int stack_nodes[WIDE_STACK_SIZE];
+	int stack_size = 0;
+	int node_idx = 0;
+	vec3 tuv;
+	while(node_idx >= 0){
+		int col_idx = node_idx % BVH_TEX_COL;
+		int row_idx = node_idx / BVH_TEX_COL;
+		for(int g = 0; g < WIDE_GROUPS; g++){
+			// Slab test of 4 children (nearer than t_max)
+			vec4 t_near = vec4(0.0);
+			vec4 t_far = vec4(t_max);
+			for(int i = 0; i < 3; i++){
+				vec4 min_i = texture(wide_bounds_tex,
+				                     vec2(6*WIDE_GROUPS*col_idx + i*WIDE_GROUPS + g, row_idx));
+				vec4 max_i = texture(wide_bounds_tex,
+				                     vec2(6*WIDE_GROUPS*col_idx + (3+i)*WIDE_GROUPS + g, row_idx));
+				vec4 t1 = (min_i - ray.org[i]) * inv_dir[i];
+				vec4 t2 = (max_i - ray.org[i]) * inv_dir[i];
+				t_near = max(t_near, min(t1, t2));
+				t_far = min(t_far, max(t1, t2));
+			}
+			ivec4 firsts = texture(wide_links_tex, vec2(2*WIDE_GROUPS*col_idx + g, row_idx));
+			ivec4 seconds = texture(wide_links_tex,
+			                        vec2(2*WIDE_GROUPS*col_idx + WIDE_GROUPS + g, row_idx));
+			for(int c = 0; c < 4; c++){
+				if(t_far[c] < t_near[c]) continue;
+				if(firsts[c] < 0){
+					if(stack_size < WIDE_STACK_SIZE) stack_nodes[stack_size++] = seconds[c];
+					continue;
+				}
+				// Leaves are searched at once
+				for(int tri_idx = firsts[c]; tri_idx < seconds[c]; tri_idx++){
+					if(hitTriangle(ray, tri_idx, t_max, tuv)) return true;
+				}
+			}
+		}
+		node_idx = (stack_size > 0) ? stack_nodes[--stack_size] : -1;
+	}
+	return false;
+}
+#elif defined(BVH_STACK_TRAVERSAL)
+// Entry distance of bbox nearer than t_max (-1 : miss)
+float enterBBox(const Ray ray, const vec3 inv_dir, const int bbox_idx, const float t_max){
+	int col_idx = bbox_idx % BVH_TEX_COL;
+	int row_idx = bbox_idx / BVH_TEX_COL;
+	vec3 min_point = texture(bbox_minmax_tex, vec2(2*col_idx+0, row_idx)).xyz;
+	vec3 max_point = texture(bbox_minmax_tex, vec2(2*col_idx+1, row_idx)).xyz;
+	vec3 t1 = (min_point - ray.org) * inv_dir;
+	vec3 t2 = (max_point - ray.org) * inv_dir;
+	vec3 t_mins = min(t1, t2);
+	vec3 t_maxs = max(t1, t2);
+	float t_near = max(max(t_mins.x, t_mins.y), max(t_mins.z, 0.0));
+	float t_far = min(min(t_maxs.x, t_maxs.y), min(t_maxs.z, t_max));
+	return (t_far < t_near) ? -1.0 : t_near;
+}
+Intersection intersect(const Ray ray){
+	Intersection result = Intersection(INFINITY, 0, vec3(0), vec3(0), vec2(0));
+
+	vec3 inv_dir = 1.0 / ray.dir;
+	int stack_nodes[BVH_STACK_SIZE];
+	float stack_dists[BVH_STACK_SIZE];
+	int stack_size = 0;
+	int bbox_idx = (enterBBox(ray, inv_dir, 0, result.dist) < 0.0) ? -1 : 0;
+	while(bbox_idx >= 0){
+		int col_idx = bbox_idx % BVH_TEX_COL;
+		int row_idx = bbox_idx / BVH_TEX_COL;
+		int tri_idx = texture(bbox_info_tex, vec2(3*col_idx+0, row_idx)).r;
+		int end_tri_idx = texture(bbox_info_tex, vec2(3*col_idx+1, row_idx)).r;
+		// Leaf check (internal node is -1)
+		if(tri_idx < 0){
+			// Children (right is miss link of left, left is end_tri_idx)
+			int left = end_tri_idx;
+			int right = texture(bbox_info_tex,
+			                    vec2(3*(left % BVH_TEX_COL)+2, left / BVH_TEX_COL)).r;
+			float t_left = enterBBox(ray, inv_dir, left, result.dist);
+			float t_right = enterBBox(ray, inv_dir, right, result.dist);
+			if(t_left >= 0.0 && t_right >= 0.0){
+				// Nearer child first, farther one is deferred
+				bool right_first = (t_right < t_left);
+				if(stack_size < BVH_STACK_SIZE){
+					stack_nodes[stack_size] = right_first ? left : right;
+					stack_dists[stack_size] = right_first ? t_left : t_right;
+					stack_size++;
+				}
+				bbox_idx = right_first ? right : left;
+				continue;
+			}
+			if(t_left >= 0.0 || t_right >= 0.0){
+				bbox_idx = (t_left >= 0.0) ? left : right;
+				continue;
+			}
+		}else{
+			// Linear search
+			for(; tri_idx < end_tri_idx; tri_idx++){
+				intersectTriangle(ray, tri_idx, result);
+			}
+		}
+		// Pop deferred child (culled behind nearest hit)
+		bbox_idx = -1;
+		while(stack_size > 0){
+			stack_size--;
+			if(stack_dists[stack_size] <= result.dist){
+				bbox_idx = stack_nodes[stack_size];
+				break;
+			}
+		}
+	}
+	return result;
+}
+#else
 Intersection intersect(const Ray ray){
 	Intersection result = Intersection(INFINITY, 0, vec3(0), vec3(0), vec2(0));
 
@@ -136,27 +399,56 @@ Intersection intersect(const Ray ray){
 	while(true){
 		int col_idx = bbox_idx % BVH_TEX_COL;
 		int row_idx = bbox_idx / BVH_TEX_COL;
-		if(intersectBBox(ray, bbox_idx)){
+		if(intersectBBox(ray, bbox_idx, -INFINITY, INFINITY)){
 			int tri_idx = texture(bbox_info_tex, vec2(3*col_idx+0, row_idx)).r;
+			int end_tri_idx = texture(bbox_info_tex, vec2(3*col_idx+1, row_idx)).r;
 			// Leaf check (internal node is -1)
-			if(tri_idx >= 0){
-				int end_tri_idx = texture(bbox_info_tex, vec2(3*col_idx+1, row_idx)).r;
-				// Linear search
-				for(; tri_idx < end_tri_idx; tri_idx++){
-					intersectTriangle(ray, tri_idx, result);
-				}
+			if(tri_idx < 0){
+				// hit link (end_tri_idx of internal node)
+				bbox_idx = end_tri_idx;
+				continue;
+			}
+			// Linear search
+			for(; tri_idx < end_tri_idx; tri_idx++){
+				intersectTriangle(ray, tri_idx, result);
 			}
-			// hit link
-			bbox_idx++;
-			if(bbox_idx >= bbox_size) break;
-		}else{
-			// miss link
-			bbox_idx = texture(bbox_info_tex, vec2(3*col_idx+2, row_idx)).r;
-			if(bbox_idx < 0) break;
 		}
+		// miss link (also hit link of leaf)
+		bbox_idx = texture(bbox_info_tex, vec2(3*col_idx+2, row_idx)).r;
+		if(bbox_idx < 0) break;
 	}
 	return result;
 }
+#endif
+#ifndef WIDE_BVH_WIDTH
+// Any hit nearer than t_max (nodes beyond it or behind origin are culled)
+bool occluded(const Ray ray, const float t_max){
+	int bbox_idx = 0;
+	vec3 tuv;
+	while(true){
+		int col_idx = bbox_idx % BVH_TEX_COL;
+		int row_idx = bbox_idx / BVH_TEX_COL;
+		if(intersectBBox(ray, bbox_idx, 0.0, t_max)){
+			int tri_idx = texture(bbox_info_tex, vec2(3*col_idx+0, row_idx)).r;
+			int end_tri_idx = texture(bbox_info_tex, vec2(3*col_idx+1, row_idx)).r;
+			// Leaf check (internal node is -1)
+			if(tri_idx < 0){
+				// hit link (end_tri_idx of internal node)
+				bbox_idx = end_tri_idx;
+				continue;
+			}
+			// First hit
+			for(; tri_idx < end_tri_idx; tri_idx++){
+				if(hitTriangle(ray, tri_idx, t_max, tuv)) return true;
+			}
+		}
+		// miss link (also hit link of leaf)
+		bbox_idx = texture(bbox_info_tex, vec2(3*col_idx+2, row_idx)).r;
+		if(bbox_idx < 0) break;
+	}
+	return false;
+}
+#endif
 
 const float glossiness = 8.0;//光沢度
 vec3 sampleDiffuse(const vec3 light_dir, const vec3 look_dir, const vec3 normal,
@@ -237,9 +529,8 @@ vec3 render(const Ray ray) {
 		vec3 light_rel_pos = (LightPos + LightPosRange * (rand_vec3 * 2.0 - 1.0))
 		                      - results[i].hit_position;
 		Ray s_ray = Ray(rays[i+1].org, normalize(light_rel_pos));
-		Intersection s_result = intersect(s_ray);
 		// Check arrival of the light TODO LightColor
-		if(s_result.dist > length(light_rel_pos)){ // Check far or miss
+		if(!occluded(s_ray, length(light_rel_pos))){
 			direct_color += vec3(1,1,1) * sampleDiffuse(s_ray.dir, rays[i].dir,
 			                results[i].normal, results[i].tri_idx, results[i].texcoord);
 		}
@@ -256,16 +547,34 @@ vec3 render(const Ray ray) {
 }
 
 void main() {
+#ifdef ADAPTIVE_SAMPLING
+	// Skipped pixel keeps framebuffer
+	int pixel_samples = texture(sample_mask_tex, position).r;
+	if(pixel_samples < 0) discard;
+	int sample_idx = pixel_samples + mask_frame;
+#else
+	int sample_idx = accum_frame;
+#endif
 	vec3 camera_dir = normalize(camera_dir_base + (position.x+rand_vec2_b.x) * camera_xvec
 	                                            - (position.y+rand_vec2_b.y) * camera_yvec);
 	Ray ray = Ray(camera_org, camera_dir);
 	vec3 color = render(ray);
-	if(accum_frame == 0){
-		gl_FragColor = vec4(color, 1);
+#ifdef PIXEL_VARIANCE
+	// Mean of squared luminance in alpha
+	float luminance = dot(color, PIXEL_LUMINANCE);
+	float moment = luminance * luminance;
+#else
+	float moment = 1;
+#endif
+	if(sample_idx == 0){
+		gl_FragColor = vec4(color, moment);
 	}else{
 		// Add pre-frame pixel color
-		vec3 old_color = texture(accum_pixel_tex, position).xyz;
-		vec3 new_color = (old_color*accum_frame + color) /(accum_frame+1);
-		gl_FragColor = vec4(new_color, 1);
+		vec4 old_color = texture(accum_pixel_tex, position);
+		vec3 new_color = (old_color.xyz*sample_idx + color) /(sample_idx+1);
+#ifdef PIXEL_VARIANCE
+		moment = (old_color.w*sample_idx + moment) /(sample_idx+1);
+#endif
+		gl_FragColor = vec4(new_color, moment);
 	}
 }
@@ -0,0 +1,134 @@
+#include "thread_pool.h"
+
+using namespace std;
+
+// Worker of the current thread
+static thread_local ThreadPool* current_pool = NULL;
+static thread_local int current_worker_idx = 0;
+
+/* Task Group */
+TaskGroup::TaskGroup(ThreadPool& pool) : pool(pool), pending_count(0) {
+}
+TaskGroup::~TaskGroup(){
+	wait();
+}
+void TaskGroup::run(const function<void()>& func){
+	pending_count++;
+	ThreadPool::Task task = {func, this};
+	pool.push(task);
+}
+void TaskGroup::wait(){
+	int worker_idx = pool.getWorkerIdx();
+	while(pending_count > 0){
+		// Help instead of blocking
+		if(!pool.executeTask(worker_idx)) this_thread::yield();
+	}
+}
+
+/* Thread Pool */
+ThreadPool::ThreadPool(int thread_count) : queued_count(0), exiting(false) {
+	if(thread_count <= 0) thread_count = thread::hardware_concurrency();
+	if(thread_count <= 0) thread_count = 1;
+	this->thread_count = thread_count;
+
+	// Worker 0 is the calling (external) threads
+	for(int i = 0; i < thread_count; i++){
+		workers.push_back(new Worker());
+	}
+	for(int i = 1; i < thread_count; i++){
+		threads.push_back(thread(&ThreadPool::workerLoop, this, i));
+	}
+}
+ThreadPool::~ThreadPool(){
+	{
+		lock_guard<mutex> lock(sleep_mutex);
+		exiting = true;
+	}
+	sleep_cond.notify_all();
+	for(int i = 0; i < threads.size(); i++){
+		threads[i].join();
+	}
+	for(int i = 0; i < workers.size(); i++){
+		delete workers[i];
+	}
+}
+int ThreadPool::getWorkerIdx(){
+	return (current_pool == this) ? current_worker_idx : 0;
+}
+void ThreadPool::push(const Task& task){
+	Worker* worker = workers[getWorkerIdx()];
+	{
+		lock_guard<mutex> lock(worker->mutex);
+		worker->tasks.push_back(task);
+	}
+	{
+		lock_guard<mutex> lock(sleep_mutex);
+		queued_count++;
+	}
+	sleep_cond.notify_one();
+}
+bool ThreadPool::popTask(int worker_idx, Task& task){
+	// Own tasks (newest first)
+	{
+		Worker* worker = workers[worker_idx];
+		lock_guard<mutex> lock(worker->mutex);
+		if(!worker->tasks.empty()){
+			task = worker->tasks.back();
+			worker->tasks.pop_back();
+			queued_count--;
+			return true;
+		}
+	}
+	// Steal from others (oldest first)
+	for(int i = 1; i < workers.size(); i++){
+		Worker* victim = workers[(worker_idx + i) % workers.size()];
+		lock_guard<mutex> lock(victim->mutex);
+		if(!victim->tasks.empty()){
+			task = victim->tasks.front();
+			victim->tasks.pop_front();
+			queued_count--;
+			return true;
+		}
+	}
+	return false;
+}
+bool ThreadPool::executeTask(int worker_idx){
+	Task task;
+	if(!popTask(worker_idx, task)) return false;
+	task.func();
+	task.group->pending_count--;
+	return true;
+}
+void ThreadPool::workerLoop(int worker_idx){
+	current_pool = this;
+	current_worker_idx = worker_idx;
+	while(true){
+		if(executeTask(worker_idx)) continue;
+		// Sleep until new tasks
+		unique_lock<mutex> lock(sleep_mutex);
+		sleep_cond.wait(lock, [this](){ return exiting || queued_count > 0; });
+		if(exiting) return;
+	}
+}
+
+/* Parallel loop */
+void parallelFor(ThreadPool& pool, int begin, int end, int grain_size,
+                 const function<void(int, int)>& func){
+	int count = end - begin;
+	if(count <= 0) return;
+	if(grain_size < 1) grain_size = 1;
+	// Chunks (a few per thread for balancing)
+	int chunk_count = min(count / grain_size, pool.getThreadCount() * 4);
+	if(chunk_count <= 1){
+		func(begin, end);
+		return;
+	}
+	TaskGroup tasks(pool);
+	for(int i = 1; i < chunk_count; i++){
+		int chunk_begin = begin + (long long)count * i / chunk_count;
+		int chunk_end = begin + (long long)count * (i + 1) / chunk_count;
+		tasks.run([=, &func](){ func(chunk_begin, chunk_end); });
+	}
+	func(begin, begin + count / chunk_count);
+	tasks.wait();
+}
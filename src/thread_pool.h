@@ -0,0 +1,64 @@
+#ifndef THREAD_POOL_H_261017
+#define THREAD_POOL_H_261017
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+class ThreadPool;
+
+/* Tasks which can be waited together */
+class TaskGroup {
+public:
+	TaskGroup(ThreadPool& pool);
+	~TaskGroup();
+	void run(const std::function<void()>& func);
+	// Wait for all tasks (the calling thread executes queued tasks meanwhile)
+	void wait();
+private:
+	friend class ThreadPool;
+	ThreadPool& pool;
+	std::atomic<int> pending_count;
+};
+
+/* Work-stealing thread pool */
+class ThreadPool {
+public:
+	// thread_count includes the calling thread (0 : hardware concurrency)
+	ThreadPool(int thread_count = 0);
+	~ThreadPool();
+	int getThreadCount() const { return thread_count; }
+private:
+	friend class TaskGroup;
+	struct Task {
+		std::function<void()> func;
+		TaskGroup* group;
+	};
+	struct Worker {
+		std::mutex mutex;
+		std::deque<Task> tasks; // owner uses back, thieves use front
+	};
+	void push(const Task& task);
+	bool popTask(int worker_idx, Task& task);
+	bool executeTask(int worker_idx);
+	void workerLoop(int worker_idx);
+	int getWorkerIdx();
+
+	int thread_count;
+	std::vector<Worker*> workers; // workers[0] is shared by external threads
+	std::vector<std::thread> threads;
+	std::mutex sleep_mutex;
+	std::condition_variable sleep_cond;
+	std::atomic<int> queued_count;
+	bool exiting;
+};
+
+/* Parallel loop over [begin, end) in chunks of at least grain_size */
+void parallelFor(ThreadPool& pool, int begin, int end, int grain_size,
+                 const std::function<void(int, int)>& func);
+
+#endif
@@ -0,0 +1,146 @@
+#include "bvh_build.h"
+
+using namespace glm;
+using namespace std;
+
+/* Treelet restructuring (TRBVH)
+ *   Each internal node is a root of a treelet which is expanded to
+ *   treelet_size leaves by the largest surfaces. The best topology of the
+ *   treelet is found by dynamic programming over subsets of its leaves, and
+ *   its internal nodes are reused. Subtrees are processed before their
+ *   root (in parallel), so concurrent treelets never overlap. */
+
+struct TreeletContext {
+	BVHNodes* nodes;
+	float* costs; // unnormalized SAH cost of subtree (sum of cost * surface)
+	int treelet_size;
+	ThreadPool* pool;
+};
+
+float calcLeafCost(const BVHNodes& nodes, int node_idx){
+	float node_surface = surface(nodes.min_points[node_idx], nodes.max_points[node_idx]);
+	return TRI_TIME * (nodes.tri_ends[node_idx] - nodes.tri_starts[node_idx]) * node_surface;
+}
+
+void optimizeTreelet(TreeletContext& ctx, int root){
+	BVHNodes& nodes = *ctx.nodes;
+	const float* costs = ctx.costs;
+
+	// Form treelet (expand leaf of largest surface)
+	int leaves[MAX_TREELET_SIZE], internals[MAX_TREELET_SIZE - 1];
+	int leaf_count = 2, internal_count = 1;
+	leaves[0] = nodes.lefts[root];
+	leaves[1] = nodes.rights[root];
+	internals[0] = root;
+	while(leaf_count < ctx.treelet_size){
+		int best = -1;
+		float best_surface = -1;
+		for(int i = 0; i < leaf_count; i++){
+			if(nodes.isLeaf(leaves[i])) continue;
+			float leaf_surface = surface(nodes.min_points[leaves[i]], nodes.max_points[leaves[i]]);
+			if(leaf_surface > best_surface){
+				best_surface = leaf_surface;
+				best = i;
+			}
+		}
+		if(best < 0) break;
+		int node_idx = leaves[best];
+		internals[internal_count++] = node_idx;
+		leaves[best] = nodes.lefts[node_idx];
+		leaves[leaf_count++] = nodes.rights[node_idx];
+	}
+	if(leaf_count < 3) return;
+
+	// Bounds and best costs of leaf subsets
+	int subset_count = 1 << leaf_count;
+	vec3 min_points[1 << MAX_TREELET_SIZE], max_points[1 << MAX_TREELET_SIZE];
+	float subset_costs[1 << MAX_TREELET_SIZE];
+	int partitions[1 << MAX_TREELET_SIZE];
+	for(int mask = 1; mask < subset_count; mask++){
+		int low_bit = mask & -mask;
+		if(mask == low_bit){
+			int leaf = leaves[__builtin_ctz(mask)];
+			min_points[mask] = nodes.min_points[leaf];
+			max_points[mask] = nodes.max_points[leaf];
+			subset_costs[mask] = costs[leaf];
+			continue;
+		}
+		min_points[mask] = min(min_points[mask ^ low_bit], min_points[low_bit]);
+		max_points[mask] = max(max_points[mask ^ low_bit], max_points[low_bit]);
+		// Partitions with low bit in left (each pair once)
+		float best_cost = INFINITY;
+		int rest = mask ^ low_bit;
+		for(int sub = (rest - 1) & rest; ; sub = (sub - 1) & rest){
+			int left = sub | low_bit;
+			float cost = subset_costs[left] + subset_costs[mask ^ left];
+			if(cost < best_cost){
+				best_cost = cost;
+				partitions[mask] = left;
+			}
+			if(sub == 0) break;
+		}
+		subset_costs[mask] = 2 * AABB_TIME * surface(min_points[mask], max_points[mask]) + best_cost;
+	}
+
+	// Restructure only when improved
+	int all = subset_count - 1;
+	if(!(subset_costs[all] < costs[root] * (1 - 1e-5f))) return;
+	int masks[MAX_TREELET_SIZE - 1];
+	masks[0] = all;
+	int next_internal = 1;
+	for(int i = 0; i < internal_count; i++){
+		int node_idx = internals[i];
+		int mask = masks[i];
+		int children[2] = {partitions[mask], mask ^ partitions[mask]};
+		int child_idxs[2];
+		for(int c = 0; c < 2; c++){
+			if((children[c] & (children[c] - 1)) == 0){
+				child_idxs[c] = leaves[__builtin_ctz(children[c])];
+			} else {
+				masks[next_internal] = children[c];
+				child_idxs[c] = internals[next_internal++];
+			}
+		}
+		nodes.setInternal(node_idx, child_idxs[0], child_idxs[1]);
+		nodes.min_points[node_idx] = min_points[mask];
+		nodes.max_points[node_idx] = max_points[mask];
+		ctx.costs[node_idx] = subset_costs[mask];
+	}
+}
+
+void optimizeNode(TreeletContext& ctx, int node_idx, int depth){
+	BVHNodes& nodes = *ctx.nodes;
+	if(nodes.isLeaf(node_idx)){
+		ctx.costs[node_idx] = calcLeafCost(nodes, node_idx);
+		return;
+	}
+	//Children first (subtrees near root become tasks)
+	int left = nodes.lefts[node_idx], right = nodes.rights[node_idx];
+	if(depth < PARALLEL_SUBTREE_DEPTH){
+		TaskGroup tasks(*ctx.pool);
+		tasks.run([=, &ctx](){
+			optimizeNode(ctx, left, depth + 1);
+		});
+		optimizeNode(ctx, right, depth + 1);
+		tasks.wait();
+	} else {
+		optimizeNode(ctx, left, depth + 1);
+		optimizeNode(ctx, right, depth + 1);
+	}
+	float node_surface = surface(nodes.min_points[node_idx], nodes.max_points[node_idx]);
+	ctx.costs[node_idx] = 2 * AABB_TIME * node_surface + ctx.costs[left] + ctx.costs[right];
+	optimizeTreelet(ctx, node_idx);
+}
+
+void optimizeTreelets(BVHNodes& nodes, int treelet_size, int pass_count, ThreadPool& pool){
+	if(nodes.size() < 3) return;
+	vector<float> costs(nodes.size());
+	TreeletContext ctx;
+	ctx.nodes = &nodes;
+	ctx.costs = &costs[0];
+	ctx.treelet_size = std::min(std::max(treelet_size, 3), MAX_TREELET_SIZE);
+	ctx.pool = &pool;
+	for(int pass = 0; pass < pass_count; pass++){
+		optimizeNode(ctx, 0, 1);
+	}
+}
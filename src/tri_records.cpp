@@ -0,0 +1,68 @@
+#include "tri_records.h"
+
+#include <cmath>
+
+using namespace glm;
+using namespace std;
+
+const static char* TRI_RECORD_NAMES[] = {"vertices", "edges", "woop"};
+const static char* TRI_RECORD_DEFINES[] = {NULL, "TRI_RECORD_EDGES", "TRI_RECORD_WOOP"};
+
+bool getTriRecordType(const string& name, TriRecordType& type){
+	for(int i = 0; i < 3; i++){
+		if(name == TRI_RECORD_NAMES[i]){
+			type = (TriRecordType)i;
+			return true;
+		}
+	}
+	return false;
+}
+const char* getTriRecordName(TriRecordType type){
+	return TRI_RECORD_NAMES[type];
+}
+const char* getTriRecordDefine(TriRecordType type){
+	return TRI_RECORD_DEFINES[type];
+}
+
+/* Woop transform
+ *   Maps v0, v1, v2 to (0,0,0), (1,0,0), (0,1,0) and the normal to z, so a
+ *   hit is at z = 0 and its x, y are the barycentric u, v of Möller–Trumbore.
+ *   Degenerate triangles get zero rows (never hit). */
+void makeWoopRecord(const vec3* vertices, vec4* rows){
+	dvec3 v0(vertices[0]);
+	dvec3 edge0 = dvec3(vertices[1]) - v0;
+	dvec3 edge1 = dvec3(vertices[2]) - v0;
+	dvec3 normal = cross(edge0, edge1);
+	// Inverse of |edge0, edge1, normal| by cross products
+	double det = dot(edge0, cross(edge1, normal));
+	if(!(std::abs(det) > 0.0)){
+		rows[0] = rows[1] = rows[2] = vec4(0);
+		return;
+	}
+	dvec3 inv_rows[3] = {
+		cross(edge1, normal) / det,
+		cross(normal, edge0) / det,
+		cross(edge0, edge1) / det,
+	};
+	for(int i = 0; i < 3; i++){
+		rows[i] = vec4(vec3(inv_rows[i]), float(-dot(inv_rows[i], v0)));
+	}
+}
+
+void makeTriRecords(const SceneData& scene, TriRecordType type, vector<vec4>& records){
+	records.clear();
+	if(type == TRI_RECORD_VERTICES) return;
+	int tri_count = scene.info.tri_count;
+	records.resize(3 * tri_count);
+	for(int i = 0; i < tri_count; i++){
+		const vec3* vertices = &scene.triangles[3 * i];
+		if(type == TRI_RECORD_EDGES){
+			records[3*i+0] = vec4(vertices[0], 0);
+			records[3*i+1] = vec4(vertices[1] - vertices[0], 0);
+			records[3*i+2] = vec4(vertices[2] - vertices[0], 0);
+		} else {
+			makeWoopRecord(vertices, &records[3 * i]);
+		}
+	}
+	padTexRows(records, 3, TRI_TEX_COL);
+}
@@ -0,0 +1,31 @@
+#ifndef TRI_RECORDS_H_261017
+#define TRI_RECORDS_H_261017
+
+#include <vector>
+#include <string>
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include "scene.h"
+
+/* Precomputed triangle records for intersection tests
+ *   Made from triangles of a scene, so records of a leaf are contiguous as
+ *   its triangles. Each triangle has 3 RGBA texels in TRI_TEX_COL columns.
+ *   Vertices, normals and texcoords are still read for hit attributes. */
+
+enum TriRecordType {
+	TRI_RECORD_VERTICES, // no records (v0, v1, v2 of triangles)
+	TRI_RECORD_EDGES,    // v0, edge0, edge1 (Möller–Trumbore without subtractions)
+	TRI_RECORD_WOOP,     // rows of world to unit triangle transform (Woop)
+};
+
+// Name of type for options and shader define (false when unknown)
+bool getTriRecordType(const std::string& name, TriRecordType& type);
+const char* getTriRecordName(TriRecordType type);
+const char* getTriRecordDefine(TriRecordType type); // NULL for vertices
+
+// Records of every triangle (padded to texture rows, empty for vertices)
+void makeTriRecords(const SceneData& scene, TriRecordType type,
+                    std::vector<glm::vec4>& records);
+
+#endif
@@ -0,0 +1,115 @@
+#include "wide_bvh.h"
+
+#include <algorithm>
+
+using namespace glm;
+using namespace std;
+
+namespace {
+
+bool isBinaryLeaf(const SceneData& scene, int bbox_idx){
+	return scene.bbox_info[3 * bbox_idx] >= 0;
+}
+float getBinarySurface(const SceneData& scene, int bbox_idx){
+	return surface(scene.bbox_minmax[2 * bbox_idx], scene.bbox_minmax[2 * bbox_idx + 1]);
+}
+// Children of internal node (left is hit link, right is miss link of left)
+void getBinaryChildren(const SceneData& scene, int bbox_idx, int& left, int& right){
+	left = scene.bbox_info[3 * bbox_idx + 1];
+	right = scene.bbox_info[3 * left + 2];
+}
+
+// Binary nodes under bbox_idx which become children of one wide node
+//   (internal child of largest surface is opened until width is reached)
+int gatherWideChildren(const SceneData& scene, int bbox_idx, int width, int* children){
+	if(isBinaryLeaf(scene, bbox_idx)){
+		children[0] = bbox_idx;
+		return 1;
+	}
+	int count = 2;
+	getBinaryChildren(scene, bbox_idx, children[0], children[1]);
+	while(count < width){
+		int open_idx = -1;
+		float max_surface = -1;
+		for(int i = 0; i < count; i++){
+			if(isBinaryLeaf(scene, children[i])) continue;
+			float child_surface = getBinarySurface(scene, children[i]);
+			if(child_surface > max_surface){
+				max_surface = child_surface;
+				open_idx = i;
+			}
+		}
+		if(open_idx < 0) break; // all leaves
+		getBinaryChildren(scene, children[open_idx], children[open_idx], children[count]);
+		count++;
+	}
+	return count;
+}
+
+}
+
+void collapseBVH(const SceneData& scene, int width, WideBVH& wide){
+	wide.width = width;
+	wide.node_count = 0;
+	wide.max_depth = 0;
+	wide.bounds.clear();
+	wide.links.clear();
+	if(scene.info.bbox_count == 0) return;
+
+	// Nodes in depth first order (binary node, wide node idx, depth)
+	struct Task {
+		int bbox_idx, node_idx, depth;
+	};
+	vector<Task> stack(1);
+	stack[0].bbox_idx = 0;
+	stack[0].node_idx = wide.node_count++;
+	stack[0].depth = 1;
+	wide.bounds.resize(6 * width);
+	wide.links.resize(2 * width);
+	while(!stack.empty()){
+		Task task = stack.back();
+		stack.pop_back();
+		wide.max_depth = std::max(wide.max_depth, task.depth);
+
+		int children[WIDE_BVH_MAX_WIDTH];
+		int child_count = gatherWideChildren(scene, task.bbox_idx, width, children);
+		float* bounds = &wide.bounds[6 * width * task.node_idx];
+		int* links = &wide.links[2 * width * task.node_idx];
+		for(int c = 0; c < width; c++){
+			if(c >= child_count){
+				for(int i = 0; i < 6; i++) bounds[i * width + c] = WIDE_EMPTY_BOUND;
+				links[c] = -1;
+				links[width + c] = -1;
+				continue;
+			}
+			int bbox_idx = children[c];
+			vec3 min_point = scene.bbox_minmax[2 * bbox_idx + 0];
+			vec3 max_point = scene.bbox_minmax[2 * bbox_idx + 1];
+			for(int i = 0; i < 3; i++){
+				bounds[i * width + c] = min_point[i];
+				bounds[(3 + i) * width + c] = max_point[i];
+			}
+			if(isBinaryLeaf(scene, bbox_idx)){
+				links[c] = scene.bbox_info[3 * bbox_idx + 0];
+				links[width + c] = scene.bbox_info[3 * bbox_idx + 1];
+			} else {
+				Task child_task = {bbox_idx, wide.node_count++, task.depth + 1};
+				stack.push_back(child_task);
+				links[c] = -1;
+				links[width + c] = child_task.node_idx;
+				wide.bounds.resize(6 * width * wide.node_count);
+				wide.links.resize(2 * width * wide.node_count);
+				// Resized arrays may move
+				bounds = &wide.bounds[6 * width * task.node_idx];
+				links = &wide.links[2 * width * task.node_idx];
+			}
+		}
+	}
+	padTexRows(wide.bounds, 6 * width, BVH_TEX_COL);
+	padTexRows(wide.links, 2 * width, BVH_TEX_COL);
+}
+
+int getWideStackSize(const WideBVH& wide){
+	// Every node on the path keeps its other children
+	return wide.max_depth * (wide.width - 1) + 1;
+}
@@ -0,0 +1,39 @@
+#ifndef WIDE_BVH_H_261017
+#define WIDE_BVH_H_261017
+
+#include <vector>
+
+#include "scene.h"
+
+/* Wide BVH (BVH4, BVH8)
+ *   Collapsed from the serialized binary tree of a scene (bbox_minmax and
+ *   bbox_info), so it shares the triangle order of the scene and can also be
+ *   made from a cached scene. Each node stores bounds of its children in SoA
+ *   to test all of them at once, and is traversed with a stack in order of
+ *   child distance. */
+
+const static int WIDE_BVH_MAX_WIDTH = 8;
+// Bounds of empty child slot (missed by any ray)
+const static float WIDE_EMPTY_BOUND = 1e30f;
+
+struct WideBVH {
+	WideBVH() : width(2), node_count(0), max_depth(0) {}
+	int width;      // children per node (4 or 8)
+	int node_count;
+	int max_depth;  // wide nodes from root to deepest leaf
+	// |min x, min y, min z, max x, max y, max z| * width * node_idx
+	//   (as RGBA texels : one texel per axis of 4 children)
+	std::vector<float> bounds;
+	// |first, second| * width * node_idx
+	//   leaf : start and end triangle idx, internal : -1 and node idx,
+	//   empty : -1 and -1
+	std::vector<int> links;
+};
+
+// Collapse binary tree of scene into nodes of width children (padded to
+//   texture rows of BVH_TEX_COL nodes)
+void collapseBVH(const SceneData& scene, int width, WideBVH& wide);
+// Stack entries needed by ordered traversal
+int getWideStackSize(const WideBVH& wide);
+
+#endif
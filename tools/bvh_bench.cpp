@@ -0,0 +1,257 @@
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <cstdlib>
+#include <chrono>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include "bvh.h"
+#include "obj_loader.h"
+#include "memory_usage.h"
+
+using namespace glm;
+using namespace std;
+
+/* BVH build and quality benchmark
+ *   Builds a mesh with each builder and writes JSON of build time, memory
+ *   and tree quality. */
+
+const static int SWEEP_MAX_TRIS = 100000; // sweep builder is skipped above
+const static int LEAF_HIST_BUCKETS = 8; // 1, 2, 3-4, ..., 65-
+
+struct BenchCase {
+	string name;
+	BVHBuildSettings settings;
+};
+struct TreeStats {
+	int node_count, leaf_count, ref_count;
+	int max_depth;
+	double avg_leaf_depth;
+	double sah_cost;
+	double overlap_area, overlap_ratio; // sum of child box intersections (/ root surface)
+	int leaf_hist[LEAF_HIST_BUCKETS];
+};
+
+/* Tree statistics */
+int getLeafHistBucket(int leaf_size){
+	int bucket = 0;
+	for(int size = 1; size < leaf_size && bucket < LEAF_HIST_BUCKETS - 1; size *= 2) bucket++;
+	return bucket;
+}
+string getLeafHistLabel(int bucket){
+	stringstream label;
+	int max_size = 1 << bucket, min_size = max_size / 2 + 1;
+	if(bucket == LEAF_HIST_BUCKETS - 1) label << min_size << "-";
+	else if(min_size == max_size || bucket == 0) label << max_size;
+	else label << min_size << "-" << max_size;
+	return label.str();
+}
+float getOverlapSurface(const BVHNodes& nodes, int a, int b){
+	vec3 min_point = glm::max(nodes.min_points[a], nodes.min_points[b]);
+	vec3 max_point = glm::min(nodes.max_points[a], nodes.max_points[b]);
+	if(min_point.x > max_point.x || min_point.y > max_point.y || min_point.z > max_point.z){
+		return 0;
+	}
+	return surface(min_point, max_point);
+}
+void calcTreeStats(const BVH& bvh, TreeStats& stats){
+	const BVHNodes& nodes = bvh.getNodes();
+	stats.node_count = nodes.size();
+	stats.leaf_count = 0;
+	stats.ref_count = bvh.getTriRefs().size();
+	stats.max_depth = 0;
+	stats.avg_leaf_depth = 0;
+	stats.sah_cost = bvh.getSahCost();
+	stats.overlap_area = stats.overlap_ratio = 0;
+	for(int b = 0; b < LEAF_HIST_BUCKETS; b++) stats.leaf_hist[b] = 0;
+	if(nodes.size() == 0) return;
+
+	// Depth first walk with depth
+	vector<pair<int, int> > stack(1, make_pair(0, 1));
+	double leaf_depth_sum = 0;
+	while(!stack.empty()){
+		int node_idx = stack.back().first;
+		int depth = stack.back().second;
+		stack.pop_back();
+		stats.max_depth = std::max(stats.max_depth, depth);
+		if(nodes.isLeaf(node_idx)){
+			stats.leaf_count++;
+			leaf_depth_sum += depth;
+			int leaf_size = nodes.tri_ends[node_idx] - nodes.tri_starts[node_idx];
+			stats.leaf_hist[getLeafHistBucket(leaf_size)]++;
+		} else {
+			int left = nodes.lefts[node_idx], right = nodes.rights[node_idx];
+			stats.overlap_area += getOverlapSurface(nodes, left, right);
+			stack.push_back(make_pair(right, depth + 1));
+			stack.push_back(make_pair(left, depth + 1));
+		}
+	}
+	stats.avg_leaf_depth = leaf_depth_sum / stats.leaf_count;
+	float root_surface = surface(nodes.min_points[0], nodes.max_points[0]);
+	if(root_surface > 0) stats.overlap_ratio = stats.overlap_area / root_surface;
+}
+
+/* JSON */
+string quoteJson(const string& str){
+	stringstream quoted;
+	quoted << '"';
+	for(int i = 0; i < str.size(); i++){
+		char c = str[i];
+		if(c == '"' || c == '\\') quoted << '\\' << c;
+		else if((unsigned char)c < 0x20) quoted << ' ';
+		else quoted << c;
+	}
+	quoted << '"';
+	return quoted.str();
+}
+void writeCaseJson(ostream& os, const BenchCase& bench_case, double build_msec,
+                   size_t peak_rss, size_t base_rss, const TreeStats& stats){
+	os << "    {" << endl;
+	os << "      \"name\": " << quoteJson(bench_case.name) << "," << endl;
+	os << "      \"build_ms\": " << build_msec << "," << endl;
+	os << "      \"peak_memory_mb\": " << peak_rss / 1048576.0 << "," << endl;
+	os << "      \"build_memory_mb\": "
+	   << (peak_rss > base_rss ? peak_rss - base_rss : 0) / 1048576.0 << "," << endl;
+	os << "      \"nodes\": " << stats.node_count << "," << endl;
+	os << "      \"leaves\": " << stats.leaf_count << "," << endl;
+	os << "      \"triangle_refs\": " << stats.ref_count << "," << endl;
+	os << "      \"max_depth\": " << stats.max_depth << "," << endl;
+	os << "      \"avg_leaf_depth\": " << stats.avg_leaf_depth << "," << endl;
+	os << "      \"sah_cost\": " << stats.sah_cost << "," << endl;
+	os << "      \"overlap_area\": " << stats.overlap_area << "," << endl;
+	os << "      \"overlap_ratio\": " << stats.overlap_ratio << "," << endl;
+	os << "      \"leaf_size_histogram\": {";
+	for(int b = 0; b < LEAF_HIST_BUCKETS; b++){
+		os << (b ? ", " : "") << quoteJson(getLeafHistLabel(b)) << ": " << stats.leaf_hist[b];
+	}
+	os << "}" << endl;
+	os << "    }";
+}
+
+/* Command line */
+void printUsage(){
+	cerr << endl;
+	cerr << " > usage: ./bvh_bench [options] mesh.obj" << endl;
+	cerr << "     --threads <n>        : BVH build threads (default: all cores)" << endl;
+	cerr << "     --bins <n>           : SAH bins per axis (default: 32)" << endl;
+	cerr << "     --treelet-passes <n> : passes of optimized cases (default: 2)" << endl;
+	cerr << "     --sweep              : run sweep builder on any mesh size" << endl;
+	cerr << "     --output <file>      : JSON output (default: stdout)" << endl;
+	cerr << endl;
+}
+
+int main(int argc, char const* argv[]){
+	string obj_file, output_file;
+	BVHBuildSettings base_settings;
+	int treelet_passes = 2;
+	bool force_sweep = false;
+	for(int i = 1; i < argc; i++){
+		string arg = argv[i];
+		bool has_value = (i + 1 < argc);
+		if(arg == "--threads" && has_value) base_settings.thread_count = atoi(argv[++i]);
+		else if(arg == "--bins" && has_value) base_settings.bin_count = atoi(argv[++i]);
+		else if(arg == "--treelet-passes" && has_value) treelet_passes = atoi(argv[++i]);
+		else if(arg == "--sweep") force_sweep = true;
+		else if(arg == "--output" && has_value) output_file = argv[++i];
+		else if(arg.size() > 0 && arg[0] != '-' && obj_file.empty()) obj_file = arg;
+		else {
+			printUsage();
+			return 1;
+		}
+	}
+	if(obj_file.empty()){
+		printUsage();
+		return 1;
+	}
+
+	// Load obj (log to stderr to keep JSON on stdout)
+	vector<vec3> triangle_buff, normal_buff, material_buff;
+	vector<vec2> texcoord_buf;
+	vector<int> mat_idx_buff;
+	streambuf* cout_buf = cout.rdbuf(cerr.rdbuf());
+	bool loaded = loadObjFile(obj_file, triangle_buff, normal_buff, texcoord_buf,
+	                          mat_idx_buff, material_buff);
+	cout.rdbuf(cout_buf);
+	if(!loaded) return 1;
+	int tri_count = triangle_buff.size() / 3;
+	// Only positions are used
+	vector<vec3>().swap(normal_buff);
+	vector<vec2>().swap(texcoord_buf);
+
+	// Cases
+	vector<BenchCase> cases;
+	BenchCase bench_case;
+	bench_case.settings = base_settings;
+	if(tri_count <= SWEEP_MAX_TRIS || force_sweep){
+		bench_case.name = "sweep";
+		bench_case.settings.method = BVH_BUILD_SWEEP;
+		cases.push_back(bench_case);
+	}
+	bench_case.name = "binned";
+	bench_case.settings.method = BVH_BUILD_BINNED;
+	cases.push_back(bench_case);
+	bench_case.name = "sbvh";
+	bench_case.settings.method = BVH_BUILD_SPATIAL;
+	cases.push_back(bench_case);
+	bench_case.name = "hlbvh";
+	bench_case.settings.method = BVH_BUILD_LINEAR;
+	cases.push_back(bench_case);
+	bench_case.name = "lbvh";
+	bench_case.settings.sah_top_bits = 0;
+	cases.push_back(bench_case);
+	if(treelet_passes > 0){
+		stringstream suffix;
+		suffix << "+treelets" << treelet_passes;
+		bench_case.settings = base_settings;
+		bench_case.settings.treelet_passes = treelet_passes;
+		bench_case.name = "binned" + suffix.str();
+		bench_case.settings.method = BVH_BUILD_BINNED;
+		cases.push_back(bench_case);
+		bench_case.name = "lbvh" + suffix.str();
+		bench_case.settings.method = BVH_BUILD_LINEAR;
+		bench_case.settings.sah_top_bits = 0;
+		cases.push_back(bench_case);
+	}
+
+	// Output
+	ofstream ofs;
+	if(!output_file.empty()){
+		ofs.open(output_file.c_str());
+		if(!ofs){
+			cerr << "Failed to open output (" << output_file << ")." << endl;
+			return 1;
+		}
+	}
+	ostream& os = output_file.empty() ? cout : ofs;
+	os << "{" << endl;
+	os << "  \"mesh\": " << quoteJson(obj_file) << "," << endl;
+	os << "  \"triangles\": " << tri_count << "," << endl;
+	os << "  \"threads\": " << ThreadPool(base_settings.thread_count).getThreadCount() << "," << endl;
+	os << "  \"builders\": [" << endl;
+	for(int i = 0; i < cases.size(); i++){
+		cerr << "* " << cases[i].name << endl;
+		size_t base_rss = getCurrentRss();
+		resetPeakRss();
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		TreeStats stats;
+		double build_msec;
+		size_t peak_rss;
+		{
+			BVH bvh;
+			bvh.build(triangle_buff, cases[i].settings);
+			chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+			build_msec = elapsed.count();
+			peak_rss = getPeakRss();
+			calcTreeStats(bvh, stats);
+		}
+		writeCaseJson(os, cases[i], build_msec, peak_rss, base_rss, stats);
+		os << (i + 1 < cases.size() ? "," : "") << endl;
+	}
+	os << "  ]" << endl;
+	os << "}" << endl;
+	return 0;
+}
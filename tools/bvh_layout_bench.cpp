@@ -0,0 +1,415 @@
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <cstdlib>
+#include <cstdint>
+#include <chrono>
+#include <random>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include "bvh.h"
+#include "obj_loader.h"
+
+using namespace glm;
+using namespace std;
+
+/* Node fetch locality benchmark of BVH layouts
+ *   Traces rays with the stackless traversal of simple.fs over the
+ *   serialized arrays of each layout. The CPU path is timed and replayed
+ *   through a data cache model (ray after ray). The GPU path is replayed
+ *   through a texture cache model with rays of a warp stepping in lockstep.
+ *   Visited nodes are the same in every layout, only their places differ. */
+
+const static int BVH_TEX_COL = 512; // same as renderer
+const static int WARP_WIDTH = 8, WARP_HEIGHT = 4; // pixels per warp
+const static int TIMING_REPEATS = 3;
+// CPU model : 32 KiB, 8 way, 64 byte lines
+const static int CPU_CACHE_SETS = 64, CPU_CACHE_WAYS = 8, CPU_LINE_BYTES = 64;
+// GPU model : 16 KiB, 8 way, 4x4 texel tiles (16 byte texels)
+const static int GPU_CACHE_SETS = 8, GPU_CACHE_WAYS = 8, GPU_TILE_SIZE = 4;
+
+const float NEAR_ZERO = 1e-6;
+const float INFINITY_DIST = 1e5;
+
+/* Serialized tree (layout of renderer textures) */
+struct SerializedBvh {
+	vector<vec3> bbox_minmax; // |min, max| * bbox_idx
+	vector<int> bbox_info;    // |start_idx or -1, end_idx or hit_idx, miss_idx| * bbox_idx
+	vector<vec3> triangles;   // |v0,v1,v2| * tri_idx (bvh order)
+};
+void serializeBvh(const BVH& bvh, BVHLayout layout, const vector<vec3>& triangle_buff,
+                  SerializedBvh& serialized){
+	vector<int> tri_array, tri_idx_info, miss_idx_array;
+	bvh.getInfo(serialized.bbox_minmax, tri_array, tri_idx_info, miss_idx_array, layout);
+	int bbox_count = miss_idx_array.size();
+	serialized.bbox_info.resize(3 * bbox_count);
+	for(int i = 0; i < bbox_count; i++){
+		serialized.bbox_info[3*i+0] = tri_idx_info[2*i+0];
+		serialized.bbox_info[3*i+1] = tri_idx_info[2*i+1];
+		serialized.bbox_info[3*i+2] = miss_idx_array[i];
+	}
+	serialized.triangles.resize(3 * tri_array.size());
+	for(int i = 0; i < tri_array.size(); i++){
+		for(int v = 0; v < 3; v++){
+			serialized.triangles[3*i+v] = triangle_buff[3*tri_array[i]+v];
+		}
+	}
+}
+
+/* Traversal (same as simple.fs) */
+struct Ray {
+	vec3 org, dir;
+};
+struct RayState {
+	Ray ray;
+	int bbox_idx; // -1 : finished
+	float dist;
+};
+bool intersectBBox(const Ray& ray, const vec3& min_point, const vec3& max_point){
+	float t_far = INFINITY_DIST;
+	float t_near = -INFINITY_DIST;
+	for(int i = 0; i < 3; i++){
+		float t1 = (min_point[i] - ray.org[i]) / ray.dir[i];
+		float t2 = (max_point[i] - ray.org[i]) / ray.dir[i];
+		t_far = std::min(t_far, std::max(t1, t2));
+		t_near = std::max(t_near, std::min(t1, t2));
+		if(t_far < t_near) return false;
+	}
+	return true;
+}
+void intersectTriangle(const Ray& ray, const vec3* vertices, float& dist){
+	vec3 edge0 = vertices[1] - vertices[0];
+	vec3 edge1 = vertices[2] - vertices[0];
+	vec3 p = cross(ray.dir, edge1);
+	float det = dot(p, edge0);
+	if(-NEAR_ZERO < det && det < NEAR_ZERO) return;
+	float inv_det = 1.0f / det;
+	vec3 t = ray.org - vertices[0];
+	float u = dot(t, p) * inv_det;
+	if(u < 0.0f || 1.0f < u) return;
+	vec3 q = cross(t, edge0);
+	float v = dot(ray.dir, q) * inv_det;
+	if(v < 0.0f || 1.0f < u + v) return;
+	float hit_dist = dot(edge1, q) * inv_det;
+	if(NEAR_ZERO < hit_dist && hit_dist < dist) dist = hit_dist;
+}
+// Visit one node
+void stepRay(const SerializedBvh& bvh, RayState& state){
+	int bbox_idx = state.bbox_idx;
+	const int* info = &bvh.bbox_info[3 * bbox_idx];
+	if(intersectBBox(state.ray, bvh.bbox_minmax[2*bbox_idx], bvh.bbox_minmax[2*bbox_idx+1])){
+		if(info[0] < 0){
+			// hit link
+			state.bbox_idx = info[1];
+			return;
+		}
+		for(int tri_idx = info[0]; tri_idx < info[1]; tri_idx++){
+			intersectTriangle(state.ray, &bvh.triangles[3 * tri_idx], state.dist);
+		}
+	}
+	// miss link
+	state.bbox_idx = info[2];
+}
+
+/* Cache models (set associative LRU) */
+class CacheModel {
+public:
+	CacheModel(int set_count, int way_count)
+	    : set_count(set_count), way_count(way_count), time(0),
+	      tags(set_count * way_count, UINT64_MAX), used(set_count * way_count, 0),
+	      access_count(0), miss_count(0) {}
+	void access(uint64_t block){
+		access_count++;
+		time++;
+		int set = block % set_count;
+		uint64_t* set_tags = &tags[set * way_count];
+		uint64_t* set_used = &used[set * way_count];
+		int oldest = 0;
+		for(int w = 0; w < way_count; w++){
+			if(set_tags[w] == block){
+				set_used[w] = time;
+				return;
+			}
+			if(set_used[w] < set_used[oldest]) oldest = w;
+		}
+		miss_count++;
+		set_tags[oldest] = block;
+		set_used[oldest] = time;
+	}
+	long long getAccessCount() const { return access_count; }
+	long long getMissCount() const { return miss_count; }
+private:
+	int set_count, way_count;
+	uint64_t time;
+	vector<uint64_t> tags, used;
+	long long access_count, miss_count;
+};
+// Byte ranges of node arrays
+void accessCpuNode(CacheModel& cache, int bbox_idx){
+	const uint64_t INFO_BASE = 1ULL << 40;
+	uint64_t ranges[2][2] = {
+		{(uint64_t)bbox_idx * 2 * sizeof(vec3), (uint64_t)(bbox_idx + 1) * 2 * sizeof(vec3)},
+		{INFO_BASE + bbox_idx * 3 * sizeof(int), INFO_BASE + (bbox_idx + 1) * 3 * sizeof(int)},
+	};
+	for(int r = 0; r < 2; r++){
+		for(uint64_t line = ranges[r][0] / CPU_LINE_BYTES;
+		    line <= (ranges[r][1] - 1) / CPU_LINE_BYTES; line++){
+			cache.access(line);
+		}
+	}
+}
+// Texels of node textures (2 texels of bbox_minmax_tex, 3 texels of bbox_info_tex)
+void accessGpuNode(CacheModel& cache, int bbox_idx){
+	int col_idx = bbox_idx % BVH_TEX_COL;
+	int row_idx = bbox_idx / BVH_TEX_COL;
+	int texel_counts[2] = {2, 3};
+	for(int tex = 0; tex < 2; tex++){
+		int tiles_per_row = (texel_counts[tex] * BVH_TEX_COL) / GPU_TILE_SIZE;
+		int prev_tile = -1;
+		for(int t = 0; t < texel_counts[tex]; t++){
+			int x = texel_counts[tex] * col_idx + t;
+			int tile = (row_idx / GPU_TILE_SIZE) * tiles_per_row + x / GPU_TILE_SIZE;
+			if(tile == prev_tile) continue;
+			cache.access(((uint64_t)tex << 40) | tile);
+			prev_tile = tile;
+		}
+	}
+}
+
+/* Rays */
+struct RaySet {
+	string name;
+	vector<Ray> rays; // warp tile order
+};
+void makePrimaryRays(const vec3& min_point, const vec3& max_point, int size, RaySet& ray_set){
+	// Pinhole camera in front of +z side
+	vec3 center = (min_point + max_point) * 0.5f;
+	float extent = std::max(max_point.x - min_point.x, max_point.y - min_point.y);
+	vec3 org = center + vec3(0, 0, (max_point.z - center.z) + extent * 1.2f);
+	ray_set.name = "primary";
+	ray_set.rays.clear();
+	for(int wy = 0; wy < size; wy += WARP_HEIGHT){
+		for(int wx = 0; wx < size; wx += WARP_WIDTH){
+			for(int y = wy; y < std::min(wy + WARP_HEIGHT, size); y++){
+				for(int x = wx; x < std::min(wx + WARP_WIDTH, size); x++){
+					Ray ray;
+					ray.org = org;
+					ray.dir = normalize(vec3((x + 0.5f) / size - 0.5f, 0.5f - (y + 0.5f) / size, -1));
+					ray_set.rays.push_back(ray);
+				}
+			}
+		}
+	}
+}
+void makeDiffuseRays(const vec3& min_point, const vec3& max_point, int count, RaySet& ray_set){
+	// Random origins in scene and directions (incoherent bounces)
+	mt19937 rand_engine(1234);
+	uniform_real_distribution<float> dist(0.0f, 1.0f);
+	ray_set.name = "diffuse";
+	ray_set.rays.resize(count);
+	for(int i = 0; i < count; i++){
+		vec3 t(dist(rand_engine), dist(rand_engine), dist(rand_engine));
+		ray_set.rays[i].org = min_point + (max_point - min_point) * t;
+		float z = dist(rand_engine) * 2 - 1;
+		float phi = dist(rand_engine) * 2 * 3.14159265f;
+		float r = sqrt(std::max(0.0f, 1 - z * z));
+		ray_set.rays[i].dir = vec3(r * cos(phi), r * sin(phi), z);
+	}
+}
+
+/* Measurement */
+struct LocalityStats {
+	double nodes_per_ray;
+	double cpu_ns_per_ray;
+	double cpu_misses_per_ray;
+	double gpu_misses_per_ray;
+	double row_change_ratio; // next fetch in other texture row
+	double avg_link_distance; // |idx difference| of consecutive fetches
+};
+void measureLocality(const SerializedBvh& bvh, const RaySet& ray_set, LocalityStats& stats){
+	int ray_count = ray_set.rays.size();
+	vector<RayState> states(ray_count);
+	for(int i = 0; i < ray_count; i++){
+		states[i].ray = ray_set.rays[i];
+		states[i].bbox_idx = 0;
+		states[i].dist = INFINITY_DIST;
+	}
+
+	// CPU time (best of repeats)
+	stats.cpu_ns_per_ray = INFINITY;
+	for(int repeat = 0; repeat < TIMING_REPEATS; repeat++){
+		vector<RayState> timed_states = states;
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		for(int i = 0; i < ray_count; i++){
+			while(timed_states[i].bbox_idx >= 0) stepRay(bvh, timed_states[i]);
+		}
+		chrono::duration<double, nano> elapsed = chrono::steady_clock::now() - start;
+		stats.cpu_ns_per_ray = std::min(stats.cpu_ns_per_ray, elapsed.count() / ray_count);
+	}
+
+	// CPU cache (ray after ray)
+	CacheModel cpu_cache(CPU_CACHE_SETS, CPU_CACHE_WAYS);
+	long long row_changes = 0;
+	double link_distance = 0;
+	vector<RayState> cpu_states = states;
+	for(int i = 0; i < ray_count; i++){
+		RayState& state = cpu_states[i];
+		int prev_idx = 0;
+		while(state.bbox_idx >= 0){
+			int bbox_idx = state.bbox_idx;
+			accessCpuNode(cpu_cache, bbox_idx);
+			if(bbox_idx / BVH_TEX_COL != prev_idx / BVH_TEX_COL) row_changes++;
+			link_distance += abs(bbox_idx - prev_idx);
+			prev_idx = bbox_idx;
+			stepRay(bvh, state);
+		}
+	}
+	long long fetch_count = 0;
+	// GPU cache (rays of warp in lockstep)
+	CacheModel gpu_cache(GPU_CACHE_SETS, GPU_CACHE_WAYS);
+	int warp_size = WARP_WIDTH * WARP_HEIGHT;
+	for(int begin = 0; begin < ray_count; begin += warp_size){
+		int end = std::min(begin + warp_size, ray_count);
+		bool active = true;
+		while(active){
+			active = false;
+			for(int i = begin; i < end; i++){
+				if(states[i].bbox_idx < 0) continue;
+				accessGpuNode(gpu_cache, states[i].bbox_idx);
+				stepRay(bvh, states[i]);
+				fetch_count++;
+				active = true;
+			}
+		}
+	}
+	stats.nodes_per_ray = (double)fetch_count / ray_count;
+	stats.cpu_misses_per_ray = (double)cpu_cache.getMissCount() / ray_count;
+	stats.gpu_misses_per_ray = (double)gpu_cache.getMissCount() / ray_count;
+	stats.row_change_ratio = (double)row_changes / std::max(fetch_count, 1LL);
+	stats.avg_link_distance = link_distance / std::max(fetch_count, 1LL);
+}
+
+/* JSON */
+string quoteJson(const string& str){
+	stringstream quoted;
+	quoted << '"';
+	for(int i = 0; i < str.size(); i++){
+		char c = str[i];
+		if(c == '"' || c == '\\') quoted << '\\' << c;
+		else if((unsigned char)c < 0x20) quoted << ' ';
+		else quoted << c;
+	}
+	quoted << '"';
+	return quoted.str();
+}
+void writeStatsJson(ostream& os, const string& layout, const string& ray_set,
+                    const LocalityStats& stats){
+	os << "    {" << endl;
+	os << "      \"layout\": " << quoteJson(layout) << "," << endl;
+	os << "      \"rays\": " << quoteJson(ray_set) << "," << endl;
+	os << "      \"nodes_per_ray\": " << stats.nodes_per_ray << "," << endl;
+	os << "      \"cpu_ns_per_ray\": " << stats.cpu_ns_per_ray << "," << endl;
+	os << "      \"cpu_line_misses_per_ray\": " << stats.cpu_misses_per_ray << "," << endl;
+	os << "      \"gpu_tile_misses_per_ray\": " << stats.gpu_misses_per_ray << "," << endl;
+	os << "      \"row_change_ratio\": " << stats.row_change_ratio << "," << endl;
+	os << "      \"avg_link_distance\": " << stats.avg_link_distance << endl;
+	os << "    }";
+}
+
+/* Command line */
+void printUsage(){
+	cerr << endl;
+	cerr << " > usage: ./bvh_layout_bench [options] mesh.obj" << endl;
+	cerr << "     --bvh <binned|sbvh|linear> : BVH builder (default: binned)" << endl;
+	cerr << "     --treelet-passes <n> : treelet optimization passes (default: 0)" << endl;
+	cerr << "     --size <n>           : primary rays per side (default: 256)" << endl;
+	cerr << "     --output <file>      : JSON output (default: stdout)" << endl;
+	cerr << endl;
+}
+
+int main(int argc, char const* argv[]){
+	string obj_file, output_file;
+	BVHBuildSettings settings;
+	int size = 256;
+	for(int i = 1; i < argc; i++){
+		string arg = argv[i];
+		bool has_value = (i + 1 < argc);
+		if(arg == "--bvh" && has_value){
+			string method = argv[++i];
+			if(method == "binned") settings.method = BVH_BUILD_BINNED;
+			else if(method == "sbvh") settings.method = BVH_BUILD_SPATIAL;
+			else if(method == "linear") settings.method = BVH_BUILD_LINEAR;
+			else {
+				printUsage();
+				return 1;
+			}
+		}
+		else if(arg == "--treelet-passes" && has_value) settings.treelet_passes = atoi(argv[++i]);
+		else if(arg == "--size" && has_value) size = std::max(atoi(argv[++i]), 1);
+		else if(arg == "--output" && has_value) output_file = argv[++i];
+		else if(arg.size() > 0 && arg[0] != '-' && obj_file.empty()) obj_file = arg;
+		else {
+			printUsage();
+			return 1;
+		}
+	}
+	if(obj_file.empty()){
+		printUsage();
+		return 1;
+	}
+
+	// Load obj (log to stderr to keep JSON on stdout)
+	vector<vec3> triangle_buff, normal_buff, material_buff;
+	vector<vec2> texcoord_buf;
+	vector<int> mat_idx_buff;
+	streambuf* cout_buf = cout.rdbuf(cerr.rdbuf());
+	bool loaded = loadObjFile(obj_file, triangle_buff, normal_buff, texcoord_buf,
+	                          mat_idx_buff, material_buff);
+	cout.rdbuf(cout_buf);
+	if(!loaded || triangle_buff.empty()) return 1;
+
+	cerr << "* Building BVH." << endl;
+	BVH bvh;
+	bvh.build(triangle_buff, settings);
+	const BVHNodes& nodes = bvh.getNodes();
+	RaySet ray_sets[2];
+	makePrimaryRays(nodes.min_points[0], nodes.max_points[0], size, ray_sets[0]);
+	makeDiffuseRays(nodes.min_points[0], nodes.max_points[0], size * size, ray_sets[1]);
+
+	// Output
+	ofstream ofs;
+	if(!output_file.empty()){
+		ofs.open(output_file.c_str());
+		if(!ofs){
+			cerr << "Failed to open output (" << output_file << ")." << endl;
+			return 1;
+		}
+	}
+	ostream& os = output_file.empty() ? cout : ofs;
+	os << "{" << endl;
+	os << "  \"mesh\": " << quoteJson(obj_file) << "," << endl;
+	os << "  \"triangles\": " << triangle_buff.size() / 3 << "," << endl;
+	os << "  \"nodes\": " << bvh.getNodeCount() << "," << endl;
+	os << "  \"rays_per_set\": " << size * size << "," << endl;
+	os << "  \"results\": [" << endl;
+	BVHLayout layouts[] = {BVH_LAYOUT_DEPTH_FIRST, BVH_LAYOUT_VEB};
+	string layout_names[] = {"dfs", "veb"};
+	for(int l = 0; l < 2; l++){
+		SerializedBvh serialized;
+		serializeBvh(bvh, layouts[l], triangle_buff, serialized);
+		for(int r = 0; r < 2; r++){
+			cerr << "* " << layout_names[l] << ", " << ray_sets[r].name << endl;
+			LocalityStats stats;
+			measureLocality(serialized, ray_sets[r], stats);
+			writeStatsJson(os, layout_names[l], ray_sets[r].name, stats);
+			os << (l + r < 2 ? "," : "") << endl;
+		}
+	}
+	os << "  ]" << endl;
+	os << "}" << endl;
+	return 0;
+}
@@ -0,0 +1,413 @@
+#include <vector>
+#include <string>
+#include <iostream>
+#include <cstdlib>
+#include <cmath>
+#include <chrono>
+#include <random>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include "bvh.h"
+#include "camera.h"
+#include "scene.h"
+#include "scene_file.h"
+#include "cpu_renderer.h"
+#include "wide_bvh.h"
+#include "tri_records.h"
+#include "image_file.h"
+
+using namespace glm;
+using namespace std;
+
+/* Headless CPU renderer
+ *   Renders a mesh with the CPU reference of simple.fs from the default
+ *   camera of the renderer and writes the image after N samples per pixel.
+ *   With --scaling, the frames are rendered with each thread count.
+ *   With --wavefront, paths advance in stages over sorted ray queues.
+ *   With --target-error or --time, rendering stops before N samples when the
+ *   estimated noise of the image or the time budget is reached.
+ *   With --adaptive, frames sample only the noisiest pixels.
+ *   With --camera-rays, camera ray intersection of single rays (miss links
+ *   and distance ordered stack), wide BVH and packets is timed on one thread
+ *   instead, and with --triangle-tests, the triangle test of each triangle
+ *   record type. */
+
+/* Camera rays of spp frames
+ *   single rays of binary BVH (miss links and stack), of wide BVH (if given)
+ *   and packets of pixel blocks, compared with hits of the first one */
+int benchCameraRays(const SceneData& scene, const WideBVH* wide_bvh, int width, int height,
+                    FrameUniforms uniforms, int spp){
+	CpuRenderer renderer(scene, width, height, 1);
+	vector<CpuRay> rays;
+	for(int by = 0; by < height; by += CPU_PACKET_HEIGHT){
+		for(int bx = 0; bx < width; bx += CPU_PACKET_WIDTH){
+			for(int lane = 0; lane < SIMD_WIDTH; lane++){
+				int x = std::min(bx + lane % CPU_PACKET_WIDTH, width - 1);
+				int y = std::min(by + lane / CPU_PACKET_WIDTH, height - 1);
+				vec3 dir = normalize(uniforms.camera_dir_base + (x + 0.5f) * uniforms.camera_xvec -
+				                     (y + 0.5f) * uniforms.camera_yvec);
+				CpuRay ray = {uniforms.camera_org, dir};
+				rays.push_back(ray);
+			}
+		}
+	}
+	cout << "* Tracing " << rays.size() << " camera rays x " << spp << ", packets of "
+	     << SIMD_WIDTH << " (" << CPU_PACKET_WIDTH << "x" << CPU_PACKET_HEIGHT << ")." << endl;
+	const int MODE_COUNT = 4;
+	string mode_names[MODE_COUNT] = {"single", "stack", "wide", "packet"};
+	double base_mrays = 0;
+	vector<CpuHit> base_hits, hits(rays.size());
+	for(int mode = 0; mode < MODE_COUNT; mode++){
+		if(mode == 1 && !renderer.setStackTraversal(true)){
+			cout << " >> stack: BVH is too deep for traversal stack" << endl;
+			continue;
+		}
+		if(mode == 2 && !wide_bvh) continue;
+		renderer.setStackTraversal(mode == 1);
+		renderer.setWideBVH(mode == 2 ? wide_bvh : NULL);
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		for(int frame = 0; frame < spp; frame++){
+			for(size_t i = 0; i < rays.size(); i += SIMD_WIDTH){
+				if(mode < 3){
+					for(int lane = 0; lane < SIMD_WIDTH; lane++){
+						hits[i + lane] = renderer.traceHit(rays[i + lane]);
+					}
+				} else {
+					renderer.intersectPacket(&rays[i], (1 << SIMD_WIDTH) - 1, &hits[i]);
+				}
+			}
+		}
+		chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+		double mrays = rays.size() * spp / elapsed.count() * 1e-6;
+
+		// Fetched nodes (packets share theirs)
+		double node_count = 0;
+		for(size_t i = 0; i < rays.size(); i += (mode < 3) ? 1 : SIMD_WIDTH){
+			node_count += hits[i].node_count;
+		}
+		int mismatch_count = 0;
+		if(mode == 0){
+			base_mrays = mrays;
+			base_hits = hits;
+		}
+		for(size_t i = 0; i < rays.size(); i++){
+			bool base_hit = base_hits[i].dist < CPU_INFINITY;
+			bool hit = hits[i].dist < CPU_INFINITY;
+			if(base_hit != hit || (hit && base_hits[i].tri_idx != hits[i].tri_idx)){
+				mismatch_count++;
+			}
+		}
+		cout << " >> " << mode_names[mode] << ": " << mrays << " Mrays/s (speedup "
+		     << mrays / base_mrays << "), " << node_count / rays.size() << " nodes per ray, "
+		     << mismatch_count << " different hits" << endl;
+	}
+	return 0;
+}
+
+/* Triangle tests of camera rays
+ *   Each ray tests a run of TRIANGLE_TEST_RUN triangles (as a leaf) which
+ *   starts at its hit triangle, with each triangle record type. Hits are
+ *   compared with vertices. */
+const static int TRIANGLE_TEST_RUN = 32;
+int benchTriangleTests(const SceneData& scene, const WideBVH* wide_bvh, int width, int height,
+                       FrameUniforms uniforms, int spp){
+	CpuRenderer renderer(scene, width, height, 1);
+	renderer.setWideBVH(wide_bvh);
+	vector<CpuRay> rays;
+	vector<int> starts;
+	for(int y = 0; y < height; y++){
+		for(int x = 0; x < width; x++){
+			vec3 dir = normalize(uniforms.camera_dir_base + (x + 0.5f) * uniforms.camera_xvec -
+			                     (y + 0.5f) * uniforms.camera_yvec);
+			CpuRay ray = {uniforms.camera_org, dir};
+			CpuHit hit = renderer.traceHit(ray);
+			int start = (hit.dist < CPU_INFINITY) ? hit.tri_idx : 0;
+			start = std::max(std::min(start, scene.info.tri_count - TRIANGLE_TEST_RUN), 0);
+			rays.push_back(ray);
+			starts.push_back(start);
+		}
+	}
+	int run = std::min(TRIANGLE_TEST_RUN, scene.info.tri_count);
+	cout << "* Testing " << rays.size() << " camera rays x " << spp << " against " << run
+	     << " triangles." << endl;
+	const int TYPE_COUNT = 3;
+	double base_mtests = 0;
+	vector<CpuHit> base_hits, hits(rays.size());
+	vector<vec4> records;
+	for(int type = 0; type < TYPE_COUNT; type++){
+		makeTriRecords(scene, (TriRecordType)type, records);
+		renderer.setTriRecords((TriRecordType)type, records.empty() ? NULL : &records[0]);
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		for(int frame = 0; frame < spp; frame++){
+			for(size_t i = 0; i < rays.size(); i++){
+				CpuHit hit = {CPU_INFINITY, 0, 0, 0, 0};
+				renderer.testTriangles(rays[i], starts[i], starts[i] + run, hit);
+				hits[i] = hit;
+			}
+		}
+		chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+		double mtests = double(rays.size()) * spp * run / elapsed.count() * 1e-6;
+
+		int mismatch_count = 0;
+		double max_dist_error = 0;
+		if(type == 0){
+			base_mtests = mtests;
+			base_hits = hits;
+		}
+		for(size_t i = 0; i < rays.size(); i++){
+			bool base_hit = base_hits[i].dist < CPU_INFINITY;
+			bool hit = hits[i].dist < CPU_INFINITY;
+			if(base_hit != hit || (hit && base_hits[i].tri_idx != hits[i].tri_idx)){
+				mismatch_count++;
+			} else if(hit){
+				double error = std::abs(hits[i].dist - base_hits[i].dist) / base_hits[i].dist;
+				max_dist_error = std::max(max_dist_error, error);
+			}
+		}
+		cout << " >> " << getTriRecordName((TriRecordType)type) << ": " << mtests
+		     << " Mtests/s (speedup " << mtests / base_mtests << "), " << mismatch_count
+		     << " different hits, max relative distance error " << max_dist_error << endl;
+	}
+	return 0;
+}
+
+/* Command line */
+void printUsage(){
+	cerr << endl;
+	cerr << " > usage: ./cpu_render [options] [mesh.obj or scene.scene]" << endl;
+	cerr << "     --spp <n>              : samples (frames) per pixel (default: 16)" << endl;
+	cerr << "     --target-error <f>     : relative error of image to stop before spp"
+	     << " (default: 0, none)" << endl;
+	cerr << "     --time <sec>           : time budget to stop before spp (default: 0, none)"
+	     << endl;
+	cerr << "     --adaptive <f>         : samples per pixel of each frame, given to noisiest"
+	     << " pixels (default: 1, every pixel)" << endl;
+	cerr << "     --width <n>            : image width (default: 360)" << endl;
+	cerr << "     --height <n>           : image height (default: 240)" << endl;
+	cerr << "     --output <file>        : .ppm, .png, .pfm or .exr image"
+	     << " (default: render.ppm)" << endl;
+	cerr << "     --seed <n>             : seed of frame random values (default: 0)" << endl;
+	cerr << "     --threads <n>          : render threads (default: all cores)" << endl;
+	cerr << "     --pixel-random         : random values of each pixel (default: of each"
+	     << " frame, as shader)" << endl;
+	cerr << "     --scaling              : report Mrays/s of 1, 2, 4, ... threads" << endl;
+	cerr << "     --packets              : trace camera and shadow rays in SIMD packets"
+	     << " (" << SIMD_WIDTH << " lanes)" << endl;
+	cerr << "     --wavefront <none|octant|cell> : render in wavefront stages, queues sorted"
+	     << " by direction octant and origin cell" << endl;
+	cerr << "     --camera-rays          : compare Mrays/s of single, stack, wide BVH and packet"
+	     << " camera rays" << endl;
+	cerr << "     --triangle-tests       : compare Mtests/s of triangle record types" << endl;
+	cerr << "     --tri-records <vertices|edges|woop> : triangle records of single rays"
+	     << " (default: vertices)" << endl;
+	cerr << "     --bvh <binned|sbvh|linear> : BVH builder (default: binned)" << endl;
+	cerr << "     --bvh-layout <dfs|veb> : node order (default: dfs)" << endl;
+	cerr << "     --bvh-width <2|4|8>    : children per node of single ray traversal"
+	     << " (default: 2)" << endl;
+	cerr << "     --bvh-traversal <stackless|stack> : binary BVH traversal of single rays"
+	     << " (default: stackless)" << endl;
+	cerr << endl;
+}
+
+int main(int argc, char const* argv[]){
+	string obj_file = "../data/CornellBox-Sphere.obj";
+	string output_file = "render.ppm";
+	int spp = 16, width = 360, height = 240;
+	double target_error = 0, time_budget = 0;
+	float adaptive_ratio = 0;
+	unsigned int seed = 0;
+	int thread_count = 0;
+	bool pixel_random = false, scaling = false, packets = false, camera_rays = false;
+	bool triangle_tests = false, wavefront = false, stack_traversal = false;
+	CpuRaySort wavefront_sort = CPU_SORT_CELL;
+	TriRecordType tri_record_type = TRI_RECORD_VERTICES;
+	int bvh_width = 2;
+	BVHBuildSettings settings;
+	BVHLayout layout = BVH_LAYOUT_DEPTH_FIRST;
+	for(int i = 1; i < argc; i++){
+		string arg = argv[i];
+		bool has_value = (i + 1 < argc);
+		if(arg == "--spp" && has_value) spp = std::max(atoi(argv[++i]), 1);
+		else if(arg == "--target-error" && has_value) target_error = atof(argv[++i]);
+		else if(arg == "--time" && has_value) time_budget = atof(argv[++i]);
+		else if(arg == "--adaptive" && has_value) adaptive_ratio = atof(argv[++i]);
+		else if(arg == "--width" && has_value) width = std::max(atoi(argv[++i]), 1);
+		else if(arg == "--height" && has_value) height = std::max(atoi(argv[++i]), 1);
+		else if(arg == "--output" && has_value) output_file = argv[++i];
+		else if(arg == "--seed" && has_value) seed = atoi(argv[++i]);
+		else if(arg == "--threads" && has_value) thread_count = atoi(argv[++i]);
+		else if(arg == "--pixel-random") pixel_random = true;
+		else if(arg == "--scaling") scaling = true;
+		else if(arg == "--packets") packets = true;
+		else if(arg == "--camera-rays") camera_rays = true;
+		else if(arg == "--triangle-tests") triangle_tests = true;
+		else if(arg == "--wavefront" && has_value){
+			string sort = argv[++i];
+			wavefront = true;
+			if(sort == "none") wavefront_sort = CPU_SORT_NONE;
+			else if(sort == "octant") wavefront_sort = CPU_SORT_OCTANT;
+			else if(sort == "cell") wavefront_sort = CPU_SORT_CELL;
+			else {
+				printUsage();
+				return 1;
+			}
+		}
+		else if(arg == "--tri-records" && has_value){
+			if(!getTriRecordType(argv[++i], tri_record_type)){
+				printUsage();
+				return 1;
+			}
+		}
+		else if(arg == "--bvh-width" && has_value){
+			bvh_width = atoi(argv[++i]);
+			if(bvh_width != 2 && bvh_width != 4 && bvh_width != 8){
+				printUsage();
+				return 1;
+			}
+		}
+		else if(arg == "--bvh-traversal" && has_value){
+			string traversal = argv[++i];
+			if(traversal == "stackless") stack_traversal = false;
+			else if(traversal == "stack") stack_traversal = true;
+			else {
+				printUsage();
+				return 1;
+			}
+		}
+		else if(arg == "--bvh" && has_value){
+			string method = argv[++i];
+			if(method == "binned") settings.method = BVH_BUILD_BINNED;
+			else if(method == "sbvh") settings.method = BVH_BUILD_SPATIAL;
+			else if(method == "linear") settings.method = BVH_BUILD_LINEAR;
+			else {
+				printUsage();
+				return 1;
+			}
+		} else if(arg == "--bvh-layout" && has_value){
+			string layout_name = argv[++i];
+			if(layout_name == "dfs") layout = BVH_LAYOUT_DEPTH_FIRST;
+			else if(layout_name == "veb") layout = BVH_LAYOUT_VEB;
+			else {
+				printUsage();
+				return 1;
+			}
+		}
+		else if(arg.size() > 0 && arg[0] != '-') obj_file = arg;
+		else {
+			printUsage();
+			return 1;
+		}
+	}
+
+	// Scene (same arrays as renderer textures)
+	ObjBuffers obj_buffs;
+	SceneBuffers scene_buffs;
+	BVHCacheFile scene_file; // owner of mapped scene file
+	SceneData scene;
+	if(isSceneFile(obj_file)){
+		cout << "* Loading scene file." << endl;
+		if(!loadSceneFile(obj_file, getSceneLayoutKey(), scene_file, scene)){
+			cerr << "Failed to load scene file (" << obj_file << ")." << endl;
+			return 1;
+		}
+	} else {
+		cout << "* Loading obj file." << endl;
+		ObjAttributes obj_attributes; // expanded after BVH build
+		if(!loadObjScene(obj_file, obj_buffs, obj_attributes, scene_buffs.info)) return 1;
+		cout << "* Building BVH." << endl;
+		BVH bvh;
+		bvh.build(obj_buffs.triangle_buff, settings);
+		expandObjScene(obj_attributes, obj_buffs);
+		orderScene(bvh, layout, std::move(obj_buffs), scene_buffs);
+		setSceneData(scene_buffs, scene);
+	}
+	cout << " >> " << scene.info.tri_count << " triangles, " << scene.info.bbox_count
+	     << " bboxes" << endl;
+
+	// Render
+	Camera camera;
+	FrameUniforms uniforms;
+	uniforms.camera_org = camera.getOrg();
+	camera.getScreenInf(width, height, uniforms.camera_dir_base, uniforms.camera_xvec,
+	                    uniforms.camera_yvec);
+	WideBVH wide_bvh;
+	if(bvh_width > 2){
+		collapseBVH(scene, bvh_width, wide_bvh);
+		cout << " >> " << wide_bvh.node_count << " nodes of BVH" << bvh_width << ", depth "
+		     << wide_bvh.max_depth << endl;
+	}
+	if(camera_rays){
+		return benchCameraRays(scene, (bvh_width > 2) ? &wide_bvh : NULL, width, height,
+		                       uniforms, spp);
+	}
+	if(triangle_tests){
+		return benchTriangleTests(scene, (bvh_width > 2) ? &wide_bvh : NULL, width, height,
+		                          uniforms, spp);
+	}
+	vector<vec4> tri_records;
+	makeTriRecords(scene, tri_record_type, tri_records);
+	vector<int> thread_counts;
+	int max_threads = ThreadPool(thread_count).getThreadCount();
+	if(scaling){
+		for(int n = 1; n < max_threads; n *= 2) thread_counts.push_back(n);
+	}
+	thread_counts.push_back(max_threads);
+	double base_mrays = 0;
+	vector<vec3> pixels;
+	for(int t = 0; t < thread_counts.size(); t++){
+		cout << "* Rendering " << width << "x" << height << ", " << spp << " spp, "
+		     << thread_counts[t] << " threads." << endl;
+		mt19937 rand_engine(seed);
+		uniform_real_distribution<float> rand_dist(0.0f, 1.0f);
+		CpuRenderer renderer(scene, width, height, thread_counts[t]);
+		renderer.setPixelRandom(pixel_random, seed);
+		renderer.setPacketTraversal(packets);
+		renderer.setWavefront(wavefront, wavefront_sort);
+		renderer.setAdaptiveSampling(adaptive_ratio);
+		if(bvh_width > 2 && !renderer.setWideBVH(&wide_bvh)){
+			cerr << "BVH" << bvh_width << " is too deep for traversal stack, binary BVH is"
+			     << " used." << endl;
+		}
+		if(stack_traversal && !renderer.setStackTraversal(true)){
+			cerr << "BVH is too deep for traversal stack, miss links are used." << endl;
+		}
+		renderer.setTriRecords(tri_record_type, tri_records.empty() ? NULL : &tri_records[0]);
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		ImageNoise noise = {0, 0, 0};
+		for(int frame = 0; frame < spp; frame++){
+			uniforms.rand_vec2_a = vec2(rand_dist(rand_engine), rand_dist(rand_engine));
+			uniforms.rand_vec2_b = vec2(rand_dist(rand_engine), rand_dist(rand_engine));
+			uniforms.rand_vec3 = vec3(rand_dist(rand_engine), rand_dist(rand_engine),
+			                          rand_dist(rand_engine));
+			renderer.renderFrame(uniforms);
+			// Stop at target error or time budget
+			chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+			if(time_budget > 0 && elapsed.count() >= time_budget) break;
+			if(target_error > 0){
+				noise = estimateImageNoise(renderer.getPixels(), renderer.getMoments(),
+				                           renderer.getSampleCounts());
+				if(noise.relative_error > 0 && noise.relative_error <= target_error) break;
+			}
+		}
+		chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+		double sec = elapsed.count();
+		double mrays = renderer.getRayCount() / sec * 1e-6;
+		double samples = renderer.getSampleCount();
+		if(t == 0) base_mrays = mrays;
+		cout << " >> " << sec * 1000 << " ms, " << mrays << " Mrays/s ("
+		     << mrays / thread_counts[t] << " per thread, speedup " << mrays / base_mrays
+		     << "), " << samples / sec * 1e-6 << " Msamples/s" << endl;
+		noise = estimateImageNoise(renderer.getPixels(), renderer.getMoments(),
+		                           renderer.getSampleCounts());
+		cout << " >> " << renderer.getAccumFrame() << " frames, " << samples / (width * height)
+		     << " spp, noise " << noise.std_error << " (relative error "
+		     << noise.relative_error << ")" << endl;
+		pixels = renderer.getPixels();
+	}
+
+	if(!writeImageFile(output_file, width, height, pixels)) return 1;
+	cout << "* Wrote " << output_file << "." << endl;
+	return 0;
+}
@@ -0,0 +1,107 @@
+#include <vector>
+#include <string>
+#include <iostream>
+#include <cstdlib>
+#include <chrono>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include "bvh.h"
+#include "scene.h"
+#include "scene_file.h"
+#include "memory_usage.h"
+
+using namespace glm;
+using namespace std;
+
+/* Scene converter
+ *   Loads an obj file, builds its BVH and writes the BVH ordered arrays as a
+ *   binary scene file, which the renderer and cpu_render map and upload as
+ *   they are (startup without parsing or building). */
+
+void printUsage(){
+	cerr << endl;
+	cerr << " > usage: ./scene_convert [options] <mesh.obj> <output.scene>" << endl;
+	cerr << "     --bvh <sweep|binned|sbvh|linear> : BVH builder (default: binned)" << endl;
+	cerr << "     --bvh-bins <n>         : SAH bins per axis (default: 32)" << endl;
+	cerr << "     --bvh-threads <n>      : BVH build threads (default: all cores)" << endl;
+	cerr << "     --bvh-layout <dfs|veb> : node order (default: dfs)" << endl;
+	cerr << endl;
+}
+
+double getElapsedMsec(chrono::steady_clock::time_point start){
+	chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+	return elapsed.count();
+}
+
+int main(int argc, char const* argv[]){
+	vector<string> files;
+	BVHBuildSettings settings;
+	BVHLayout layout = BVH_LAYOUT_DEPTH_FIRST;
+	for(int i = 1; i < argc; i++){
+		string arg = argv[i];
+		bool has_value = (i + 1 < argc);
+		if(arg == "--bvh" && has_value){
+			string method = argv[++i];
+			if(method == "sweep") settings.method = BVH_BUILD_SWEEP;
+			else if(method == "binned") settings.method = BVH_BUILD_BINNED;
+			else if(method == "sbvh") settings.method = BVH_BUILD_SPATIAL;
+			else if(method == "linear") settings.method = BVH_BUILD_LINEAR;
+			else {
+				printUsage();
+				return 1;
+			}
+		}
+		else if(arg == "--bvh-bins" && has_value){
+			settings.bin_count = std::max(std::min(atoi(argv[++i]), MAX_BIN_COUNT),
+			                              MIN_BIN_COUNT);
+		}
+		else if(arg == "--bvh-threads" && has_value) settings.thread_count = atoi(argv[++i]);
+		else if(arg == "--bvh-layout" && has_value){
+			string layout_name = argv[++i];
+			if(layout_name == "dfs") layout = BVH_LAYOUT_DEPTH_FIRST;
+			else if(layout_name == "veb") layout = BVH_LAYOUT_VEB;
+			else {
+				printUsage();
+				return 1;
+			}
+		}
+		else if(arg.size() > 0 && arg[0] != '-') files.push_back(arg);
+		else {
+			printUsage();
+			return 1;
+		}
+	}
+	if(files.size() != 2){
+		printUsage();
+		return 1;
+	}
+
+	cout << "* Loading obj file." << endl;
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	ObjBuffers obj_buffs;
+	ObjAttributes obj_attributes; // expanded after BVH build
+	SceneBuffers scene_buffs;
+	if(!loadObjScene(files[0], obj_buffs, obj_attributes, scene_buffs.info)) return 1;
+	cout << " >> " << obj_buffs.triangle_buff.size() / 3 << " triangles ("
+	     << getElapsedMsec(start) << " ms)" << endl;
+
+	cout << "* Building BVH." << endl;
+	start = chrono::steady_clock::now();
+	BVH bvh;
+	bvh.build(obj_buffs.triangle_buff, settings);
+	expandObjScene(obj_attributes, obj_buffs);
+	orderScene(bvh, layout, std::move(obj_buffs), scene_buffs);
+	bvh.release();
+	cout << " >> " << scene_buffs.info.bbox_count << " bboxes (" << getElapsedMsec(start)
+	     << " ms)" << endl;
+
+	cout << "* Writing scene file." << endl;
+	if(!writeSceneFile(files[1], getSceneLayoutKey(), scene_buffs)){
+		cerr << "Failed to write scene file (" << files[1] << ")." << endl;
+		return 1;
+	}
+	cout << " >> " << files[1] << ", peak memory " << (getPeakRss() >> 20) << " MB" << endl;
+	return 0;
+}